@@ -160,11 +160,19 @@ class UT():
 
 
     # We want shorthand in descriptions, ie. "state"
-    # instead of "booth_conf->ticket[0].state".
-    def translate_shorthand(self, name, context):
+    # instead of "booth_conf->hot[0].state".
+    def translate_shorthand(self, name, context, msg_type=None):
         if context == 'ticket':
+            # kept in per-ticket arrays, see struct booth_config
+            if name in ("next_cron",):
+                return "booth_conf->" + name + "[0]"
+            if name in ("state", "term_expires",
+                    "acks_expected", "acks_received"):
+                return "booth_conf->hot[0]." + name
             return "booth_conf->ticket[0]." + name
         if context == 'message':
+            if msg_type:
+                return "((" + msg_type + " *)msg)->" + name
             return "msg->" + name
         if context == 'inject':
             return "ntohl(((struct boothc_ticket_msg *)buf)->" + name + ")"
@@ -245,7 +253,7 @@ class UT():
 
         # Only stop for this recipient, so that broadcasts are not seen multiple times
         self.send_cmd("break booth_udp_send if to == &(booth_conf->site[1])")
-        self.send_cmd("break recvfrom")
+        self.send_cmd("break recvmsg")
         # ticket_cron is still a breakpoint
 
         # Now we're set up.
@@ -405,19 +413,31 @@ class UT():
                 self.user_debug("Didn't stop in function %s" % fn)
         logging.info("Now in %s" % fn)
 
+    # Messages other than struct boothc_ticket_msg name their "type";
+    # of the defaults, they only get the header.
+    def message_defaults(self, defaults, msg):
+        if not msg.has_key("type"):
+            return defaults
+        return dict(filter(lambda kv: kv[0].startswith("header."),
+            defaults.items()))
+
     # We break, change the data, and return the correct size.
     def send_message(self, msg):
+        msg_type = msg.pop("type", None)
         self.udp_sock.sendto('a', (socket.gethostbyname(self.this_site), self.this_port))
 
-        self.wait_for_function("recvfrom")
-        # drain input, but stop afterwards for changing data
-        self.send_cmd("finish")
+        self.wait_for_function("recvmsg")
+        # drain input, but stop afterwards for changing data;
+        # uring_recvmsg() may be in between
+        for i in range(3):
+            if re.search(r"\bprocess_recv \(", self.send_cmd("finish")):
+                break
         # step over length assignment
         self.send_cmd("next")
         
         # push message.
         for (n, v) in msg.iteritems():
-            self.set_val( self.translate_shorthand(n, "message"), v, "htonl")
+            self.set_val( self.translate_shorthand(n, "message", msg_type), v, "htonl")
 
         # set "received" length
         self.set_val("rv", "msg->header.length", "ntohl")
@@ -475,7 +495,8 @@ class UT():
                 self.current_nr = msg.aux.get("line")
                 comment = msg.aux.get("comment", "")
                 logging.info("sending %s  (%s:%d)  %s" % (kmsg, fn, self.current_nr, comment))
-                self.send_message(self.merge_dicts(data["message"], msg))
+                self.send_message(self.merge_dicts(
+                    self.message_defaults(data["message"], msg), msg))
             if gdb:
                 for (k, v) in gdb.iteritems():
                     self.send_cmd(k + " " + v.replace("§", "\n"))
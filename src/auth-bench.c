@@ -0,0 +1,96 @@
+/* 
+ * Copyright (C) 2026 agent <agent@local>
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Measures what signing and checking a ticket message costs, see
+ * auth.c. Not installed; "make auth-bench", then
+ *	./auth-bench [messages]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "booth.h"
+#include "config.h"
+#include "auth.h"
+
+/* what auth.c needs from the rest of boothd */
+struct booth_config *booth_conf;
+struct booth_site *local;
+
+static struct booth_site peer;
+
+int find_site_by_id(uint32_t site_id, struct booth_site **node)
+{
+	*node = &peer;
+	return 1;
+}
+
+const char *shard_file_name(void)
+{
+	return "auth-bench";
+}
+
+
+static double elapsed_ns(struct timespec *t0, struct timespec *t1)
+{
+	return (t1->tv_sec - t0->tv_sec) * 1e9 + (t1->tv_nsec - t0->tv_nsec);
+}
+
+int main(int argc, char *argv[])
+{
+	static struct booth_config conf;
+	struct boothc_ticket_msg msg;
+	struct timespec t0, t1, t2;
+	long i, n;
+
+	n = argc > 1 ? atol(argv[1]) : 1000000;
+	if (n <= 0) {
+		fprintf(stderr, "usage: %s [messages]\n", argv[0]);
+		return 1;
+	}
+
+	booth_conf = &conf;
+	conf.auth = 1;
+	memset(conf.authkey, 0x5a, sizeof(conf.authkey));
+	local = &peer;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.header.from = htonl(1);
+	msg.header.length = htonl(sizeof(msg));
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++)
+		auth_sign(&msg.header, sizeof(msg));
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	for (i = 0; i < n; i++) {
+		auth_sign(&msg.header, sizeof(msg));
+		if (auth_verify(&msg.header, sizeof(msg))) {
+			fprintf(stderr, "message %ld not accepted\n", i);
+			return 1;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+
+	printf("%d byte message, %ld times: sign %.0f ns, verify %.0f ns\n",
+			(int)sizeof(msg), n,
+			elapsed_ns(&t0, &t1) / n,
+			(elapsed_ns(&t1, &t2) - elapsed_ns(&t0, &t1)) / n);
+	return 0;
+}
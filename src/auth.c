@@ -0,0 +1,291 @@
+/* 
+ * Copyright (C) 2026 agent <agent@local>
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include "config.h"
+#include "inline-fn.h"
+#include "log.h"
+#include "booth.h"
+#include "auth.h"
+
+/* Messages between the sites carry a keyed hash in auth2 and a
+ * counter in iv (the session, one up with every start of this
+ * boothd) and auth1 (a sequence number), so that nobody without
+ * the key can inject or replay them. The hash is SipHash-2-4,
+ * truncated to 32 bits; it costs well below a microsecond for our
+ * message sizes, see auth-bench.c. */
+
+/* Accept messages that arrive out of order by up to this many. */
+#define AUTH_WINDOW	32
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND do { \
+	v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+	v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+	v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+	v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+} while (0)
+
+
+static uint64_t get_le64(const unsigned char *p)
+{
+	uint64_t v = 0;
+	int i;
+
+	for (i = 7; i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+static uint64_t siphash(const unsigned char *key,
+		const unsigned char *data, int len)
+{
+	uint64_t k0, k1, v0, v1, v2, v3, m;
+	const unsigned char *end;
+	int left;
+
+	k0 = get_le64(key);
+	k1 = get_le64(key + 8);
+	v0 = k0 ^ 0x736f6d6570736575ULL;
+	v1 = k1 ^ 0x646f72616e646f6dULL;
+	v2 = k0 ^ 0x6c7967656e657261ULL;
+	v3 = k1 ^ 0x7465646279746573ULL;
+
+	end = data + len - (len % 8);
+	for (; data != end; data += 8) {
+		m = get_le64(data);
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+
+	m = (uint64_t)len << 56;
+	for (left = len % 8; left; left--)
+		m |= (uint64_t)data[left - 1] << (8 * (left - 1));
+	v3 ^= m;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= m;
+
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static uint32_t message_mac(struct boothc_header *h, int len)
+{
+	uint32_t mac, saved;
+
+	saved = h->auth2;
+	h->auth2 = 0;
+	mac = (uint32_t)siphash(booth_conf->authkey, (void *)h, len);
+	h->auth2 = saved;
+	return mac;
+}
+
+
+/* Longer keys are folded into AUTH_KEY_LEN bytes. */
+int read_authkey(struct booth_config *conf)
+{
+	unsigned char buf[1024];
+	FILE *fp;
+	int i, n;
+
+	if (!conf->authfile[0])
+		return 0;
+
+	fp = fopen(conf->authfile, "r");
+	if (!fp) {
+		log_error("cannot open authfile %s: %s",
+				conf->authfile, strerror(errno));
+		return -errno;
+	}
+	n = fread(buf, 1, sizeof(buf), fp);
+	fclose(fp);
+
+	if (n < AUTH_KEY_LEN) {
+		log_error("authfile %s: the key needs at least %d bytes",
+				conf->authfile, AUTH_KEY_LEN);
+		return -EINVAL;
+	}
+
+	memset(conf->authkey, 0, sizeof(conf->authkey));
+	for (i = 0; i < n; i++)
+		conf->authkey[i % AUTH_KEY_LEN] ^= buf[i];
+	memset(buf, 0, sizeof(buf));
+	conf->auth = 1;
+	return 0;
+}
+
+
+static uint32_t my_session, my_seq;
+
+
+static void session_path(char *path, int len)
+{
+	snprintf(path, len, "%s%s-%s.session",
+			BOOTH_LIB_DIR, shard_file_name(), site_string(local));
+}
+
+static int save_session(void)
+{
+	char path[BOOTH_PATH_LEN + 1], tmp[BOOTH_PATH_LEN + 8];
+	char buf[16];
+	int fd, len;
+
+	session_path(path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.new", path);
+	len = snprintf(buf, sizeof(buf), "%u\n", my_session);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+	if (fd < 0)
+		goto err;
+	if (write(fd, buf, len) != len || fdatasync(fd)) {
+		close(fd);
+		unlink(tmp);
+		goto err;
+	}
+	close(fd);
+	if (rename(tmp, path))
+		goto err;
+	return 0;
+
+err:
+	log_warn("cannot write %s: %s", path, strerror(errno));
+	return -errno;
+}
+
+/** Our session has to go up with every start; the time alone
+ * doesn't do after a restart within the same second, or after
+ * the clock was set back. The last one is kept on disk. */
+int auth_session_init(void)
+{
+	char path[BOOTH_PATH_LEN + 1];
+	unsigned int last = 0;
+	FILE *fp;
+
+	if (!booth_conf->auth)
+		return 0;
+
+	mkdir(BOOTH_LIB_DIR, 0775);
+	session_path(path, sizeof(path));
+	fp = fopen(path, "r");
+	if (fp) {
+		if (fscanf(fp, "%u", &last) != 1)
+			last = 0;
+		fclose(fp);
+	}
+
+	my_session = last + 1;
+	/* should the file have gone */
+	if (my_session < (uint32_t)time(NULL))
+		my_session = time(NULL);
+	my_seq = 0;
+	return save_session();
+}
+
+
+/* Called once per outgoing message, however many sites it goes
+ * to; every site keeps its own window. */
+void auth_sign(struct boothc_header *h, int len)
+{
+	if (!booth_conf->auth)
+		return;
+
+	/* see auth_session_init() */
+	if (!my_session)
+		my_session = time(NULL);
+	if (my_seq == UINT32_MAX) {
+		my_session++;
+		my_seq = 0;
+		(void)save_session();
+	}
+
+	h->iv = htonl(my_session);
+	h->auth1 = htonl(++my_seq);
+	h->auth2 = htonl(message_mac(h, len));
+}
+
+
+int auth_verify(struct boothc_header *h, int len)
+{
+	struct booth_site *from;
+	uint32_t session, seq, behind;
+
+	if (!booth_conf->auth)
+		return 0;
+
+	if (len < sizeof(*h) ||
+			!find_site_by_id(ntohl(h->from), &from) || !from) {
+		log_error("message without valid sender");
+		return -EINVAL;
+	}
+
+	if (ntohl(h->auth2) != message_mac(h, len)) {
+		log_error("message from %s failed authentication",
+				site_string(from));
+		return -EPERM;
+	}
+
+	session = ntohl(h->iv);
+	seq = ntohl(h->auth1);
+
+	/* restarted */
+	if (session > from->auth_session) {
+		from->auth_session = session;
+		from->auth_seq = seq;
+		from->auth_window = 1;
+		return 0;
+	}
+
+	if (session == from->auth_session && seq > from->auth_seq) {
+		behind = seq - from->auth_seq;
+		from->auth_window = behind < AUTH_WINDOW ?
+			from->auth_window << behind : 0;
+		from->auth_window |= 1;
+		from->auth_seq = seq;
+		return 0;
+	}
+
+	behind = from->auth_seq - seq;
+	if (session < from->auth_session || behind >= AUTH_WINDOW) {
+		log_warn("message from %s replayed or too old (%u.%u)",
+				site_string(from), session, seq);
+		return -EPERM;
+	}
+	/* votes go over all paths of a multi-homed site */
+	if (from->auth_window & (1U << behind)) {
+		log_debug("duplicate message from %s (%u.%u)",
+				site_string(from), session, seq);
+		return -EALREADY;
+	}
+	from->auth_window |= 1U << behind;
+	return 0;
+}
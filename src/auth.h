@@ -0,0 +1,31 @@
+/* 
+ * Copyright (C) 2026 agent <agent@local>
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _AUTH_H
+#define _AUTH_H
+
+#include "booth.h"
+#include "config.h"
+
+int read_authkey(struct booth_config *conf);
+int auth_session_init(void);
+void auth_sign(struct boothc_header *h, int len);
+int auth_verify(struct boothc_header *h, int len);
+
+
+#endif /* _AUTH_H */
@@ -28,6 +28,7 @@
 
 
 #define BOOTH_RUN_DIR "/var/run/booth/"
+#define BOOTH_LIB_DIR "/var/lib/booth/"
 #define BOOTH_LOG_DIR "/var/log"
 #define BOOTH_LOGFILE_NAME "booth.log"
 #define BOOTH_DEFAULT_CONF_DIR "/etc/booth/"
@@ -44,8 +45,18 @@
 /* TODO: remove */
 #define BOOTH_PROTO_FAMILY	AF_INET
 
+/* Addresses per site, eg. "site = 10.0.0.1, 192.168.1.1". */
+#define MAX_SITE_ADDRS		4
+
+/* Daemon processes per site, see "shards" in the man page. */
+#define MAX_SHARDS		64
+
 #define BOOTHC_MAGIC		0x5F1BA08C
+/* Sites talk to each other as long as the major version (upper
+ * 16 bits) matches; newer features are negotiated via CAP_*.
+ * Older sites want exactly this version, so it stays. */
 #define BOOTHC_VERSION		0x00010003
+#define BOOTHC_MAJOR(v)		((v) >> 16)
 
 
 /** Timeout value for poll().
@@ -74,7 +85,7 @@ typedef unsigned char boothc_ticket[BOOTH_NAME_LEN];
 
 
 struct boothc_header {
-	/** Authentication data; not used now. */
+	/** Authentication data; see auth.c. */
 	uint32_t iv;
 	uint32_t auth1;
 	uint32_t auth2;
@@ -118,6 +129,11 @@ struct ticket_msg {
 	uint32_t term;
 	uint32_t term_valid_for;
 
+	/** Site that takes over if the leader gets lost; only
+	 * meaningful in messages from the leader. May be NO_ONE.
+	 * See pick_successor(). */
+	uint32_t successor;
+
 	/* Perhaps we need to send a status along, too - like
 	 *  starting, running, stopping, error, ...? */
 } __attribute__((packed));
@@ -128,30 +144,138 @@ struct boothc_ticket_msg {
 	struct ticket_msg ticket;
 } __attribute__((packed));
 
+/* Length of a boothc_ticket_msg as sites without CAP_SUCCESSOR
+ * know it. */
+#define BOOTHC_CLASSIC_LEN \
+	(sizeof(struct boothc_ticket_msg) - sizeof(uint32_t))
+
+
+/* Largest datagram we send; stays below the usual path MTU. */
+#define BOOTH_MAX_DGRAM 1400
+/* Largest message over TCP between sites. */
+#define FRAME_SIZE_MAX	10000
+
+/** State of all tickets, the reply to OP_BULK_STATUS.
+ * Split over as many datagrams as needed; all but the last one
+ * have RLT_MORE as result. */
+struct boothc_bulk_msg {
+	struct boothc_header header;
+	struct ticket_msg ticket[0];
+} __attribute__((packed));
+
+/* How many subranges a digest is split into. */
+#define DIGEST_FANOUT 16
+
+/** Hashes over the tickets, see digest.c.
+ * 'hash[i]' covers the 'span' tickets starting at index
+ * 'first + i * span'; zero beyond the last ticket. */
+struct digest_msg {
+	/** Number of configured tickets; must match ours. */
+	uint32_t ticket_count;
+	/** See struct boothc_compact_msg. */
+	uint32_t ticket_ids;
+	uint32_t first;
+	uint32_t span;
+	uint32_t hash[DIGEST_FANOUT];
+	/** See catalog_hash(). */
+	uint32_t catalog;
+} __attribute__((packed));
+
+struct boothc_digest_msg {
+	struct boothc_header header;
+	struct digest_msg digest;
+} __attribute__((packed));
+
+/* Length of a boothc_digest_msg without the catalog hash. */
+#define BOOTHC_DIGEST_V1_LEN \
+	(sizeof(struct boothc_digest_msg) - sizeof(uint32_t))
+
+/** Like struct ticket_msg, but the ticket is given by its index
+ * in the configuration. */
+struct compact_ticket_msg {
+	uint32_t id;
+	uint32_t leader;
+	uint32_t term;
+	uint32_t term_valid_for;
+	uint32_t successor;
+} __attribute__((packed));
+
+/** OP_BULK_COMPACT, the state of many tickets. Only sent to sites
+ * that have the same ticket IDs, ie. the same 'ticket_ids' hash over
+ * the ticket names in configuration order.
+ * Without records, it asks for OP_BULK_STATUS in this form. */
+struct boothc_compact_msg {
+	struct boothc_header header;
+	uint32_t ticket_ids;
+	struct compact_ticket_msg ticket[0];
+} __attribute__((packed));
+
+/* Records per message of the given size. */
+#define BOOTH_COMPACT_RECORDS(size) \
+	(((size) - sizeof(struct boothc_compact_msg)) / \
+	 sizeof(struct compact_ticket_msg))
+
+/* Room for the attributes of a ticket added at runtime. */
+#define BOOTH_ATTRS_LEN 512
+
+/** Used for CMD_ADD_TICKET and OP_ADD_TICKET (and the DEL
+ * variants, without attributes): the ticket message, followed by
+ * "key=value" pairs as in the configuration file, separated by
+ * newlines and terminated by a NUL. Only as long as needed.
+ * Between sites 'ticket.term' is the version of the change and
+ * 'ticket.leader' the site that made it; the OP_ACK has them, too
+ * (see catalog.c). */
+struct boothc_attr_msg {
+	struct boothc_header header;
+	struct ticket_msg ticket;
+	char attrs[BOOTH_ATTRS_LEN];
+} __attribute__((packed));
+
+#define BOOTH_BULK_RECORDS(size) \
+	(((size) - sizeof(struct boothc_header)) / \
+	 sizeof(struct ticket_msg))
+
 
 typedef enum {
 	/* 0x43 = "C"ommands */
 	CMD_LIST    = CHAR2CONST('C', 'L', 's', 't'),
 	CMD_GRANT   = CHAR2CONST('C', 'G', 'n', 't'),
 	CMD_REVOKE  = CHAR2CONST('C', 'R', 'v', 'k'),
+	CMD_MOVE    = CHAR2CONST('C', 'M', 'o', 'v'),
+	CMD_ADD_TICKET = CHAR2CONST('C', 'A', 'd', 'd'),
+	CMD_DEL_TICKET = CHAR2CONST('C', 'D', 'e', 'l'),
+	CMD_STATS   = CHAR2CONST('C', 'S', 't', 'a'),
 
 	/* Replies */
 	CL_RESULT  = CHAR2CONST('R', 's', 'l', 't'),
 	CL_LIST    = CHAR2CONST('R', 'L', 's', 't'),
+	CL_STATS   = CHAR2CONST('R', 'S', 't', 'a'),
 	CL_GRANT   = CHAR2CONST('R', 'G', 'n', 't'),
 	CL_REVOKE  = CHAR2CONST('R', 'R', 'v', 'k'),
 
 	/* get status from another server */
 	OP_STATUS   = CHAR2CONST('S', 't', 'a', 't'),
 	OP_MY_INDEX = CHAR2CONST('M', 'I', 'd', 'x'), /* reply to status */
+	OP_BULK_STATUS = CHAR2CONST('B', 'S', 't', 'a'), /* status of all tickets */
+	OP_BULK_INDEX  = CHAR2CONST('B', 'I', 'd', 'x'), /* reply to bulk status */
+	OP_BULK_COMPACT = CHAR2CONST('B', 'C', 'm', 'p'), /* the same, by ticket ID */
+	OP_DIGEST   = CHAR2CONST('D', 'g', 's', 't'), /* hashes over tickets */
+	OP_HELLO    = CHAR2CONST('H', 'e', 'l', 'o'), /* opens a TCP connection */
+	OP_PATH_PROBE = CHAR2CONST('P', 'P', 'r', 'b'), /* RTT of one address */
+	OP_PATH_ECHO  = CHAR2CONST('P', 'E', 'c', 'h'), /* reply to PATH_PROBE */
+	OP_MCAST_PROBE = CHAR2CONST('M', 'P', 'r', 'b'), /* is the group there? */
 
 	/* Raft */
+	OP_PREVOTE  = CHAR2CONST('P', 'V', 'o', 't'), /* could we win an election? */
 	OP_REQ_VOTE = CHAR2CONST('R', 'V', 'o', 't'), /* start election */
 	OP_VOTE_FOR = CHAR2CONST('V', 't', 'F', 'r'), /* reply to REQ_VOTE */
 	OP_HEARTBEAT= CHAR2CONST('H', 'r', 't', 'B'), /* Heartbeat */
 	OP_ACK      = CHAR2CONST('A', 'c', 'k', '.'), /* Ack for heartbeats and revokes */
 	OP_UPDATE   = CHAR2CONST('U', 'p', 'd', 'E'), /* Update ticket */
 	OP_REVOKE   = CHAR2CONST('R', 'e', 'v', 'k'), /* Revoke ticket */
+	OP_HANDOVER = CHAR2CONST('H', 'n', 'd', 'O'), /* Hand the ticket over to another site */
+	OP_ADD_TICKET = CHAR2CONST('A', 'd', 'T', 'k'), /* ticket added at runtime */
+	OP_DEL_TICKET = CHAR2CONST('D', 'l', 'T', 'k'), /* ticket removed at runtime */
 	OP_REJECTED = CHAR2CONST('R', 'J', 'C', '!'),
 } cmd_request_t;
 
@@ -187,6 +311,7 @@ typedef enum {
 	OR_LOCAL_FAIL           = CHAR2CONST('L', 'o', 'c', 'F'),
 	OR_STEPDOWN             = CHAR2CONST('S', 'p', 'd', 'n'),
 	OR_SPLIT                = CHAR2CONST('S', 'p', 'l', 't'),
+	OR_SUCCESSOR            = CHAR2CONST('S', 'u', 'c', 'c'),
 } cmd_reason_t;
 
 /* bitwise command options, currently used only for immediate
@@ -196,6 +321,24 @@ typedef enum {
 	OPT_WAIT = 2,
 } cmd_options_t;
 
+/* Protocol capabilities; sites advertise them in the options of
+ * every UDP message. Older sites leave the options at zero, hence
+ * CAP_VALID. See booth_udp_send() and message_recv(). */
+typedef enum {
+	CAP_SUCCESSOR   = 0x0001,	/* ticket_msg carries a successor */
+	CAP_PREVOTE     = 0x0002,
+	CAP_BULK        = 0x0004,	/* OP_BULK_* and OP_BULK_COMPACT */
+	CAP_DIGEST      = 0x0008,
+	CAP_HANDOVER    = 0x0010,
+	CAP_CATALOG     = 0x0020,	/* OP_ADD_TICKET, OP_DEL_TICKET */
+	CAP_PATHS       = 0x0040,	/* OP_PATH_PROBE, OP_PATH_ECHO */
+	CAP_MCAST       = 0x0080,	/* joined the multicast group; not in BOOTH_CAPS */
+	CAP_VALID       = 0x80000000,
+} cmd_caps_t;
+
+#define BOOTH_CAPS	(CAP_SUCCESSOR | CAP_PREVOTE | CAP_BULK | \
+		CAP_DIGEST | CAP_HANDOVER | CAP_CATALOG | CAP_PATHS)
+
 /** @} */
 
 /** @{ */
@@ -225,6 +368,28 @@ struct booth_site {
 	};
 	int saddrlen;
 	int addrlen;
+
+	/** When we last got a message from this site; 0 if never. */
+	time_t last_recv;
+	/** Smoothed round-trip time in milliseconds; 0 if unknown.
+	 * See update_acks(). */
+	int rtt_ms;
+	/** Capabilities the site advertised last; 0 if unknown or
+	 * an older version. See cmd_caps_t. */
+	uint32_t caps;
+
+	/** The newest authenticated message from this site, and
+	 * which of the ones before it were seen. See auth_verify(). */
+	uint32_t auth_session;
+	uint32_t auth_seq;
+	uint32_t auth_window;
+
+	/** Further addresses of the site, for multi-homing; same
+	 * family and port as the first one. See add_site(). */
+	int alt_count;
+	struct sockaddr_in6 alt[MAX_SITE_ADDRS - 1];
+	/** The SCTP association with this site; 0 if none. */
+	int sctp_assoc;
 } __attribute__((packed));
 
 
@@ -236,11 +401,15 @@ extern struct booth_site * no_leader;
 
 struct booth_transport;
 
+struct client_in;
+
 struct client {
 	int fd;
 	const struct booth_transport *transport;
 	void (*workfn)(int);
 	void (*deadfn)(int);
+	/* a request as far as it arrived, see process_connection() */
+	struct client_in *in;
 };
 
 extern struct client *clients;
@@ -250,6 +419,8 @@ extern struct pollfd *pollfds;
 int client_add(int fd, const struct booth_transport *tpt,
 		void (*workfn)(int ci), void (*deadfn)(int ci));
 int find_client_by_fd(int fd);
+void client_dead(int ci);
+int client_admit(int fd);
 int do_read(int fd, void *buf, size_t count);
 int do_write(int fd, void *buf, size_t count);
 void process_connection(int ci);
@@ -265,6 +436,8 @@ struct command_line {
 
 	char site[BOOTH_NAME_LEN];
 	struct boothc_ticket_msg msg;
+	/* for "booth add", see struct boothc_attr_msg */
+	char attrs[BOOTH_ATTRS_LEN];
 };
 extern struct command_line cl;
 
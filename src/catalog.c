@@ -0,0 +1,595 @@
+/* 
+ * Copyright (C) 2026 agent <agent@local>
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+#include "ticket.h"
+#include "config.h"
+#include "inline-fn.h"
+#include "log.h"
+#include "booth.h"
+#include "transport.h"
+#include "catalog.h"
+
+
+/* Tickets added or removed at runtime ("booth add", "booth del").
+ *
+ * The site that gets the client request applies the change and
+ * sends it on to all others (OP_ADD_TICKET, OP_DEL_TICKET), until
+ * each acknowledged it; after the retries, less often. Every site
+ * keeps the changes in a file next to the state file and applies
+ * them on top of the configuration file on startup and reload; so
+ * the configuration file wins for tickets that got added there in
+ * the meantime.
+ *
+ * Each change has a version, a Lamport clock: one more than the
+ * highest version seen so far, with the site that made it to break
+ * ties. Of two changes of a ticket the one with the higher version
+ * wins, wherever they arrive first; a site that gets an older
+ * change than its own sends its own back. A site that comes back
+ * after a while, or whose digest shows another number of tickets
+ * or other changes (see catalog_hash()), gets all changes again.
+ *
+ * The file has one line per ticket:
+ *	add	NAME	key=value	key=value ...
+ *	del	NAME
+ * then the versions:
+ *	version	NAME	VERSION	SITE-ID
+ * and, for changes not acknowledged by all yet, a bitmap of the
+ * sites still missing, so that the resends go on after a restart:
+ *	unacked	NAME	HEX
+ */
+
+/* resends after the retries are at most this far apart */
+#define CATALOG_RESEND_MAX	60
+
+struct catalog_entry {
+	/* OP_ADD_TICKET or OP_DEL_TICKET */
+	cmd_request_t op;
+	boothc_ticket name;
+	/* "key=value" pairs, one per line */
+	char attrs[BOOTH_ATTRS_LEN];
+	uint32_t version;
+	/* site ID of the site that made the change */
+	uint32_t origin;
+	/* an add of a ticket the configuration file has, too */
+	int shadowed;
+
+	/* sites that still have to acknowledge the change */
+	uint64_t unacked;
+	int sends;
+	time_t next_send;
+};
+
+static struct catalog_entry *entries;
+static int entry_cnt, entry_alloc;
+/* highest version seen */
+static uint32_t catalog_clock;
+
+
+static void catalog_path(char *path, int len)
+{
+	snprintf(path, len, "%s%s-%s.tickets",
+			BOOTH_LIB_DIR, shard_file_name(), site_string(local));
+}
+
+
+static struct catalog_entry *add_entry(cmd_request_t op,
+		const char *name, const char *attrs)
+{
+	struct catalog_entry *e;
+	void *p;
+	int i;
+
+	/* only the latest change of a ticket counts */
+	for (i = 0; i < entry_cnt; i++) {
+		if (!strcmp((char *)entries[i].name, name)) {
+			memmove(entries + i, entries + i + 1,
+					(entry_cnt - i - 1) * sizeof(*entries));
+			entry_cnt--;
+			break;
+		}
+	}
+
+	if (entry_cnt == entry_alloc) {
+		p = realloc(entries, (entry_alloc + 8) * sizeof(*entries));
+		if (!p) {
+			log_error("out of memory");
+			return NULL;
+		}
+		entries = p;
+		entry_alloc += 8;
+	}
+
+	e = entries + entry_cnt++;
+	memset(e, 0, sizeof(*e));
+	e->op = op;
+	strncpy((char *)e->name, name, sizeof(e->name) - 1);
+	strncpy(e->attrs, attrs, sizeof(e->attrs) - 1);
+	return e;
+}
+
+
+static int catalog_save(void)
+{
+	char path[BOOTH_PATH_LEN + 1], tmp[BOOTH_PATH_LEN + 8];
+	struct catalog_entry *e;
+	FILE *fp;
+	char *cp;
+	int i;
+
+	catalog_path(path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.new", path);
+
+	mkdir(BOOTH_LIB_DIR, 0775);
+	fp = fopen(tmp, "w");
+	if (!fp)
+		goto err;
+
+	for (i = 0; i < entry_cnt; i++) {
+		e = entries + i;
+		if (e->op == OP_DEL_TICKET) {
+			fprintf(fp, "del\t%s\n", e->name);
+			continue;
+		}
+		fprintf(fp, "add\t%s\t", e->name);
+		for (cp = e->attrs; *cp; cp++)
+			fputc(*cp == '\n' ? '\t' : *cp, fp);
+		fputc('\n', fp);
+	}
+	for (i = 0; i < entry_cnt; i++) {
+		e = entries + i;
+		fprintf(fp, "version\t%s\t%" PRIu32 "\t%" PRIu32 "\n",
+				e->name, e->version, e->origin);
+	}
+	for (i = 0; i < entry_cnt; i++) {
+		e = entries + i;
+		if (e->unacked)
+			fprintf(fp, "unacked\t%s\t%" PRIx64 "\n",
+					e->name, e->unacked);
+	}
+
+	if (fflush(fp) || fdatasync(fileno(fp)) ||
+			fclose(fp) || rename(tmp, path))
+		goto err_unlink;
+	return 0;
+
+err_unlink:
+	unlink(tmp);
+err:
+	log_error("cannot write %s: %s", path, strerror(errno));
+	return -errno;
+}
+
+
+static struct catalog_entry *find_entry(const char *name)
+{
+	int i;
+
+	for (i = 0; i < entry_cnt; i++)
+		if (!strcmp((char *)entries[i].name, name))
+			return entries + i;
+	return NULL;
+}
+
+
+/** Reads the changes done at runtime, and applies them to the
+ * freshly read configuration. Only at startup. */
+int catalog_load(void)
+{
+	char path[BOOTH_PATH_LEN + 1];
+	char line[BOOTH_NAME_LEN + BOOTH_ATTRS_LEN + 8];
+	char *op, *name, *attrs, *cp;
+	struct catalog_entry *e;
+	FILE *fp;
+	int lineno = 0;
+
+	catalog_path(path, sizeof(path));
+	fp = fopen(path, "r");
+	if (!fp) {
+		if (errno == ENOENT)
+			return 0;
+		log_warn("cannot open %s: %s", path, strerror(errno));
+		return -errno;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		cp = strchr(line, '\n');
+		if (cp)
+			*cp = 0;
+
+		op = line;
+		name = strchr(op, '\t');
+		if (!name)
+			goto bad;
+		*name++ = 0;
+		attrs = strchr(name, '\t');
+		if (attrs) {
+			*attrs++ = 0;
+			for (cp = attrs; *cp; cp++)
+				if (*cp == '\t')
+					*cp = '\n';
+		} else {
+			attrs = name + strlen(name);
+		}
+
+		if (!strcmp(op, "add"))
+			add_entry(OP_ADD_TICKET, name, attrs);
+		else if (!strcmp(op, "del"))
+			add_entry(OP_DEL_TICKET, name, "");
+		else if (!strcmp(op, "version") && (e = find_entry(name))) {
+			/* separated by a newline now */
+			e->version = strtoul(attrs, &cp, 10);
+			e->origin = strtoul(cp, NULL, 10);
+			catalog_clock = max(catalog_clock, e->version);
+		} else if (!strcmp(op, "unacked") && (e = find_entry(name)))
+			/* resent right away, see catalog_cron() */
+			e->unacked = strtoull(attrs, NULL, 16) &
+				booth_conf->all_bits & ~local->bitmask;
+		else
+			goto bad;
+		continue;
+
+bad:
+		log_warn("%s: ignoring bad line %d", path, lineno);
+	}
+	fclose(fp);
+
+	catalog_apply(booth_conf);
+	log_info("%d ticket(s) added or removed at runtime", entry_cnt);
+	return 0;
+}
+
+
+/** Adds and removes the tickets in 'conf' as done at runtime. */
+void catalog_apply(struct booth_config *conf)
+{
+	struct catalog_entry *e;
+	const char *error;
+	int i, rv;
+
+	for (i = 0; i < entry_cnt; i++) {
+		e = entries + i;
+		if (e->op == OP_DEL_TICKET) {
+			config_del_ticket(conf, (char *)e->name);
+			continue;
+		}
+
+		rv = config_add_ticket(conf, (char *)e->name, e->attrs, &error);
+		e->shadowed = rv == -EEXIST;
+		if (rv < 0 && rv != -EEXIST)
+			log_warn("cannot add ticket %s again: %s",
+					e->name, error);
+	}
+}
+
+
+static void send_entry(struct catalog_entry *e)
+{
+	struct boothc_attr_msg msg;
+	struct booth_site *site;
+	int i, len;
+
+	len = offsetof(struct boothc_attr_msg, attrs) + strlen(e->attrs) + 1;
+	init_header(&msg.header, e->op, 0, 0, RLT_SUCCESS, 0, len);
+	memset(&msg.ticket, 0, sizeof(msg.ticket));
+	memcpy(msg.ticket.id, e->name, sizeof(msg.ticket.id));
+	/* see struct boothc_attr_msg */
+	msg.ticket.leader = htonl(e->origin);
+	msg.ticket.term = htonl(e->version);
+	msg.ticket.successor = htonl(NO_ONE);
+	strcpy(msg.attrs, e->attrs);
+
+	/* older sites can't take it; retried, see catalog_cron() */
+	foreach_node(i, site) {
+		if ((e->unacked & site->bitmask) && (site->caps & CAP_CATALOG))
+			transport()->send(site, &msg, len);
+	}
+}
+
+
+static int newer(uint32_t version, uint32_t origin,
+		struct catalog_entry *e)
+{
+	if (version != e->version)
+		return version > e->version;
+	return origin > e->origin;
+}
+
+
+/* Resend 'e' to 'site' from the start. */
+static void resend_entry(struct catalog_entry *e, struct booth_site *site)
+{
+	e->unacked |= site->bitmask;
+	e->sends = 0;
+	e->next_send = 0;
+}
+
+
+/* Returns an RLT_* code. 'version' and 'origin' only count for
+ * changes from other sites. */
+static int change_ticket(cmd_request_t op, const char *name,
+		const char *attrs, struct booth_site *from,
+		uint32_t version, uint32_t origin)
+{
+	struct booth_config *conf;
+	struct catalog_entry *e;
+	const char *error;
+	int rv, replace;
+
+	replace = 0;
+	if (from) {
+		catalog_clock = max(catalog_clock, version);
+		e = find_entry(name);
+		if (e && !newer(version, origin, e)) {
+			/* a resend, or an older change; ours wins */
+			if ((version != e->version || origin != e->origin) &&
+					!(e->unacked & from->bitmask)) {
+				log_info("change of ticket %s by %s is older "
+						"than ours, sending ours",
+						name, site_string(from));
+				resend_entry(e, from);
+				catalog_save();
+			}
+			return RLT_SUCCESS;
+		}
+		/* an added ticket gets the newer attributes */
+		replace = e && e->op == OP_ADD_TICKET && !e->shadowed;
+	}
+
+	conf = copy_config();
+	if (!conf)
+		return RLT_SYNC_FAIL;
+
+	if (op == OP_ADD_TICKET) {
+		if (replace)
+			config_del_ticket(conf, name);
+		rv = config_add_ticket(conf, name, attrs, &error);
+		if (rv == -EEXIST && from) {
+			/* in the configuration file, which wins */
+			free_config(conf);
+			conf = NULL;
+		} else if (rv < 0) {
+			free_config(conf);
+			log_error("cannot add ticket %s: %s", name, error);
+			return RLT_INVALID_ARG;
+		}
+	} else {
+		rv = config_del_ticket(conf, name);
+		if (rv < 0) {
+			free_config(conf);
+			conf = NULL;
+			if (!from) {
+				log_error("cannot remove ticket %s: not configured", name);
+				return RLT_INVALID_ARG;
+			}
+		}
+	}
+
+	/* otherwise only remembered, for the versions */
+	if (conf && apply_config(conf) < 0)
+		return RLT_SYNC_FAIL;
+	if (!from) {
+		version = ++catalog_clock;
+		origin = local->site_id;
+	}
+	e = add_entry(op, name, attrs);
+	if (!e)
+		return RLT_SYNC_FAIL;
+	e->version = version;
+	e->origin = origin;
+	e->shadowed = op == OP_ADD_TICKET && !conf;
+
+	if (conf)
+		log_info("ticket %s %s%s%s", name,
+				op == OP_ADD_TICKET ? "added" : "removed",
+				from ? " by " : "",
+				from ? site_string(from) : "");
+
+	if (!from) {
+		e->unacked = booth_conf->all_bits & ~local->bitmask;
+		send_entry(e);
+		e->sends = 1;
+		e->next_send = get_secs(NULL) + booth_conf->defaults.timeout;
+	}
+	catalog_save();
+	return RLT_SUCCESS;
+}
+
+
+/** Client request to add or remove a ticket. */
+int catalog_request(int fd, struct boothc_attr_msg *msg, int len)
+{
+	struct boothc_ticket_msg reply;
+	int rv;
+
+	msg->ticket.id[sizeof(msg->ticket.id) - 1] = 0;
+	if (len <= offsetof(struct boothc_attr_msg, attrs) ||
+			msg->attrs[len - offsetof(struct boothc_attr_msg, attrs) - 1]) {
+		log_error("bad ticket attributes from client");
+		rv = RLT_INVALID_ARG;
+	} else {
+		rv = change_ticket(ntohl(msg->header.cmd) == CMD_ADD_TICKET ?
+				OP_ADD_TICKET : OP_DEL_TICKET,
+				(char *)msg->ticket.id, msg->attrs, NULL, 0, 0);
+	}
+
+	init_ticket_msg(&reply, CL_RESULT, 0, rv, 0, NULL);
+	memcpy(reply.ticket.id, msg->ticket.id, sizeof(reply.ticket.id));
+	return send_ticket_msg(fd, &reply);
+}
+
+
+int catalog_recv(struct booth_site *from,
+		struct boothc_attr_msg *msg, int len)
+{
+	struct boothc_ticket_msg ack;
+	cmd_request_t op;
+	int rv;
+
+	op = ntohl(msg->header.cmd);
+	if (len <= offsetof(struct boothc_attr_msg, attrs) ||
+			len > sizeof(*msg) ||
+			msg->attrs[len - offsetof(struct boothc_attr_msg, attrs) - 1] ||
+			msg->ticket.id[sizeof(msg->ticket.id) - 1]) {
+		log_error("bad ticket change from %s", site_string(from));
+		return -1;
+	}
+
+	rv = change_ticket(op, (char *)msg->ticket.id, msg->attrs, from,
+			ntohl(msg->ticket.term), ntohl(msg->ticket.leader));
+
+	init_ticket_msg(&ack, OP_ACK, op, rv, 0, NULL);
+	memcpy(ack.ticket.id, msg->ticket.id, sizeof(ack.ticket.id));
+	/* for this version */
+	ack.ticket.leader = msg->ticket.leader;
+	ack.ticket.term = msg->ticket.term;
+	return transport()->send(from, &ack, sizeof(ack));
+}
+
+
+int catalog_ack(struct booth_site *from, struct boothc_ticket_msg *msg)
+{
+	struct catalog_entry *e;
+	int i;
+
+	for (i = 0; i < entry_cnt; i++) {
+		e = entries + i;
+		if (e->op != ntohl(msg->header.request) ||
+				strncmp((char *)e->name, (char *)msg->ticket.id,
+					sizeof(e->name)))
+			continue;
+		/* for a change since replaced by a newer one */
+		if (e->version != ntohl(msg->ticket.term) ||
+				e->origin != ntohl(msg->ticket.leader))
+			break;
+
+		if (ntohl(msg->header.result) != RLT_SUCCESS)
+			log_warn("%s could not %s ticket %s",
+					site_string(from),
+					e->op == OP_ADD_TICKET ? "add" : "remove",
+					e->name);
+		if (e->unacked & from->bitmask) {
+			e->unacked &= ~from->bitmask;
+			catalog_save();
+		}
+		break;
+	}
+	return 0;
+}
+
+
+/** 'site' may have missed changes: it was silent for a while, or
+ * has another number of tickets. Send them all again. */
+void catalog_resend(struct booth_site *site)
+{
+	struct catalog_entry *e;
+	int i, cnt;
+
+	if (site == local)
+		return;
+
+	cnt = 0;
+	for (i = 0; i < entry_cnt; i++) {
+		e = entries + i;
+		if (e->unacked & site->bitmask)
+			continue;
+		resend_entry(e, site);
+		cnt++;
+	}
+	if (!cnt)
+		return;
+
+	log_info("sending %d ticket change(s) to %s again",
+			cnt, site_string(site));
+	catalog_save();
+	catalog_cron();
+}
+
+
+/** Over the versions of all changes, in any order; in the digest,
+ * so that sites which missed or lost a change get them all again
+ * (see process_digest()). */
+uint32_t catalog_hash(void)
+{
+	struct catalog_entry *e;
+	uint32_t v[2], crc, sum;
+	int i;
+
+	sum = 0;
+	for (i = 0; i < entry_cnt; i++) {
+		e = entries + i;
+		v[0] = htonl(e->version);
+		v[1] = htonl(e->origin);
+		crc = crc32(0L, NULL, 0);
+		crc = crc32(crc, (void *)e->name, strlen((char *)e->name));
+		sum += crc32(crc, (void *)v, sizeof(v));
+	}
+	return sum;
+}
+
+
+static void still_unacked(struct catalog_entry *e)
+{
+	struct booth_site *site;
+	int i;
+
+	foreach_node(i, site) {
+		if (e->unacked & site->bitmask)
+			log_warn("%s did not acknowledge the change "
+					"of ticket %s yet, trying less often",
+					site_string(site), e->name);
+	}
+}
+
+
+void catalog_cron(void)
+{
+	struct catalog_entry *e;
+	time_t now;
+	int i, interval;
+
+	now = get_secs(NULL);
+	for (i = 0; i < entry_cnt; i++) {
+		e = entries + i;
+		if (!e->unacked || now < e->next_send)
+			continue;
+
+		/* a site may be down for long, but must get it in
+		 * the end */
+		interval = booth_conf->defaults.timeout;
+		if (e->sends > booth_conf->defaults.retries) {
+			if (e->sends == booth_conf->defaults.retries + 1)
+				still_unacked(e);
+			interval = CATALOG_RESEND_MAX;
+		}
+
+		send_entry(e);
+		e->sends++;
+		e->next_send = now + interval;
+	}
+}
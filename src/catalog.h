@@ -0,0 +1,37 @@
+/* 
+ * Copyright (C) 2026 agent <agent@local>
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _CATALOG_H
+#define _CATALOG_H
+
+#include "booth.h"
+
+struct booth_config;
+
+int catalog_load(void);
+void catalog_apply(struct booth_config *conf);
+int catalog_request(int fd, struct boothc_attr_msg *msg, int len);
+int catalog_recv(struct booth_site *from,
+		struct boothc_attr_msg *msg, int len);
+int catalog_ack(struct booth_site *from, struct boothc_ticket_msg *msg);
+void catalog_resend(struct booth_site *site);
+uint32_t catalog_hash(void);
+void catalog_cron(void);
+
+
+#endif /* _CATALOG_H */
@@ -33,33 +33,109 @@
 #include "ticket.h"
 #include "log.h"
 
-static int ticket_size = 0;
-
-static int ticket_realloc(void)
+/* Makes room for at least 'want' tickets; grows geometrically, so
+ * that adding many tickets one by one stays cheap. */
+static int ticket_reserve(struct booth_config *conf, int want)
 {
-	const int added = 5;
-	int had, want;
+	int had;
 	void *p;
 
-	had = booth_conf->ticket_allocated;
-	want = had + added;
+	had = conf->ticket_allocated;
+	if (want <= had)
+		return 0;
 
-	p = realloc(booth_conf->ticket,
+	if (want < 2 * had)
+		want = 2 * had;
+	if (want < TICKET_ALLOC)
+		want = TICKET_ALLOC;
+	p = realloc(conf->next_cron, sizeof(timetype) * want);
+	if (!p)
+		goto oom;
+	conf->next_cron = p;
+	memset(conf->next_cron + had, 0,
+			sizeof(timetype) * (want - had));
+
+	p = realloc(conf->hot, sizeof(struct ticket_hot) * want);
+	if (!p)
+		goto oom;
+	conf->hot = p;
+	memset(conf->hot + had, 0,
+			sizeof(struct ticket_hot) * (want - had));
+
+	p = realloc(conf->ticket,
 			sizeof(struct ticket_config) * want);
-	if (!p) {
-		log_error("can't alloc more tickets");
-		return -ENOMEM;
-	}
+	if (!p)
+		goto oom;
 
-	booth_conf->ticket = p;
-	memset(booth_conf->ticket + had, 0,
-			sizeof(struct ticket_config) * added);
-	booth_conf->ticket_allocated = want;
+	conf->ticket = p;
+	memset(conf->ticket + had, 0,
+			sizeof(struct ticket_config) * (want - had));
+	conf->ticket_allocated = want;
 
 	return 0;
+
+oom:
+	log_error("can't alloc more tickets");
+	return -ENOMEM;
 }
 
 
+/* IPv4 or IPv6, whichever the string is. */
+static int set_mcast_group(const char *addr)
+{
+	if (inet_pton(AF_INET, addr, &booth_conf->mcast4.sin_addr) > 0) {
+		if (!IN_MULTICAST(ntohl(booth_conf->mcast4.sin_addr.s_addr)))
+			return -1;
+		booth_conf->mcast4.sin_family = AF_INET;
+		return 0;
+	}
+
+	if (inet_pton(AF_INET6, addr, &booth_conf->mcast6.sin6_addr) > 0) {
+		if (!IN6_IS_ADDR_MULTICAST(&booth_conf->mcast6.sin6_addr))
+			return -1;
+		booth_conf->mcast6.sin6_family = AF_INET6;
+		return 0;
+	}
+
+	return -1;
+}
+
+
+/* Another address of the same site, for multi-homing. */
+static int add_site_addr(struct booth_site *site, const char *addr)
+{
+	struct sockaddr_in6 *sa;
+	int ok;
+
+	if (site->alt_count == MAX_SITE_ADDRS - 1) {
+		log_error("too many addresses for site %s", site->addr_string);
+		return -1;
+	}
+
+	sa = site->alt + site->alt_count;
+	memset(sa, 0, sizeof(*sa));
+	if (site->family == AF_INET) {
+		struct sockaddr_in *sa4 = (void *)sa;
+
+		sa4->sin_family = AF_INET;
+		sa4->sin_port = htons(booth_conf->port);
+		ok = inet_pton(AF_INET, addr, &sa4->sin_addr) > 0;
+	} else {
+		sa->sin6_family = AF_INET6;
+		sa->sin6_port = htons(booth_conf->port);
+		ok = inet_pton(AF_INET6, addr, &sa->sin6_addr) > 0;
+	}
+
+	if (!ok) {
+		log_error("Address string \"%s\" is bad (site %s)",
+				addr, site->addr_string);
+		return -1;
+	}
+
+	site->alt_count++;
+	return 0;
+}
+
 int add_site(char *address, int type);
 int add_site(char *addr_string, int type)
 {
@@ -68,8 +144,16 @@ int add_site(char *addr_string, int type)
 	uLong nid;
 	uint32_t mask;
 	int i;
+	char *more, *addr;
 
 
+	/* further addresses, comma-separated */
+	more = strchr(addr_string, ',');
+	if (more) {
+		*more++ = '\0';
+		addr_string[strcspn(addr_string, " \t")] = '\0';
+	}
+
 	rv = 1;
 	if (booth_conf->site_count == MAX_NODES) {
 		log_error("too many nodes");
@@ -154,6 +238,16 @@ int add_site(char *addr_string, int type)
 			exit(1);
 		}
 
+	while (!rv && more) {
+		addr = more + strspn(more, " \t");
+		more = strchr(addr, ',');
+		if (more)
+			*more++ = '\0';
+		addr[strcspn(addr, " \t")] = '\0';
+		if (add_site_addr(site, addr) < 0)
+			rv = EINVAL;
+	}
+
 out:
 	return rv;
 }
@@ -193,64 +287,247 @@ static inline int is_end_of_line(char *cp)
 }
 
 
-static int add_ticket(const char *name, struct ticket_config **tkp,
-		const struct ticket_config *def)
+static struct ticket_config *conf_ticket(struct booth_config *conf,
+		const char *name)
 {
-	int rv;
-	struct ticket_config *tk;
-
+	int i;
 
-	if (booth_conf->ticket_count == booth_conf->ticket_allocated) {
-		rv = ticket_realloc();
-		if (rv < 0)
-			return rv;
-	}
+	for (i = 0; i < conf->ticket_count; i++)
+		if (!strcmp(conf->ticket[i].name, name))
+			return conf->ticket + i;
+	return NULL;
+}
 
 
-	tk = booth_conf->ticket + booth_conf->ticket_count;
-	booth_conf->ticket_count++;
+/* Callers check for duplicate names. */
+static int add_ticket(struct booth_config *conf, const char *name,
+		struct ticket_config **tkp, const struct ticket_config *def)
+{
+	int rv;
+	struct ticket_config *tk;
 
-	tk->last_valid_tk = malloc(sizeof(struct ticket_config));
-	if (!tk->last_valid_tk) {
-		log_error("out of memory");
-		return -ENOMEM;
-	}
-	memset(tk->last_valid_tk, 0, sizeof(struct ticket_config));
 
 	if (!check_max_len_valid(name, sizeof(tk->name))) {
 		log_error("ticket name \"%s\" too long.", name);
 		return -EINVAL;
 	}
 
-	if (find_ticket_by_name(name, NULL)) {
-		log_error("ticket name \"%s\" used again.", name);
-		return -EINVAL;
-	}
-
 	if (* skip_while_in(name, isalnum, "-/")) {
 		log_error("ticket name \"%s\" invalid; only alphanumeric names.", name);
 		return -EINVAL;
 	}
 
+	rv = ticket_reserve(conf, conf->ticket_count + 1);
+	if (rv < 0)
+		return rv;
+
+
+	tk = conf->ticket + conf->ticket_count;
+	conf->ticket_count++;
+
 	strcpy(tk->name, name);
 	tk->timeout = def->timeout;
 	tk->term_duration = def->term_duration;
 	tk->retries = def->retries;
+	tk->acquire_after = def->acquire_after;
+	tk->renewal_freq = def->renewal_freq;
 	memcpy(tk->weight, def->weight, sizeof(tk->weight));
+	tk->election_delay = def->election_delay;
+
+	if (def->ext_verifier) {
+		tk->ext_verifier = strdup(def->ext_verifier);
+		if (!tk->ext_verifier) {
+			log_error("out of memory");
+			return -ENOMEM;
+		}
+	}
 
 	if (tkp)
 		*tkp = tk;
 	return 0;
 }
 
+
+/* Upper limit for a single range, against typos. */
+#define MAX_TICKET_RANGE	100000
+
+/* A name like "db-[0001-2000]" stands for the tickets "db-0001" up
+ * to "db-2000"; the numbers get as many digits as the first one
+ * of the range has. Other names are taken as they are.
+ * All tickets get allocated at once; returns their number, *tkp
+ * is the first one. */
+static int add_ticket_range(struct booth_config *conf, const char *pattern,
+		struct ticket_config **tkp, const struct ticket_config *def)
+{
+	const char *open, *dash, *close;
+	char name[2 * BOOTH_NAME_LEN];
+	char *end;
+	long first, last, n, i;
+	int width, rv;
+
+	open = strchr(pattern, '[');
+	if (!open) {
+		rv = add_ticket(conf, pattern, tkp, def);
+		return rv < 0 ? rv : 1;
+	}
+
+	if (!isdigit(open[1]))
+		goto bad;
+	first = strtol(open + 1, &end, 10);
+	dash = end;
+	width = dash - (open + 1);
+	if (*dash != '-' || !isdigit(dash[1]))
+		goto bad;
+	last = strtol(dash + 1, &end, 10);
+	close = end;
+	if (*close != ']' || strchr(close, '[') ||
+			last < first || last - first >= MAX_TICKET_RANGE)
+		goto bad;
+
+	n = last - first + 1;
+	rv = ticket_reserve(conf, conf->ticket_count + n);
+	if (rv < 0)
+		return rv;
+
+	for (i = 0; i < n; i++) {
+		snprintf(name, sizeof(name), "%.*s%0*ld%s",
+				(int)(open - pattern), pattern,
+				width, first + i, close + 1);
+		rv = add_ticket(conf, name, i ? NULL : tkp, def);
+		if (rv < 0)
+			return rv;
+	}
+	return n;
+
+bad:
+	log_error("ticket range \"%s\" invalid; expected "
+			"\"name-[first-last]\".", pattern);
+	return -EINVAL;
+}
+
+
+/* The tickets are numbered in configuration order; sites with the
+ * same names in the same order agree on the numbers. */
+static uint32_t ticket_ids_hash(struct booth_config *conf)
+{
+	uLong crc;
+	int i;
+
+	crc = crc32(0L, NULL, 0);
+	for (i = 0; i < conf->ticket_count; i++)
+		crc = crc32(crc, (void *)conf->ticket[i].name,
+				strlen(conf->ticket[i].name) + 1);
+	return crc;
+}
+
+
+/* Which of the daemons of a site serves the ticket. */
+int ticket_shard(const char *name)
+{
+	if (booth_conf->shards <= 1)
+		return 0;
+	return crc32(crc32(0L, NULL, 0), (void *)name, strlen(name)) %
+		booth_conf->shards;
+}
+
+/* Drops the tickets that another shard serves. */
+static void keep_own_tickets(struct booth_config *conf)
+{
+	int i, n;
+
+	n = 0;
+	for (i = 0; i < conf->ticket_count; i++) {
+		if (ticket_shard(conf->ticket[i].name) != booth_shard) {
+			free_ticket(conf->ticket + i);
+			continue;
+		}
+		if (i != n)
+			conf->ticket[n] = conf->ticket[i];
+		n++;
+	}
+	memset(conf->ticket + n, 0,
+			sizeof(conf->ticket[0]) * (conf->ticket_count - n));
+	conf->ticket_count = n;
+}
+
+/* Points all site (and group) addresses to another port. */
+void set_conf_port(struct booth_config *conf, int port)
+{
+	struct booth_site *site;
+	int i, j;
+
+	conf->port = port;
+	for (i = 0; i < conf->site_count; i++) {
+		site = conf->site + i;
+		/* same place in sockaddr_in */
+		site->sa6.sin6_port = htons(port);
+		for (j = 0; j < site->alt_count; j++)
+			site->alt[j].sin6_port = htons(port);
+	}
+	if (conf->mcast6.sin6_family)
+		conf->mcast6.sin6_port = htons(port);
+}
+
+/* The configuration name, with the shard appended for all but the
+ * first; for the names of the files in BOOTH_LIB_DIR. */
+const char *shard_file_name(void)
+{
+	static char name[BOOTH_NAME_LEN + 4];
+
+	if (!booth_shard)
+		return booth_conf->name;
+	snprintf(name, sizeof(name), "%s.%d", booth_conf->name, booth_shard);
+	return name;
+}
+
+
+static int cmp_ticket_name(const void *a, const void *b)
+{
+	return strcmp((*(struct ticket_config * const *)a)->name,
+			(*(struct ticket_config * const *)b)->name);
+}
+
+/* Sorting is quicker than comparing all pairs, for big
+ * configurations. */
+static int check_duplicates(struct booth_config *conf)
+{
+	struct ticket_config **sorted;
+	int i, rv;
+
+	if (conf->ticket_count < 2)
+		return 0;
+
+	sorted = malloc(conf->ticket_count * sizeof(*sorted));
+	if (!sorted) {
+		log_error("out of memory");
+		return -ENOMEM;
+	}
+	for (i = 0; i < conf->ticket_count; i++)
+		sorted[i] = conf->ticket + i;
+	qsort(sorted, conf->ticket_count, sizeof(*sorted), cmp_ticket_name);
+
+	rv = 0;
+	for (i = 1; i < conf->ticket_count; i++) {
+		if (!strcmp(sorted[i-1]->name, sorted[i]->name)) {
+			log_error("ticket name \"%s\" used again.",
+					sorted[i]->name);
+			rv = -EINVAL;
+			break;
+		}
+	}
+	free(sorted);
+	return rv;
+}
+
 static int validate_ticket(struct ticket_config *tk)
 {
 	if (tk->timeout*(tk->retries+1) >= tk->renewal_freq) {
-		tk_log_error("total amount of time to "
+		/* may not be in booth_conf yet; no tk_log_*() */
+		log_error("ticket %s: total amount of time to "
 			"retry sending packets cannot exceed "
 			"renewal frequency "
 			"(%d*(%d+1) >= %d)",
-			tk->timeout, tk->retries, tk->renewal_freq);
+			tk->name, tk->timeout, tk->retries, tk->renewal_freq);
 		return 0;
 	}
 	return 1;
@@ -303,6 +580,96 @@ static int parse_weights(const char *input, int weights[MAX_NODES])
 }
 
 
+/** Parses one of the per-ticket items of the configuration file.
+ * Returns 1 if 'key' was handled, 0 if it is no ticket attribute,
+ * and -1 (with '*error' set) on invalid values. */
+int parse_ticket_attr(struct ticket_config *tk,
+		const char *key, const char *val, const char **error)
+{
+	char *s;
+
+	if (strcmp(key, "expire") == 0) {
+		tk->term_duration = strtol(val, &s, 0);
+		if (*s || s == val || tk->term_duration<10) {
+			*error = "Expected plain integer value >=10 for expire";
+			return -1;
+		}
+		return 1;
+	}
+
+	if (strcmp(key, "timeout") == 0) {
+		tk->timeout = strtol(val, &s, 0);
+		if (*s || s == val || tk->timeout<1) {
+			*error = "Expected plain integer value >=1 for timeout";
+			return -1;
+		}
+		return 1;
+	}
+
+	if (strcmp(key, "retries") == 0) {
+		tk->retries = strtol(val, &s, 0);
+		if (*s || s == val ||
+				tk->retries<3 || tk->retries > 100) {
+			*error = "Expected plain integer value in the range [3, 100] for retries";
+			return -1;
+		}
+		return 1;
+	}
+
+	if (strcmp(key, "renewal-freq") == 0) {
+		tk->renewal_freq = strtol(val, &s, 0);
+		if (*s || s == val || tk->renewal_freq<1) {
+			*error = "Expected plain integer value >=1 for renewal-freq";
+			return -1;
+		}
+		return 1;
+	}
+
+	if (strcmp(key, "acquire-after") == 0) {
+		tk->acquire_after = strtol(val, &s, 0);
+		if (*s || s == val || tk->acquire_after<0) {
+			*error = "Expected plain integer value >=1 for acquire-after";
+			return -1;
+		}
+		return 1;
+	}
+
+	if (strcmp(key, "before-acquire-handler") == 0) {
+		if (tk->ext_verifier) {
+			free(tk->ext_verifier);
+		}
+		tk->ext_verifier = strdup(val);
+		if (!tk->ext_verifier) {
+			*error = "Out of memory";
+			return -1;
+		}
+		return 1;
+	}
+
+	if (strcmp(key, "weights") == 0) {
+		if (parse_weights(val, tk->weight) < 0) {
+			*error = "Invalid weights";
+			return -1;
+		}
+		return 1;
+	}
+
+	if (strcmp(key, "election-delay") == 0) {
+		if (strcasecmp(val, "random") == 0)
+			tk->election_delay = ELECTION_DELAY_RANDOM;
+		else if (strcasecmp(val, "weighted") == 0)
+			tk->election_delay = ELECTION_DELAY_WEIGHTED;
+		else {
+			*error = "Expected \"random\" or \"weighted\" for election-delay";
+			return -1;
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+
 int read_config(const char *path, int type)
 {
 	char line[1024];
@@ -310,11 +677,12 @@ int read_config(const char *path, int type)
 	char *s, *key, *val, *end_of_key;
 	const char *error;
 	char *cp, *cp2;
-	int i;
+	int i, j, rv;
 	int lineno = 0;
 	int got_transport = 0;
 	struct ticket_config defaults = { { 0 } };
 	struct ticket_config *current_tk = NULL;
+	int current_cnt = 0;
 
 
 	fp = fopen(path, "r");
@@ -323,19 +691,17 @@ int read_config(const char *path, int type)
 		return -1;
 	}
 
-	booth_conf = malloc(sizeof(struct booth_config)
-			+ TICKET_ALLOC * sizeof(struct ticket_config));
+	booth_conf = malloc(sizeof(struct booth_config));
 	if (!booth_conf) {
 		log_error("failed to alloc memory for booth config");
 		return -ENOMEM;
 	}
-	memset(booth_conf, 0, sizeof(struct booth_config)
-			+ TICKET_ALLOC * sizeof(struct ticket_config));
-	ticket_size = TICKET_ALLOC;
+	memset(booth_conf, 0, sizeof(struct booth_config));
 
 
 	booth_conf->proto = UDP;
 	booth_conf->port = BOOTH_DEFAULT_PORT;
+	booth_conf->mcast_ttl = 1;
 
 
 	/* Provide safe defaults. -1 is reserved, though. */
@@ -352,6 +718,7 @@ int read_config(const char *path, int type)
 	defaults.timeout       = DEFAULT_TICKET_TIMEOUT;
 	defaults.retries       = DEFAULT_RETRIES;
 	defaults.acquire_after = 0;
+	defaults.election_delay = ELECTION_DELAY_RANDOM;
 
 	error = "";
 
@@ -454,6 +821,8 @@ no_value:
 				booth_conf->proto = UDP;
 			else if (strcasecmp(val, "SCTP") == 0)
 				booth_conf->proto = SCTP;
+			else if (strcasecmp(val, "TCP") == 0)
+				booth_conf->proto = TCP_PEER;
 			else {
 				error = "invalid transport protocol";
 				goto err;
@@ -467,6 +836,16 @@ no_value:
 			continue;
 		}
 
+		if (strcmp(key, "shards") == 0) {
+			booth_conf->shards = strtol(val, &cp, 0);
+			if (*cp || booth_conf->shards < 1 ||
+					booth_conf->shards > MAX_SHARDS) {
+				error = "Invalid number of shards";
+				goto err;
+			}
+			continue;
+		}
+
 		if (strcmp(key, "name") == 0) {
 			safe_copy(booth_conf->name, 
 					val, BOOTH_NAME_LEN,
@@ -474,15 +853,44 @@ no_value:
 			continue;
 		}
 
+		if (strcmp(key, "authfile") == 0) {
+			safe_copy(booth_conf->authfile,
+					val, BOOTH_PATH_LEN,
+					"authfile");
+			continue;
+		}
+
+		if (strcmp(key, "multicast") == 0) {
+			if (set_mcast_group(val) < 0) {
+				error = "Invalid multicast group";
+				goto out;
+			}
+			continue;
+		}
+
+		if (strcmp(key, "multicast-ttl") == 0) {
+			booth_conf->mcast_ttl = strtol(val, &cp, 0);
+			if (*cp || booth_conf->mcast_ttl < 1 ||
+					booth_conf->mcast_ttl > 255) {
+				error = "Expected a TTL between 1 and 255";
+				goto err;
+			}
+			continue;
+		}
+
 		if (strcmp(key, "site") == 0) {
-			if (add_site(val, SITE))
+			if (add_site(val, SITE)) {
+				error = "Invalid site address";
 				goto out;
+			}
 			continue;
 		}
 
 		if (strcmp(key, "arbitrator") == 0) {
-			if (add_site(val, ARBITRATOR))
+			if (add_site(val, ARBITRATOR)) {
+				error = "Invalid site address";
 				goto out;
+			}
 			continue;
 		}
 
@@ -514,15 +922,16 @@ no_value:
 		}
 
 		if (strcmp(key, "ticket") == 0) {
-			if (current_tk && strcmp(current_tk->name, "__defaults__")) {
-				if (!validate_ticket(current_tk)) {
-					goto out;
-				}
-			}
 			if (!strcmp(val, "__defaults__")) {
 				current_tk = &defaults;
-			} else if (add_ticket(val, &current_tk, &defaults)) {
-				goto out;
+				current_cnt = 1;
+			} else {
+				current_cnt = add_ticket_range(booth_conf, val,
+						&current_tk, &defaults);
+				if (current_cnt < 0) {
+					error = "Invalid ticket";
+					goto out;
+				}
 			}
 
 			/* current_tk is valid until another one is needed -
@@ -531,69 +940,17 @@ no_value:
 			continue;
 		}
 
-		if (strcmp(key, "expire") == 0) {
-			current_tk->term_duration = strtol(val, &s, 0);
-			if (*s || s == val || current_tk->term_duration<10) {
-				error = "Expected plain integer value >=10 for expire";
-				goto err;
-			}
-			continue;
-		}
-
-		if (strcmp(key, "timeout") == 0) {
-			current_tk->timeout = strtol(val, &s, 0);
-			if (*s || s == val || current_tk->timeout<1) {
-				error = "Expected plain integer value >=1 for timeout";
-				goto err;
-			}
-			continue;
-		}
-
-		if (strcmp(key, "retries") == 0) {
-			current_tk->retries = strtol(val, &s, 0);
-			if (*s || s == val ||
-					current_tk->retries<3 || current_tk->retries > 100) {
-				error = "Expected plain integer value in the range [3, 100] for retries";
-				goto err;
-			}
-			continue;
-		}
-
-		if (strcmp(key, "renewal-freq") == 0) {
-			current_tk->renewal_freq = strtol(val, &s, 0);
-			if (*s || s == val || current_tk->renewal_freq<1) {
-				error = "Expected plain integer value >=1 for renewal-freq";
-				goto err;
-			}
-			continue;
-		}
-
-		if (strcmp(key, "acquire-after") == 0) {
-			current_tk->acquire_after = strtol(val, &s, 0);
-			if (*s || s == val || current_tk->acquire_after<0) {
-				error = "Expected plain integer value >=1 for acquire-after";
-				goto err;
-			}
-			continue;
-		}
-
-		if (strcmp(key, "before-acquire-handler") == 0) {
-			if (current_tk->ext_verifier) {
-				free(current_tk->ext_verifier);
-			}
-			current_tk->ext_verifier = strdup(val);
-			if (!current_tk->ext_verifier) {
-				error = "Out of memory";
-				goto err;
-			}
-			continue;
+		/* the attributes apply to all tickets of a range */
+		rv = 0;
+		for (j = 0; j < current_cnt; j++) {
+			rv = parse_ticket_attr(current_tk + j, key, val, &error);
+			if (rv <= 0)
+				break;
 		}
-
-		if (strcmp(key, "weights") == 0) {
-			if (parse_weights(val, current_tk->weight) < 0)
-				goto out;
+		if (rv < 0)
+			goto err;
+		if (rv > 0)
 			continue;
-		}
 
 		error = "Unknown item";
 		goto out;
@@ -603,6 +960,22 @@ no_value:
 		log_warn("An odd number of nodes is strongly recommended!");
 	}
 
+	if (booth_conf->mcast6.sin6_family) {
+		if (booth_conf->proto != UDP) {
+			log_error("multicast works only with transport UDP");
+			goto fail;
+		}
+		if (booth_conf->site_count &&
+				booth_conf->mcast6.sin6_family !=
+				booth_conf->site[0].family) {
+			log_error("multicast group and sites differ "
+					"in the address family");
+			goto fail;
+		}
+		/* the port may come after the group */
+		booth_conf->mcast6.sin6_port = htons(booth_conf->port);
+	}
+
 	/* Default: make config name match config filename. */
 	if (!booth_conf->name[0]) {
 		cp = strrchr(path, '/');
@@ -618,8 +991,26 @@ no_value:
 		*(booth_conf->name+(cp2-cp)) = '\0';
 	}
 
-	if (!current_tk->renewal_freq)
-		current_tk->renewal_freq = current_tk->term_duration/2;
+	/* Clients ask the shard of the ticket; see do_client(). */
+	if (booth_conf->shards > 1 && type != CLIENT && type != STATUS) {
+		keep_own_tickets(booth_conf);
+		set_conf_port(booth_conf, booth_conf->port + booth_shard);
+	}
+
+	for (j = 0; j < booth_conf->ticket_count; j++) {
+		current_tk = booth_conf->ticket + j;
+		if (!current_tk->renewal_freq)
+			current_tk->renewal_freq = current_tk->term_duration/2;
+		if (!validate_ticket(current_tk))
+			goto fail;
+	}
+
+	if (check_duplicates(booth_conf) < 0)
+		goto fail;
+	booth_conf->ticket_ids = ticket_ids_hash(booth_conf);
+
+	/* for tickets added at runtime */
+	booth_conf->defaults = defaults;
 
 	return 0;
 
@@ -629,12 +1020,197 @@ out:
 	log_error("%s in config file line %d",
 			error, lineno);
 
+fail:
 	free(booth_conf);
 	booth_conf = NULL;
 	return -1;
 }
 
 
+void free_ticket(struct ticket_config *tk)
+{
+	free(tk->ext_verifier);
+}
+
+void free_config(struct booth_config *conf)
+{
+	int i;
+
+	for (i = 0; i < conf->ticket_count; i++)
+		free_ticket(conf->ticket + i);
+	free(conf->defaults.ext_verifier);
+	free(conf->ticket);
+	free(conf->next_cron);
+	free(conf->hot);
+	free(conf);
+}
+
+
+static int copy_ticket_config(struct ticket_config *tk,
+		const struct ticket_config *from)
+{
+	memset(tk, 0, sizeof(*tk));
+	strcpy(tk->name, from->name);
+	tk->term_duration = from->term_duration;
+	tk->timeout = from->timeout;
+	tk->retries = from->retries;
+	tk->acquire_after = from->acquire_after;
+	tk->renewal_freq = from->renewal_freq;
+	tk->election_delay = from->election_delay;
+	memcpy(tk->weight, from->weight, sizeof(tk->weight));
+
+	if (from->ext_verifier) {
+		tk->ext_verifier = strdup(from->ext_verifier);
+		if (!tk->ext_verifier)
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+/** Copy of the current configuration, without any ticket state;
+ * to be changed and then passed to apply_config(). */
+struct booth_config *copy_config(void)
+{
+	struct booth_config *conf;
+	struct ticket_config *tk;
+	int i;
+
+	conf = malloc(sizeof(*conf));
+	if (!conf)
+		goto oom;
+
+	*conf = *booth_conf;
+	conf->ticket_count = 0;
+	conf->ticket = NULL;
+	conf->next_cron = NULL;
+	conf->hot = NULL;
+	conf->ticket_allocated = 0;
+	if (copy_ticket_config(&conf->defaults, &booth_conf->defaults) < 0 ||
+			ticket_reserve(conf, booth_conf->ticket_count) < 0)
+		goto fail;
+
+	for (i = 0; i < booth_conf->ticket_count; i++) {
+		tk = conf->ticket + i;
+		if (copy_ticket_config(tk, booth_conf->ticket + i) < 0)
+			goto fail;
+		conf->ticket_count++;
+	}
+
+	return conf;
+
+fail:
+	free_config(conf);
+oom:
+	log_error("out of memory");
+	return NULL;
+}
+
+
+/** Adds a ticket to 'conf', with the defaults of the configuration
+ * file and 'attrs' ("key=value" pairs, one per line) on top.
+ * On errors 'conf' stays unchanged. */
+int config_add_ticket(struct booth_config *conf, const char *name,
+		const char *attrs, const char **error)
+{
+	struct ticket_config *tk;
+	char buf[BOOTH_ATTRS_LEN];
+	char *line, *save, *key, *val, *end;
+	int had, rv;
+
+	if (conf_ticket(conf, name)) {
+		*error = "Ticket exists already";
+		return -EEXIST;
+	}
+
+	if (ticket_shard(name) != booth_shard) {
+		*error = "Ticket belongs to another shard";
+		return -EINVAL;
+	}
+
+	if (strlen(attrs) >= sizeof(buf)) {
+		*error = "Attributes too long";
+		return -EINVAL;
+	}
+	strcpy(buf, attrs);
+
+	had = conf->ticket_count;
+	*error = "Invalid ticket name";
+	rv = add_ticket(conf, name, &tk, &conf->defaults);
+	if (rv < 0)
+		goto fail;
+
+	rv = -EINVAL;
+	for (line = strtok_r(buf, "\n", &save); line;
+			line = strtok_r(NULL, "\n", &save)) {
+		key = skip_while(line, isspace);
+		if (is_end_of_line(key))
+			continue;
+
+		val = strchr(key, '=');
+		if (!val) {
+			*error = "Expected '=' after key";
+			goto fail;
+		}
+		end = val;
+		while (end > key && isspace(end[-1]))
+			end--;
+		*end = 0;
+
+		val = skip_while(val + 1, isspace);
+		end = val + strlen(val);
+		while (end > val && isspace(end[-1]))
+			end--;
+		*end = 0;
+
+		switch (parse_ticket_attr(tk, key, val, error)) {
+		case 1:
+			continue;
+		case 0:
+			*error = "Unknown item";
+		}
+		goto fail;
+	}
+
+	if (!tk->renewal_freq)
+		tk->renewal_freq = tk->term_duration/2;
+
+	if (!validate_ticket(tk)) {
+		*error = "Invalid timeouts";
+		goto fail;
+	}
+
+	conf->ticket_ids = ticket_ids_hash(conf);
+	return 0;
+
+fail:
+	if (conf->ticket_count > had) {
+		tk = conf->ticket + had;
+		free_ticket(tk);
+		memset(tk, 0, sizeof(*tk));
+		conf->ticket_count = had;
+	}
+	return rv;
+}
+
+
+int config_del_ticket(struct booth_config *conf, const char *name)
+{
+	struct ticket_config *tk;
+	int rest;
+
+	tk = conf_ticket(conf, name);
+	if (!tk)
+		return -ENOENT;
+
+	free_ticket(tk);
+	rest = conf->ticket_count - (tk - conf->ticket) - 1;
+	memmove(tk, tk + 1, rest * sizeof(*tk));
+	conf->ticket_count--;
+	conf->ticket_ids = ticket_ids_hash(conf);
+	return 0;
+}
+
+
 int check_config(int type)
 {
 	struct passwd *pw;
@@ -34,6 +34,46 @@
 #define TICKET_ALLOC	16
 
 
+/** How the start of an election gets delayed.
+ * See add_random_delay(). */
+typedef enum {
+	/** Uniformly random, up to a second. */
+	ELECTION_DELAY_RANDOM = 0,
+	/** By rank of the site (weights, then config order);
+	 * the slot length depends on the measured round-trip times. */
+	ELECTION_DELAY_WEIGHTED,
+} election_delay_e;
+
+
+/** What we tell others about a ticket while we are candidate for
+ * a new term; see new_election() and status_ticket(). */
+struct ticket_status {
+	struct booth_site *leader;
+	struct booth_site *voted_for;
+	struct booth_site *successor;
+	uint32_t current_term;
+	time_t term_expires;
+};
+
+
+/** The runtime values of a ticket that are read all the time (the
+ * state, the expiry, the acks we wait for), in an array parallel
+ * to the tickets, like the wakeup times; see tk_hot(). */
+struct ticket_hot {
+	/* bitmask of servers which sent acks
+	 */
+	uint64_t acks_received;
+	/** Timestamp of leadership expiration */
+	time_t term_expires;
+	/** Current state. */
+	server_state_e state;
+	/* if we expect some acks, then set this to the id of
+	 * the RPC which others will send us; it is cleared once all
+	 * replies were received
+	 */
+	uint32_t acks_expected;
+};
+
 
 struct ticket_config {
 	/** \name Configuration items.
@@ -66,20 +106,19 @@ struct ticket_config {
 
 	/** Node weights. */
 	int weight[MAX_NODES];
+
+	/** How to delay elections. */
+	election_delay_e election_delay;
 	/** @} */
 
 
 	/** \name Runtime values.
+	 * Those every round of the state machine reads are in
+	 * struct ticket_hot.
 	 * @{ */
-	/** Current state. */
-	server_state_e state;
-
 	/** Next state. Used at startup. */
 	server_state_e next_state;
 
-	/** When something has to be done */
-	timetype next_cron;
-
 	/** The client which sent a request */
 	struct client *req_client;
 
@@ -91,8 +130,6 @@ struct ticket_config {
 
 	/** Is the ticket granted? */
 	int is_granted;
-	/** Timestamp of leadership expiration */
-	time_t term_expires;
 	/** End of election period */
 	time_t election_end;
 	struct booth_site *voted_for;
@@ -118,12 +155,6 @@ struct ticket_config {
 	/** @} */
 
 
-	/** */
-	uint32_t last_applied;
-	uint32_t next_index[MAX_NODES];
-	uint32_t match_index[MAX_NODES];
-
-
 	/* Why did we start the elections?
 	*/
 	cmd_reason_t election_reason;
@@ -137,16 +168,8 @@ struct ticket_config {
 	/* the last request RPC we sent
 	 */
 	uint32_t last_request;
-	/* if we expect some acks, then set this to the id of
-	 * the RPC which others will send us; it is cleared once all
-	 * replies were received
-	 */
-	uint32_t acks_expected;
-	/* bitmask of servers which sent acks
-	 */
-	uint64_t acks_received;
-	/* timestamp of the request, currently unused */
-	time_t req_sent_at;
+	/* timestamp of the request, used to measure round-trip times */
+	timetype req_sent_at;
 	/* we need to wait for MY_INDEX from other servers,
 	 * hold the ticket processing for a while until they reply
 	 */
@@ -166,16 +189,43 @@ struct ticket_config {
 	*/
 	int in_election;
 
+	/* Are we asking whether we could win an election (without
+	 * bumping the term yet)? Bitmap of the sites that agreed.
+	 */
+	int in_prevote;
+	uint64_t prevotes;
+
 	/* don't log warnings unnecessarily
 	 */
 	int expect_more_rejects;
+
+	/* The site which takes over once the lease runs out.
+	 * The leader picks it (see pick_successor()) and sends it
+	 * along with every heartbeat and update.
+	 */
+	struct booth_site *successor;
+	/* On the leader: bitmap of sites whose before-acquire-handler
+	 * succeeded, as reported in their acks
+	 */
+	uint64_t acquire_ok;
+	/* Local before-acquire-handler result and when we got it;
+	 * reported to the leader in acks
+	 */
+	int acquire_verdict;
+	time_t acquire_verdict_at;
+	int verdict_pending;
+	/* The before-acquire-handler runs for a grant or renewal
+	 * (see acquire_ticket()), and what came of it
+	 */
+	int test_pending;
+	int acquire_rv;
 	/** \name Needed while proposals are being done.
 	 * @{ */
 	/* Need to keep the previous valid ticket in case we moved to
 	 * start new elections and another server asks for the ticket
 	 * status. It would be wrong to send our candidate ticket.
 	*/
-	struct ticket_config *last_valid_tk;
+	struct ticket_status last_valid;
 
 	/** Whom to vote for the next time.
 	 * Needed to push a ticket to someone else. */
@@ -203,6 +253,9 @@ struct ticket_config {
 	/** @} */
 };
 
+/** Size of the key derived from the authfile, in bytes. */
+#define AUTH_KEY_LEN	16
+
 struct booth_config {
     char name[BOOTH_NAME_LEN];
 
@@ -227,16 +280,66 @@ struct booth_config {
     int ticket_count;
     int ticket_allocated;
     struct ticket_config *ticket;
+    /** When something has to be done for the ticket of the same
+     * index. Kept apart, so that the scan in process_tickets()
+     * touches just a few cache lines. See tk_next_cron(). */
+    timetype *next_cron;
+    /** The same for the hot runtime values. See tk_hot(). */
+    struct ticket_hot *hot;
+    /** Hash over the ticket names in order; sites with the same
+     * hash can refer to tickets by index. See ticket_ids_hash(). */
+    uint32_t ticket_ids;
+
+    /** The "__defaults__" ticket section, for tickets added at
+     * runtime. */
+    struct ticket_config defaults;
+
+    /** Messages between sites are signed if set; see auth.c. */
+    char authfile[BOOTH_PATH_LEN];
+    int auth;
+    unsigned char authkey[AUTH_KEY_LEN];
+
+    /** Group for broadcasts with UDP, if the family is set;
+     * see booth_udp_init(). */
+    union {
+        struct sockaddr_in  mcast4;
+        struct sockaddr_in6 mcast6;
+    };
+    int mcast_ttl;
+
+    /** Tickets are spread over that many daemons per site, each
+     * on its own port; see ticket_shard(). */
+    int shards;
 };
 
 
 extern struct booth_config *booth_conf;
 
+static inline struct ticket_hot *tk_hot(const struct ticket_config *tk)
+{
+	return booth_conf->hot + (tk - booth_conf->ticket);
+}
+
+/** The shard this daemon serves; 0 for the first (or only) one. */
+extern int booth_shard;
+
 
 int read_config(const char *path, int type);
+int parse_ticket_attr(struct ticket_config *tk,
+		const char *key, const char *val, const char **error);
+struct booth_config *copy_config(void);
+int config_add_ticket(struct booth_config *conf, const char *name,
+		const char *attrs, const char **error);
+int config_del_ticket(struct booth_config *conf, const char *name);
+void free_ticket(struct ticket_config *tk);
+void free_config(struct booth_config *conf);
 
 int check_config(int type);
 
+int ticket_shard(const char *name);
+void set_conf_port(struct booth_config *conf, int port);
+const char *shard_file_name(void);
+
 int find_site_by_name(unsigned char *site, struct booth_site **node, int any_type);
 int find_site_by_id(uint32_t site_id, struct booth_site **node);
 
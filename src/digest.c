@@ -0,0 +1,201 @@
+/* 
+ * Copyright (C) 2026 agent <agent@local>
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+#include "ticket.h"
+#include "config.h"
+#include "inline-fn.h"
+#include "log.h"
+#include "booth.h"
+#include "transport.h"
+#include "digest.h"
+#include "catalog.h"
+
+
+/* Anti-entropy: every DIGEST_INTERVAL seconds we send the hashes
+ * over all tickets to the other sites. Those compare them to
+ * their own and only drill down into ranges which differ; for
+ * single tickets that differ the usual OP_MY_INDEX exchange
+ * follows.
+ *
+ * Only the leader and the term go into the hash, the expiry time
+ * is derived locally and would never match. */
+#define DIGEST_INTERVAL 30
+
+
+static uint32_t ticket_hash(struct ticket_config *tk)
+{
+	struct ticket_status st;
+	uint32_t v[2], crc;
+
+	status_ticket(tk, &st);
+	v[0] = htonl(get_node_id(status_leader(&st)));
+	v[1] = htonl(st.current_term);
+
+	crc = crc32(0L, NULL, 0);
+	crc = crc32(crc, (void *)tk->name, strlen(tk->name));
+	return crc32(crc, (void *)v, sizeof(v));
+}
+
+
+static uint32_t range_hash(int first, int cnt)
+{
+	uint32_t crc, h;
+	int i;
+
+	crc = crc32(0L, NULL, 0);
+	for (i = first; i < first + cnt; i++) {
+		h = ticket_hash(booth_conf->ticket + i);
+		crc = crc32(crc, (void *)&h, sizeof(h));
+	}
+	return crc;
+}
+
+
+/* The smallest power of the fanout to cover all tickets. */
+static int top_span(void)
+{
+	int span;
+
+	for (span = 1; span * DIGEST_FANOUT < booth_conf->ticket_count; )
+		span *= DIGEST_FANOUT;
+	return span;
+}
+
+
+static int send_digest(struct booth_site *dest, int first, int span)
+{
+	struct boothc_digest_msg msg;
+	int i, start, cnt;
+
+	init_header(&msg.header, OP_DIGEST, 0, 0, RLT_SUCCESS, 0,
+			sizeof(msg));
+	msg.digest.ticket_count = htonl(booth_conf->ticket_count);
+	msg.digest.ticket_ids = htonl(booth_conf->ticket_ids);
+	msg.digest.first = htonl(first);
+	msg.digest.span = htonl(span);
+
+	for (i = 0; i < DIGEST_FANOUT; i++) {
+		start = first + i * span;
+		cnt = min(span, booth_conf->ticket_count - start);
+		msg.digest.hash[i] = cnt > 0 ? htonl(range_hash(start, cnt)) : 0;
+	}
+	msg.digest.catalog = htonl(catalog_hash());
+
+	return transport()->send(dest, &msg, sizeof(msg));
+}
+
+
+int process_digest(struct booth_site *sender,
+		struct boothc_digest_msg *msg)
+{
+	struct ticket_config *tk, *differ[DIGEST_FANOUT];
+	int first, span, i, cnt, n;
+	int64_t start;
+
+	if (ntohl(msg->digest.ticket_count) != booth_conf->ticket_count) {
+		log_debug("%s has %d tickets configured, we %d "
+				"(ignoring digest)",
+				site_string(sender),
+				ntohl(msg->digest.ticket_count),
+				booth_conf->ticket_count);
+		/* it may have missed a "booth add" or "booth del" */
+		catalog_resend(sender);
+		return 0;
+	}
+
+	/* or got another one of two at the same time */
+	if (ntohl(msg->digest.catalog) != catalog_hash())
+		catalog_resend(sender);
+
+	first = ntohl(msg->digest.first);
+	span = ntohl(msg->digest.span);
+	/* from the wire; the ranges must stay within the tickets */
+	if (first < 0 || first >= booth_conf->ticket_count ||
+			span < 1 || span > top_span() ||
+			(span > 1 && span % DIGEST_FANOUT)) {
+		log_error("invalid digest from %s (first %d, span %d)",
+				site_string(sender), first, span);
+		return -EINVAL;
+	}
+
+	n = 0;
+	for (i = 0; i < DIGEST_FANOUT; i++) {
+		start = first + (int64_t)i * span;
+		if (start >= booth_conf->ticket_count)
+			break;
+		cnt = min(span, booth_conf->ticket_count - (int)start);
+		if (ntohl(msg->digest.hash[i]) == range_hash(start, cnt))
+			continue;
+
+		if (span > 1) {
+			send_digest(sender, start, span / DIGEST_FANOUT);
+			continue;
+		}
+
+		tk = booth_conf->ticket + start;
+		tk_log_debug("differs at %s", site_string(sender));
+		if (tk->in_election)
+			continue;
+		if (ntohl(msg->digest.ticket_ids) == booth_conf->ticket_ids &&
+				(sender->caps & CAP_BULK))
+			differ[n++] = tk;
+		else
+			send_msg(OP_MY_INDEX, tk, sender, NULL);
+	}
+
+	/* all in one go */
+	if (n)
+		return send_compact_status(sender, OP_DIGEST, differ, n,
+				RLT_SUCCESS);
+	return 0;
+}
+
+
+void digest_cron(void)
+{
+	static time_t next;
+	struct booth_site *site;
+	time_t now;
+	int span, i;
+
+	if (!booth_conf || !booth_conf->ticket_count)
+		return;
+
+	now = get_secs(NULL);
+	if (now < next)
+		return;
+	/* no need right after startup */
+	if (!next) {
+		next = now + DIGEST_INTERVAL;
+		return;
+	}
+	next = now + DIGEST_INTERVAL;
+
+	span = top_span();
+
+	/* older sites don't know about digests */
+	foreach_node(i, site) {
+		if (site != local && (site->caps & CAP_DIGEST))
+			send_digest(site, 0, span);
+	}
+}
@@ -24,6 +24,8 @@
 #include <stdio.h>
 #include <assert.h>
 #include <time.h>
+#include <spawn.h>
+#include <sys/wait.h>
 #include "ticket.h"
 #include "config.h"
 #include "inline-fn.h"
@@ -31,40 +33,143 @@
 #include "pacemaker.h"
 #include "booth.h"
 #include "handler.h"
+#include "worker.h"
 
 
+extern char **environ;
 
-/** Runs an external handler.
- * See eg. 'before-acquire-handler'.
- * TODO: timeout, async operation?. */
-int run_handler(struct ticket_config *tk,
-		const char *cmd, int synchronous)
-{
+#define HANDLER_ENV	5
+
+/* A handler run, done by the worker thread. The environment is
+ * put together here, as setenv() can't be used in the thread. */
+struct handler_job {
+	char name[BOOTH_NAME_LEN];
+	char *cmd;
+	char **envp;
+	char env[HANDLER_ENV][BOOTH_PATH_LEN + 32];
+	handler_done_fn done;
+	int arg;
 	int rv;
-	char expires[16];
+};
 
-	if (!cmd)
-		return 0;
 
-	assert(synchronous);
-	sprintf(expires, "%" PRId64, (int64_t)wall_ts(tk->term_expires));
+static void free_job(struct handler_job *job)
+{
+	free(job->cmd);
+	free(job->envp);
+	free(job);
+}
+
+
+/* The environment of the daemon, with ours instead of any
+ * BOOTH_ variables. */
+static int make_env(struct handler_job *job, struct ticket_config *tk)
+{
+	int i, n, cnt;
+
+	snprintf(job->env[0], sizeof(job->env[0]),
+			"BOOTH_TICKET=%s", tk->name);
+	snprintf(job->env[1], sizeof(job->env[1]),
+			"BOOTH_LOCAL=%s", local->addr_string);
+	snprintf(job->env[2], sizeof(job->env[2]),
+			"BOOTH_CONF_NAME=%s", booth_conf->name);
+	snprintf(job->env[3], sizeof(job->env[3]),
+			"BOOTH_CONF_PATH=%s", cl.configfile);
+	snprintf(job->env[4], sizeof(job->env[4]),
+			"BOOTH_TICKET_EXPIRES=%" PRId64,
+			(int64_t)wall_ts(tk_hot(tk)->term_expires));
 
-	rv = setenv("BOOTH_TICKET", tk->name, 1) ||
-		setenv("BOOTH_LOCAL", local->addr_string, 1) ||
-		setenv("BOOTH_CONF_NAME", booth_conf->name, 1) ||
-		setenv("BOOTH_CONF_PATH", cl.configfile, 1) ||
-		setenv("BOOTH_TICKET_EXPIRES", expires, 1);
+	for (cnt = 0; environ[cnt]; cnt++) ;
+	job->envp = malloc((cnt + HANDLER_ENV + 1) * sizeof(char *));
+	if (!job->envp)
+		return -ENOMEM;
 
+	for (i = n = 0; i < cnt; i++)
+		if (strncmp(environ[i], "BOOTH_", 6))
+			job->envp[n++] = environ[i];
+	for (i = 0; i < HANDLER_ENV; i++)
+		job->envp[n++] = job->env[i];
+	job->envp[n] = NULL;
+	return 0;
+}
+
+
+/* In the worker thread; no logging there. */
+static void handler_run(void *arg)
+{
+	struct handler_job *job = arg;
+	char sh[] = "sh", c[] = "-c";
+	char *argv[] = { sh, c, job->cmd, NULL };
+	pid_t pid;
+	int rv;
+
+	rv = posix_spawn(&pid, "/bin/sh", NULL, NULL, argv, job->envp);
 	if (rv) {
-		log_error("Cannot set environment: %s", strerror(errno));
-	} else {
-		rv = system(cmd);
-		if (rv)
-			tk_log_warn("handler \"%s\" exited with error %s",
-					cmd, interpret_rv(rv));
-		else
-			tk_log_debug("handler \"%s\" exited with success", cmd);
+		/* like system() */
+		job->rv = 127 << 8;
+		return;
+	}
+	while (waitpid(pid, &job->rv, 0) < 0 && errno == EINTR) ;
+}
+
+/* Back in the event loop. The ticket is looked up again, the
+ * configuration might have been reloaded meanwhile. */
+static void handler_done(void *arg)
+{
+	struct handler_job *job = arg;
+	struct ticket_config *tk;
+
+	if (!find_ticket_by_name(job->name, &tk)) {
+		log_warn("ticket %s gone while its handler ran", job->name);
+		goto out;
 	}
 
+	if (job->rv)
+		tk_log_warn("handler \"%s\" exited with error %s",
+				job->cmd, interpret_rv(job->rv));
+	else
+		tk_log_debug("handler \"%s\" exited with success", job->cmd);
+	job->done(tk, job->rv, job->arg);
+
+out:
+	free_job(job);
+}
+
+
+/** Runs an external handler, see eg. 'before-acquire-handler'.
+ * That happens in the worker thread, 'done' gets its exit status
+ * back in the event loop (right away, if there's no thread).
+ * 'arg' is passed on as is. */
+int run_handler(struct ticket_config *tk, const char *cmd,
+		handler_done_fn done, int arg)
+{
+	struct handler_job *job;
+	int rv;
+
+	if (!cmd) {
+		done(tk, 0, arg);
+		return 0;
+	}
+
+	job = calloc(1, sizeof(*job));
+	if (!job) {
+		log_error("out of memory");
+		return -ENOMEM;
+	}
+	strcpy(job->name, tk->name);
+	job->cmd = strdup(cmd);
+	job->done = done;
+	job->arg = arg;
+	if (!job->cmd || make_env(job, tk) < 0) {
+		log_error("out of memory");
+		free_job(job);
+		return -ENOMEM;
+	}
+
+	rv = worker_queue(WORKER_HANDLER, handler_run, handler_done, job);
+	if (rv < 0) {
+		tk_log_error("cannot run handler \"%s\": too much queued", cmd);
+		free_job(job);
+	}
 	return rv;
 }
@@ -19,8 +19,10 @@
 #ifndef _HANDLER_H
 #define _HANDLER_H
 
-int run_handler(struct ticket_config *tk,
-		const char *cmd, int synchronous);
+typedef void (*handler_done_fn)(struct ticket_config *tk, int rv, int arg);
+
+int run_handler(struct ticket_config *tk, const char *cmd,
+		handler_done_fn done, int arg);
 
 
 #endif
@@ -45,7 +45,7 @@ inline static int term_time_left(const struct ticket_config *tk)
 {
 	int left;
 
-	left = tk->term_expires - get_secs(NULL);
+	left = tk_hot(tk)->term_expires - get_secs(NULL);
 	return (left < 0) ? 0 : left;
 }
 
@@ -68,10 +68,12 @@ inline static int is_owned(const struct ticket_config *tk)
 
 
 static inline void init_header_bare(struct boothc_header *h) {
-	assert(local && local->site_id);
+	assert(!local || local->site_id);
 	h->magic   = htonl(BOOTHC_MAGIC);
 	h->version = htonl(BOOTHC_VERSION);
-	h->from    = htonl(local->site_id);
+	/* a client given a site doesn't know its own, see
+	 * setup_config(); the daemons don't look at it for commands */
+	h->from    = htonl(local ? local->site_id : 0);
 	h->iv      = htonl(0);
 	h->auth1   = htonl(0);
 	h->auth2   = htonl(0);
@@ -95,9 +97,32 @@ static inline void init_ticket_site_header(struct boothc_ticket_msg *msg, int cm
 	init_header(&msg->header, cmd, 0, 0, 0, 0, sizeof(*msg));
 }
 
+/* While in elections, we report the last valid ticket. */
+static inline void status_ticket(struct ticket_config *tk,
+		struct ticket_status *st)
+{
+	if (tk_hot(tk)->state == ST_CANDIDATE &&
+			tk->last_valid.current_term) {
+		*st = tk->last_valid;
+		return;
+	}
+
+	st->leader = tk->leader;
+	st->voted_for = tk->voted_for;
+	st->successor = tk->successor;
+	st->current_term = tk->current_term;
+	st->term_expires = tk_hot(tk)->term_expires;
+}
+
+/* The reported leader, or NULL. */
+static inline struct booth_site *status_leader(const struct ticket_status *st)
+{
+	return (st->leader && st->leader != no_leader) ? st->leader : NULL;
+}
+
 #define my_last_term(tk) \
-	(((tk)->state == ST_CANDIDATE && (tk)->last_valid_tk->current_term) ? \
-	(tk)->last_valid_tk->current_term : (tk)->current_term)
+	((tk_hot(tk)->state == ST_CANDIDATE && (tk)->last_valid.current_term) ? \
+	(tk)->last_valid.current_term : (tk)->current_term)
 
 static inline void init_ticket_msg(struct boothc_ticket_msg *msg,
 		int cmd, int request, int rv, int reason,
@@ -109,6 +134,7 @@ static inline void init_ticket_msg(struct boothc_ticket_msg *msg,
 
 	if (!tk) {
 		memset(&msg->ticket, 0, sizeof(msg->ticket));
+		msg->ticket.successor = htonl(NO_ONE);
 	} else {
 		memcpy(msg->ticket.id, tk->name, sizeof(msg->ticket.id));
 
@@ -116,9 +142,29 @@ static inline void init_ticket_msg(struct boothc_ticket_msg *msg,
 			(tk->leader && tk->leader != no_leader) ? tk->leader : tk->voted_for));
 		msg->ticket.term           = htonl(tk->current_term);
 		msg->ticket.term_valid_for = htonl(term_time_left(tk));
+		msg->ticket.successor      = htonl(get_node_id(tk->successor));
 	}
 }
 
+/* init_ticket_msg() with what we report to others, see
+ * status_ticket(). */
+static inline void init_status_msg(struct boothc_ticket_msg *msg,
+		int cmd, int request, struct ticket_config *tk)
+{
+	struct ticket_status st;
+	int left;
+
+	init_ticket_msg(msg, cmd, request, RLT_SUCCESS, 0, tk);
+	status_ticket(tk, &st);
+	left = st.term_expires - get_secs(NULL);
+
+	msg->ticket.leader         = htonl(get_node_id(
+		status_leader(&st) ? st.leader : st.voted_for));
+	msg->ticket.term           = htonl(st.current_term);
+	msg->ticket.term_valid_for = htonl(left < 0 ? 0 : left);
+	msg->ticket.successor      = htonl(get_node_id(st.successor));
+}
+
 
 static inline struct booth_transport const *transport(void)
 {
@@ -142,12 +188,12 @@ static inline void disown_ticket(struct ticket_config *tk)
 {
 	tk->leader = NULL;
 	tk->is_granted = 0;
-	get_secs(&tk->term_expires);
+	get_secs(&tk_hot(tk)->term_expires);
 }
 
 static inline int disown_if_expired(struct ticket_config *tk)
 {
-	if (get_secs(NULL) >= tk->term_expires ||
+	if (get_secs(NULL) >= tk_hot(tk)->term_expires ||
 			!tk->leader) {
 		disown_ticket(tk);
 		return 1;
@@ -240,16 +286,16 @@ static inline void expect_replies(struct ticket_config *tk,
 		int reply_type)
 {
 	tk->retry_number = 0;
-	tk->acks_expected = reply_type;
-	tk->acks_received = local->bitmask;
-	tk->req_sent_at  = get_secs(NULL);
+	tk_hot(tk)->acks_expected = reply_type;
+	tk_hot(tk)->acks_received = local->bitmask;
+	get_time(&tk->req_sent_at);
 	tk->ticket_updated = 0;
 }
 
 static inline void no_resends(struct ticket_config *tk)
 {
 	tk->retry_number = 0;
-	tk->acks_expected = 0;
+	tk_hot(tk)->acks_expected = 0;
 }
 
 static inline struct booth_site *my_vote(struct ticket_config *tk)
@@ -258,6 +304,18 @@ static inline struct booth_site *my_vote(struct ticket_config *tk)
 }
 
 
+/** Is site @a preferred over site @b for this ticket?
+ * A higher weight wins; for equal weights the order in the
+ * configuration file decides. */
+static inline int site_preferred(const struct ticket_config *tk,
+		const struct booth_site *a, const struct booth_site *b)
+{
+	if (tk->weight[a->index] != tk->weight[b->index])
+		return tk->weight[a->index] > tk->weight[b->index];
+	return a->index < b->index;
+}
+
+
 static inline int count_bits(uint64_t val) {
 	return __builtin_popcount(val);
 }
@@ -273,12 +331,12 @@ static inline int majority_of_bits(struct ticket_config *tk, uint64_t val)
 
 static inline int all_replied(struct ticket_config *tk)
 {
-	return !(tk->acks_received ^ booth_conf->all_bits);
+	return !(tk_hot(tk)->acks_received ^ booth_conf->all_bits);
 }
 
 static inline int all_sites_replied(struct ticket_config *tk)
 {
-	return !((tk->acks_received & booth_conf->sites_bits) ^ booth_conf->sites_bits);
+	return !((tk_hot(tk)->acks_received & booth_conf->sites_bits) ^ booth_conf->sites_bits);
 }
 
 
@@ -0,0 +1,493 @@
+/* 
+ * Copyright (C) 2026 agent <agent@local>
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "ticket.h"
+#include "config.h"
+#include "inline-fn.h"
+#include "log.h"
+#include "booth.h"
+#include "transport.h"
+#include "worker.h"
+#include "journal.h"
+
+
+/* Raft wants the term and the vote to survive a crash. Changes
+ * are appended to a journal; records are collected during one
+ * round of the main loop and written in journal_flush(), with a
+ * single fdatasync() on the journal worker (see worker.c). Until
+ * that is done outgoing datagrams are held back (see
+ * booth_udp_send()), so nobody hears about a vote which is not
+ * on disk yet; the loop goes on meanwhile.
+ *
+ * On startup the journal is read, and then rewritten with only
+ * the last record per ticket once it grows too large. */
+
+/* compact when the journal has that many records per ticket */
+#define JOURNAL_RECORDS_PER_TICKET 64
+
+struct journal_record {
+	/** Ticket index in the configuration ... */
+	uint32_t index;
+	/** ... and a hash over its name, in case it changed. */
+	uint32_t name_crc;
+	uint32_t term;
+	uint32_t voted_for;
+	/* over all of the above */
+	uint32_t crc;
+} __attribute__((packed));
+
+struct journal_state {
+	uint32_t name_crc;
+	uint32_t term;
+	uint32_t voted_for;
+	int valid;
+};
+
+static int journal_fd = -1;
+static char journal_path[BOOTH_PATH_LEN + 1];
+/* what is (or will be) in the journal for each ticket */
+static struct journal_state *jstate;
+static struct journal_record *pending;
+static int pending_cnt, pending_alloc;
+static int file_records;
+/* A write failed, and the file may end in a torn record, which
+ * would hide anything appended after it from replay(). Until it
+ * is rewritten, see journal_flush(), nothing goes out. */
+static int journal_broken;
+static time_t compact_retry;
+
+/* A sync on the worker; only one at a time. */
+struct sync_job {
+	/* a dup() of journal_fd, or the compacted file */
+	int fd;
+	int compact;
+	/* rewriting a broken journal */
+	int repair;
+	/* written, or in the compacted file */
+	int records;
+	/* datagrams that wait for this sync */
+	int held;
+	int err;
+};
+
+static struct sync_job *syncing;
+
+
+static uint32_t name_crc(struct ticket_config *tk)
+{
+	return crc32(crc32(0L, NULL, 0), (void *)tk->name,
+			strlen(tk->name));
+}
+
+
+static uint32_t record_crc(struct journal_record *r)
+{
+	return crc32(crc32(0L, NULL, 0), (void *)r,
+			offsetof(struct journal_record, crc));
+}
+
+
+static void fill_record(struct journal_record *r, int i)
+{
+	r->index = htonl(i);
+	r->name_crc = htonl(jstate[i].name_crc);
+	r->term = htonl(jstate[i].term);
+	r->voted_for = htonl(jstate[i].voted_for);
+	r->crc = htonl(record_crc(r));
+}
+
+
+static int replay(int fd)
+{
+	struct journal_record r;
+	uint32_t i;
+	int rv, cnt;
+
+	cnt = 0;
+	while ((rv = read(fd, &r, sizeof(r))) == sizeof(r)) {
+		if (ntohl(r.crc) != record_crc(&r)) {
+			/* torn write; the rest is garbage */
+			log_warn("journal %s: bad record #%d, "
+					"ignoring the rest", journal_path, cnt);
+			break;
+		}
+		cnt++;
+		i = ntohl(r.index);
+		if (i >= booth_conf->ticket_count ||
+				ntohl(r.name_crc) != jstate[i].name_crc)
+			continue;
+		jstate[i].term = ntohl(r.term);
+		jstate[i].voted_for = ntohl(r.voted_for);
+		jstate[i].valid = 1;
+	}
+
+	return cnt;
+}
+
+
+static void tmp_path(char *buf, int len)
+{
+	snprintf(buf, len, "%s.new", journal_path);
+}
+
+
+/* Write the current state into a new file; compact_finish()
+ * syncs it and replaces the journal with it. Returns the file
+ * descriptor. */
+static int compact_write(int *cnt)
+{
+	char tmp[BOOTH_PATH_LEN + 8];
+	struct journal_record r;
+	int fd, i;
+
+	tmp_path(tmp, sizeof(tmp));
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+	if (fd < 0)
+		goto err;
+
+	*cnt = 0;
+	for (i = 0; i < booth_conf->ticket_count; i++) {
+		if (!jstate[i].valid)
+			continue;
+		fill_record(&r, i);
+		if (write(fd, &r, sizeof(r)) != sizeof(r))
+			goto err_close;
+		(*cnt)++;
+	}
+	return fd;
+
+err_close:
+	close(fd);
+	unlink(tmp);
+err:
+	log_warn("cannot compact journal %s: %s",
+			journal_path, strerror(errno));
+	return -errno;
+}
+
+
+/* 'err' is what the fdatasync() of 'fd' gave. */
+static int compact_finish(int fd, int cnt, int err)
+{
+	char tmp[BOOTH_PATH_LEN + 8];
+
+	tmp_path(tmp, sizeof(tmp));
+	if (err || rename(tmp, journal_path)) {
+		if (!err)
+			err = errno;
+		close(fd);
+		unlink(tmp);
+		log_warn("cannot compact journal %s: %s",
+				journal_path, strerror(err));
+		return -err;
+	}
+
+	close(journal_fd);
+	journal_fd = fd;
+	file_records = cnt;
+	log_debug("journal %s compacted to %d records",
+			journal_path, cnt);
+	return 0;
+}
+
+
+static int compact(void)
+{
+	int fd, cnt;
+
+	fd = compact_write(&cnt);
+	if (fd < 0)
+		return fd;
+	return compact_finish(fd, cnt, fdatasync(fd) ? errno : 0);
+}
+
+
+int journal_open(void)
+{
+	int fd, i, rv;
+
+	/* Again after a configuration reload; the tickets are noted
+	 * anew then, so what wasn't written yet doesn't matter. A
+	 * sync still running finds itself stale, see sync_done(). */
+	if (journal_fd >= 0) {
+		close(journal_fd);
+		journal_fd = -1;
+	}
+	syncing = NULL;
+	pending_cnt = 0;
+	journal_broken = 0;
+	free(jstate);
+	jstate = calloc(booth_conf->ticket_count, sizeof(*jstate));
+	if (!jstate)
+		return -ENOMEM;
+	for (i = 0; i < booth_conf->ticket_count; i++)
+		jstate[i].name_crc = name_crc(booth_conf->ticket + i);
+
+	/* After reboot the directory may not yet exist.
+	 * Try to create it, but ignore errors. */
+	mkdir(BOOTH_LIB_DIR, 0775);
+	snprintf(journal_path, sizeof(journal_path), "%s%s-%s.journal",
+			BOOTH_LIB_DIR, shard_file_name(), site_string(local));
+
+	fd = open(journal_path, O_RDWR | O_CREAT | O_APPEND, 0640);
+	if (fd < 0) {
+		log_warn("cannot open journal %s: %s",
+				journal_path, strerror(errno));
+		return -errno;
+	}
+
+	journal_fd = fd;
+	file_records = replay(fd);
+	/* drop anything after a bad record, too */
+	rv = compact();
+	if (rv < 0)
+		journal_broken = 1;
+	return rv;
+}
+
+
+/* Take over the term and vote from before the restart, unless
+ * the CIB knows about a newer term. Returns 0 if anything was
+ * restored. */
+int journal_restore(struct ticket_config *tk)
+{
+	struct journal_state *js;
+	struct booth_site *vote;
+
+	if (!jstate)
+		return -ENOENT;
+
+	js = jstate + (tk - booth_conf->ticket);
+	if (!js->valid || js->term < tk->current_term)
+		return -ENOENT;
+
+	tk->current_term = js->term;
+	if (find_site_by_id(js->voted_for, &vote) && vote != no_leader)
+		tk->voted_for = vote;
+	tk_log_debug("restored term %d, voted for %s",
+			js->term, site_string(tk->voted_for));
+	return 0;
+}
+
+
+/* Record the term and the vote, if they changed. */
+void journal_note(struct ticket_config *tk)
+{
+	struct journal_state *js;
+	struct journal_record *p;
+	uint32_t vote;
+	int i, n;
+
+	if (journal_fd < 0)
+		return;
+
+	i = tk - booth_conf->ticket;
+	js = jstate + i;
+	vote = get_node_id(tk->voted_for);
+	if (js->valid && js->term == tk->current_term &&
+			js->voted_for == vote)
+		return;
+
+	js->term = tk->current_term;
+	js->voted_for = vote;
+	js->valid = 1;
+	/* compact() writes it with the rest */
+	if (journal_broken)
+		return;
+
+	if (pending_cnt == pending_alloc) {
+		n = pending_alloc ? pending_alloc * 2 : 32;
+		p = realloc(pending, n * sizeof(*pending));
+		if (!p) {
+			log_error("out of memory for the journal");
+			/* hold everything until compact() made it */
+			journal_broken = 1;
+			return;
+		}
+		pending = p;
+		pending_alloc = n;
+	}
+
+	fill_record(pending + pending_cnt, i);
+	pending_cnt++;
+}
+
+
+int journal_pending(void)
+{
+	/* the later datagrams must not overtake those held */
+	return pending_cnt > 0 || journal_broken || syncing ||
+		booth_udp_held() > 0;
+}
+
+
+static void sync_run(void *arg)
+{
+	struct sync_job *job = arg;
+
+	job->err = fdatasync(job->fd) ? errno : 0;
+}
+
+
+static void sync_done(void *arg)
+{
+	struct sync_job *job = arg;
+
+	if (job != syncing) {
+		/* from before journal_open(); its file is gone */
+		close(job->fd);
+		free(job);
+		return;
+	}
+	syncing = NULL;
+
+	if (!job->compact) {
+		close(job->fd);
+		if (job->err) {
+			log_error("cannot write journal %s: %s",
+					journal_path, strerror(job->err));
+			/* rewrite it right away */
+			journal_broken = 1;
+			compact_retry = 0;
+		} else {
+			file_records += job->records;
+			booth_udp_release_held(job->held);
+		}
+	} else if (!compact_finish(job->fd, job->records, job->err)) {
+		if (job->repair)
+			log_info("journal %s written again", journal_path);
+		booth_udp_release_held(job->held);
+	} else {
+		compact_retry = get_secs(NULL) + 1;
+		if (job->repair) {
+			journal_broken = 1;
+			pending_cnt = 0;
+			/* the peers resend, or we do */
+			booth_udp_drop_held();
+		} else {
+			/* the old journal has it all */
+			booth_udp_release_held(job->held);
+		}
+	}
+
+	free(job);
+}
+
+
+static int start_sync(int fd, int compact, int records)
+{
+	struct sync_job *job;
+
+	job = calloc(1, sizeof(*job));
+	if (!job) {
+		log_error("out of memory for the journal");
+		close(fd);
+		return -ENOMEM;
+	}
+
+	job->fd = fd;
+	job->compact = compact;
+	job->repair = compact && journal_broken;
+	job->records = records;
+	job->held = booth_udp_held();
+	/* anything noted from now on waits for the next one */
+	syncing = job;
+	pending_cnt = 0;
+	journal_broken = 0;
+	/* one at a time, so the ring has room */
+	(void)worker_queue(WORKER_JOURNAL, sync_run, sync_done, job);
+	return 0;
+}
+
+
+/* Group commit: one write for everything noted since the last
+ * sync, then a sync on the worker; the held back datagrams go
+ * out when that is done. */
+void journal_flush(void)
+{
+	int len, fd, cnt;
+	time_t now;
+
+	if (syncing)
+		return;
+
+	now = get_secs(NULL);
+	if (!journal_broken && pending_cnt) {
+		len = pending_cnt * sizeof(*pending);
+		fd = -1;
+		if (write(journal_fd, pending, len) == len)
+			fd = dup(journal_fd);
+		if (fd >= 0) {
+			if (start_sync(fd, 0, pending_cnt) < 0) {
+				/* written, but maybe not on disk */
+				journal_broken = 1;
+				compact_retry = now + 1;
+				goto drop;
+			}
+			return;
+		}
+
+		log_error("cannot write journal %s: %s",
+				journal_path, strerror(errno));
+		journal_broken = 1;
+		compact_retry = 0;
+	}
+
+	if (journal_broken ||
+			file_records >
+			JOURNAL_RECORDS_PER_TICKET * booth_conf->ticket_count) {
+		/* start over from the state we have, at most once
+		 * a second */
+		if (now < compact_retry)
+			goto drop;
+		fd = compact_write(&cnt);
+		if (fd < 0) {
+			compact_retry = now + 1;
+			goto drop;
+		}
+		if (start_sync(fd, 1, cnt) < 0) {
+			compact_retry = now + 1;
+			goto drop;
+		}
+		return;
+	}
+
+	/* held while a sync was running */
+	booth_udp_release_held(booth_udp_held());
+	return;
+
+drop:
+	if (!journal_broken) {
+		/* just too long; it has all we need */
+		booth_udp_release_held(booth_udp_held());
+		return;
+	}
+	pending_cnt = 0;
+	/* the peers resend, or we do */
+	booth_udp_drop_held();
+}
@@ -37,7 +37,7 @@
  */
 #define tk_cl_log(sev, fmt, args...) \
 	cl_log(sev, "%s (%s/%d/%d): " fmt, \
-	tk->name, state_to_string(tk->state), tk->current_term, term_time_left(tk), \
+	tk->name, state_to_string(tk_hot(tk)->state), tk->current_term, term_time_left(tk), \
 	##args)
 
 #define tk_log_debug(fmt, args...)		do { \
@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <sched.h>
 #include <errno.h>
 #include <limits.h>
@@ -31,6 +32,7 @@
 #include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/wait.h>
 #include <sys/poll.h>
 #include <pacemaker/crm/services.h>
 #include <clplumbing/setproctitle.h>
@@ -54,12 +56,32 @@
 #include "inline-fn.h"
 #include "pacemaker.h"
 #include "ticket.h"
+#include "digest.h"
+#include "journal.h"
+#include "worker.h"
+#include "uring.h"
+#include "catalog.h"
+#include "auth.h"
 
 #define RELEASE_VERSION		"0.2.0"
 #define RELEASE_STR 	RELEASE_VERSION " (build " BOOTH_BUILD_VERSION ")"
 
 #define CLIENT_NALLOC		32
 
+/* Admission of client connections, see client_admit(). */
+#define CLIENT_CONN_MAX		64
+#define CLIENT_RATE		20	/* per second and source */
+#define CLIENT_BURST		40
+#define CLIENT_RATE_SLOTS	64
+#define CLIENT_RECV_TIMEOUT_MS	200
+
+/* A client request as far as it has arrived. */
+struct client_in {
+	int64_t started_ms;
+	int len;
+	struct boothc_attr_msg msg;
+};
+
 int daemonize = 0;
 int enable_stderr = 0;
 time_t start_time;
@@ -93,6 +115,7 @@ int poll_timeout = POLL_TIMEOUT;
 
 
 struct booth_config *booth_conf;
+int booth_shard;
 struct command_line cl;
 
 int do_read(int fd, void *buf, size_t count)
@@ -157,14 +180,41 @@ static void client_alloc(void)
 		clients[i].workfn = NULL;
 		clients[i].deadfn = NULL;
 		clients[i].fd = -1;
+		clients[i].in = NULL;
 		pollfds[i].fd = -1;
 		pollfds[i].revents = 0;
 	}
 	client_size += CLIENT_NALLOC;
 }
 
-static void client_dead(int ci)
+static int64_t now_ms(void)
+{
+	timetype now;
+
+	get_time(&now);
+	return time_to_ms(now);
+}
+
+static int client_in_new(int ci)
+{
+	clients[ci].in = malloc(sizeof(*clients[ci].in));
+	if (!clients[ci].in)
+		return -ENOMEM;
+	clients[ci].in->started_ms = now_ms();
+	clients[ci].in->len = 0;
+	return 0;
+}
+
+static void client_in_free(int ci)
 {
+	free(clients[ci].in);
+	clients[ci].in = NULL;
+}
+
+void client_dead(int ci)
+{
+	client_in_free(ci);
+	uring_poll_del(ci);
 	if (clients[ci].fd != -1)
 		close(clients[ci].fd);
 
@@ -199,6 +249,10 @@ int client_add(int fd, const struct booth_transport *tpt,
 
 		c->transport = tpt;
 		c->fd = fd;
+		/* the request has to arrive in time, see client_expire();
+		 * else process_connection() tries again */
+		if (workfn == process_connection)
+			(void)client_in_new(i);
 
 		pollfds[i].fd = fd;
 		pollfds[i].events = POLLIN;
@@ -223,17 +277,47 @@ int find_client_by_fd(int fd)
 }
 
 
+/* Reads what is there of a client request up to 'want' bytes,
+ * without waiting for the rest. Returns 1 once they are all in,
+ * 0 if not yet, and -1 on errors. */
+static int client_read(int ci, int want)
+{
+	struct client_in *in = clients[ci].in;
+	int rv;
+
+	if (in->len >= want)
+		return 1;
+
+	rv = recv(clients[ci].fd, (char *)&in->msg + in->len,
+			want - in->len, MSG_DONTWAIT);
+	if (rv == 0)
+		return -1;
+	if (rv < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK ||
+				errno == EINTR) ? 0 : -1;
+
+	in->len += rv;
+	return in->len == want;
+}
+
+
 /* Only used for client requests, TCP ???*/
 void process_connection(int ci)
 {
-	struct boothc_ticket_msg msg;
-	int rv, len, expr, fd;
+	/* big enough for all client requests */
+	struct boothc_attr_msg msg;
+	struct client_in *in;
+	int rv, len, fd;
 	void (*deadfn) (int ci);
 
 
 	fd = clients[ci].fd;
-	rv = do_read(fd, &msg.header, sizeof(msg.header));
+	/* another request on this connection */
+	if (!clients[ci].in && client_in_new(ci) < 0)
+		goto kill;
+	in = clients[ci].in;
 
+	rv = client_read(ci, sizeof(msg.header));
 	if (rv < 0) {
 		if (errno == ECONNRESET)
 			log_debug("client %d connection reset for fd %d",
@@ -241,44 +325,67 @@ void process_connection(int ci)
 
 		goto kill;
 	}
+	if (!rv)
+		return;
 
-	if (check_boothc_header(&msg.header, -1) < 0)
+	if (check_boothc_header(&in->msg.header, -1) < 0)
 		goto kill;
 
+	/* another site, see transport.c */
+	if (tcp_peer_adopt(ci, &in->msg.header)) {
+		client_in_free(ci);
+		return;
+	}
+
 	/* Basic sanity checks already done. */
-	len = ntohl(msg.header.length);
+	len = ntohl(in->msg.header.length);
 	if (len) {
-		if (len != sizeof(msg)) {
+		if (len < sizeof(struct boothc_ticket_msg) || len > sizeof(msg)) {
 bad_len:
 			log_error("got wrong length %u", len);
-			return;
+			goto kill;
 		}
-		expr = len - sizeof(msg.header);
-		rv = do_read(clients[ci].fd, msg.header.data, expr);
+		rv = client_read(ci, len);
 		if (rv < 0) {
 			log_error("connection %d read data error %d, wanted %d",
-					ci, rv, expr);
+					ci, rv, len - (int)sizeof(msg.header));
 			goto kill;
 		}
+		if (!rv)
+			return;
 	}
 
+	/* complete; a further request starts afresh */
+	memcpy(&msg, &in->msg, in->len);
+	client_in_free(ci);
+
 
 	/* For CMD_GRANT and CMD_REVOKE:
 	 * Don't close connection immediately, but send
 	 * result a second later? */
 	switch (ntohl(msg.header.cmd)) {
 	case CMD_LIST:
-		ticket_answer_list(fd, &msg);
+		ticket_answer_list(fd, (void *)&msg);
+		goto kill;
+
+	case CMD_STATS:
+		transport_answer_stats(fd);
 		goto kill;
 
 	case CMD_GRANT:
 	case CMD_REVOKE:
+	case CMD_MOVE:
 		/* Expect boothc_ticket_site_msg. */
-		if (len != sizeof(msg))
+		if (len != sizeof(struct boothc_ticket_msg))
 			goto bad_len;
-		process_client_request(&clients[ci], &msg);
+		process_client_request(&clients[ci], (void *)&msg);
 		return;
 
+	case CMD_ADD_TICKET:
+	case CMD_DEL_TICKET:
+		catalog_request(fd, &msg, len);
+		goto kill;
+
 	default:
 		log_error("connection %d cmd %x unknown",
 				ci, ntohl(msg.header.cmd));
@@ -299,6 +406,129 @@ kill:
 }
 
 
+/* Connections per source, as a token bucket; the least recently
+ * seen source makes room for a new one. */
+struct client_rate {
+	struct in6_addr addr;
+	int64_t last_ms;
+	/* in thousandths of a connection */
+	int tokens;
+};
+
+static struct client_rate client_rates[CLIENT_RATE_SLOTS];
+
+static int client_rate_ok(const struct sockaddr_storage *sa)
+{
+	struct client_rate *r, *oldest;
+	struct in6_addr addr;
+	timetype now;
+	int64_t now_ms;
+	int i;
+
+	/* IPv4 addresses in the last four bytes */
+	memset(&addr, 0, sizeof(addr));
+	if (sa->ss_family == AF_INET)
+		memcpy(addr.s6_addr + 12,
+				&((struct sockaddr_in *)sa)->sin_addr, 4);
+	else if (sa->ss_family == AF_INET6)
+		addr = ((struct sockaddr_in6 *)sa)->sin6_addr;
+
+	get_time(&now);
+	now_ms = time_to_ms(now);
+
+	oldest = client_rates;
+	for (i = 0; i < CLIENT_RATE_SLOTS; i++) {
+		r = client_rates + i;
+		if (r->last_ms && !memcmp(&r->addr, &addr, sizeof(addr)))
+			goto found;
+		if (r->last_ms < oldest->last_ms)
+			oldest = r;
+	}
+
+	r = oldest;
+	r->addr = addr;
+	r->tokens = CLIENT_BURST * 1000;
+	r->last_ms = now_ms;
+
+found:
+	r->tokens += (now_ms - r->last_ms) * CLIENT_RATE;
+	if (r->tokens > CLIENT_BURST * 1000)
+		r->tokens = CLIENT_BURST * 1000;
+	r->last_ms = now_ms;
+
+	if (r->tokens < 1000)
+		return 0;
+	r->tokens -= 1000;
+	return 1;
+}
+
+/* Refusals get logged at most once a second. */
+static void client_refused(const char *why)
+{
+	static time_t last;
+	static int count;
+	time_t now;
+
+	count++;
+	now = get_secs(NULL);
+	if (now == last)
+		return;
+
+	log_warn("refused %d client connection(s): %s", count, why);
+	last = now;
+	count = 0;
+}
+
+/* Whether to serve a new client connection at all. The protocol
+ * has precedence; a flood of requests must not keep the loop
+ * from renewing tickets in time. */
+int client_admit(int fd)
+{
+	struct sockaddr_storage sa;
+	socklen_t sa_len;
+	int i, conns;
+
+	conns = 0;
+	for (i = 0; i <= client_maxi; i++)
+		if (clients[i].fd >= 0 &&
+				clients[i].workfn == process_connection)
+			conns++;
+	if (conns >= CLIENT_CONN_MAX) {
+		client_refused("too many connections");
+		return 0;
+	}
+
+	sa_len = sizeof(sa);
+	if (getpeername(fd, (struct sockaddr *)&sa, &sa_len) == 0 &&
+			!client_rate_ok(&sa)) {
+		client_refused("rate limit per source");
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/* A stalled request mustn't hold a slot for long; see
+ * process_connection(), which never waits for the rest. */
+static void client_expire(void)
+{
+	int64_t now;
+	int i;
+
+	now = now_ms();
+	for (i = 0; i <= client_maxi; i++) {
+		if (clients[i].fd < 0 || !clients[i].in ||
+				now - clients[i].in->started_ms <=
+				CLIENT_RECV_TIMEOUT_MS)
+			continue;
+
+		log_debug("client %d request timed out", i);
+		clients[i].deadfn(i);
+	}
+}
+
+
 /** Callback function for the listening TCP socket. */
 static void process_listener(int ci)
 {
@@ -313,6 +543,11 @@ static void process_listener(int ci)
 		return;
 	}
 
+	if (!client_admit(fd)) {
+		close(fd);
+		return;
+	}
+
 	i = client_add(fd, clients[ci].transport, process_connection, NULL);
 
 	log_debug("add client connection %d fd %d", i, fd);
@@ -335,7 +570,8 @@ static int setup_config(int type)
 			return -EINVAL;
 		}
 		local->local = 1;
-	} else
+	} else if (type != CLIENT || !cl.site[0])
+		/* a client given a site doesn't need to know ours */
 		find_myself(NULL, type == CLIENT);
 
 
@@ -343,6 +579,13 @@ static int setup_config(int type)
 	if (rv < 0)
 		goto out;
 
+	/* only here, we might not be root when reloading */
+	if (type != CLIENT && type != STATUS) {
+		rv = read_authkey(booth_conf);
+		if (rv < 0)
+			goto out;
+	}
+
 
 	/* Per default the PID file name is derived from the
 	 * configuration name. */
@@ -355,6 +598,84 @@ out:
 	return rv;
 }
 
+/* The further shards, in the first one; see start_shards(). */
+static pid_t *shard_pids;
+static volatile sig_atomic_t shard_exited;
+
+static void sig_chld_handler(int sig)
+{
+	shard_exited = 1;
+}
+
+/* If another shard is gone, the first one goes down, too, and the
+ * others with it; the cluster manager restarts booth then. Alone,
+ * a shard would go on with its tickets while those of the missing
+ * one can't be reached. Only waits for the shards; the handlers
+ * and crm_ticket are waited for in the worker threads. */
+static void check_shards(void)
+{
+	int k, status;
+
+	if (!shard_pids)
+		return;
+
+	for (k = 1; k < booth_conf->shards; k++) {
+		if (waitpid(shard_pids[k], &status, WNOHANG) != shard_pids[k])
+			continue;
+
+		if (WIFSIGNALED(status))
+			log_error("shard %d (pid %d) killed by signal %d, "
+					"stopping all shards", k,
+					(int)shard_pids[k], WTERMSIG(status));
+		else
+			log_error("shard %d (pid %d) exited with status %d, "
+					"stopping all shards", k,
+					(int)shard_pids[k], WEXITSTATUS(status));
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Set on SIGHUP, see reload_config(). */
+static volatile sig_atomic_t reload_requested;
+
+static void sig_reload_handler(int sig)
+{
+	reload_requested = 1;
+}
+
+/* Read the configuration file again and apply the differences;
+ * on errors the old configuration stays in effect. */
+static void reload_config(void)
+{
+	struct booth_config *live, *conf;
+	int rv;
+
+	log_info("reloading configuration from %s", cl.configfile);
+
+	live = booth_conf;
+	booth_conf = NULL;
+	rv = read_config(cl.configfile, local->type);
+	conf = booth_conf;
+	booth_conf = live;
+	if (rv < 0) {
+		log_error("cannot reload configuration, "
+				"keeping the old one");
+		return;
+	}
+
+	/* the tickets were already picked by the new number, see
+	 * keep_own_tickets() */
+	if (conf->shards != live->shards) {
+		log_error("changing the number of shards needs a restart, "
+				"keeping the old configuration");
+		free_config(conf);
+		return;
+	}
+
+	catalog_apply(conf);
+	apply_config(conf);
+}
+
 static int setup_transport(void)
 {
 	int rv;
@@ -371,6 +692,10 @@ static int setup_transport(void)
 		goto out;
 	}
 
+	/* not fatal; the addresses are then taken to be up */
+	if (addr_watch_init() < 0)
+		log_warn("cannot watch the local addresses");
+
 out:
 	return rv;
 }
@@ -436,12 +761,46 @@ static int write_daemon_state(int fd, int state)
 	return 0;
 }
 
-static int loop(int fd)
+/* Client requests (and their listener), as opposed to the other
+ * sites; see process_tcp_listener(). Anything else counts as
+ * another site: UDP, SCTP, the connections of TCP_PEER (see
+ * tcp_peer_adopt()), and the internal descriptors like the one
+ * of the worker thread. */
+static int is_client_slot(int i)
+{
+	return clients[i].transport == booth_transport + TCP;
+}
+
+static void dispatch(int i)
 {
 	void (*workfn) (int ci);
 	void (*deadfn) (int ci);
+
+	/* POLLOUT only if asked for, see transport.c */
+	if (pollfds[i].revents & (POLLIN | POLLOUT)) {
+		workfn = clients[i].workfn;
+		if (workfn)
+			workfn(i);
+	}
+	if (clients[i].fd >= 0 && pollfds[i].revents &
+			(POLLERR | POLLHUP | POLLNVAL)) {
+		deadfn = clients[i].deadfn;
+		if (deadfn)
+			deadfn(i);
+	}
+}
+
+static int loop(int fd)
+{
 	int rv, i;
 
+	/* before anything is sent; else the time is used */
+	(void)auth_session_init();
+
+	/* falls back to poll(); before the sockets, for their
+	 * multishot receive */
+	(void)uring_init();
+
 	rv = setup_transport();
 	if (rv < 0)
 		goto fail;
@@ -466,8 +825,23 @@ static int loop(int fd)
 		type_to_string(local->type),
 			local->site_id, local->site_id);
 
+	/* the jobs of a missing worker are done in the loop then */
+	if (worker_init() < 0)
+		log_warn("worker threads missing, the protocol may be delayed");
+
 	while (1) {
-		rv = poll(pollfds, client_maxi + 1, poll_timeout);
+		if (reload_requested) {
+			reload_requested = 0;
+			reload_config();
+		}
+		if (shard_exited) {
+			shard_exited = 0;
+			check_shards();
+		}
+
+		rv = uring_active() ?
+			uring_poll(pollfds, client_maxi + 1, poll_timeout) :
+			poll(pollfds, client_maxi + 1, poll_timeout);
 		if (rv == -1 && errno == EINTR)
 			continue;
 		if (rv < 0) {
@@ -475,24 +849,23 @@ static int loop(int fd)
 			goto fail;
 		}
 
-		for (i = 0; i <= client_maxi; i++) {
-			if (clients[i].fd < 0)
-				continue;
-
-			if (pollfds[i].revents & POLLIN) {
-				workfn = clients[i].workfn;
-				if (workfn)
-					workfn(i);
-			}
-			if (pollfds[i].revents &
-					(POLLERR | POLLHUP | POLLNVAL)) {
-				deadfn = clients[i].deadfn;
-				if (deadfn)
-					deadfn(i);
-			}
-		}
+		/* The other sites first, then the timers, and the
+		 * clients only then; see client_admit(), too. */
+		for (i = 0; i <= client_maxi; i++)
+			if (clients[i].fd >= 0 && !is_client_slot(i))
+				dispatch(i);
 
 		process_tickets();
+		transport_cron();
+
+		for (i = 0; i <= client_maxi; i++)
+			if (clients[i].fd >= 0 && is_client_slot(i))
+				dispatch(i);
+		client_expire();
+
+		digest_cron();
+		catalog_cron();
+		journal_flush();
 	}
 
 	return 0;
@@ -562,6 +935,21 @@ out:
 	return rv;
 }
 
+/* Every shard lists its own tickets. */
+static int query_all_shards(cmd_request_t cmd)
+{
+	int base, k, rv;
+
+	base = booth_conf->port;
+	k = 0;
+	do {
+		set_conf_port(booth_conf, base + k);
+		rv = query_get_string_answer(cmd);
+	} while (!rv && ++k < booth_conf->shards);
+
+	return rv;
+}
+
 
 static int test_reply(int reply_code, cmd_request_t cmd)
 {
@@ -572,6 +960,12 @@ static int test_reply(int reply_code, cmd_request_t cmd)
 		op_str = "grant";
 	else if (cmd == CMD_REVOKE)
 		op_str = "revoke";
+	else if (cmd == CMD_MOVE)
+		op_str = "move";
+	else if (cmd == CMD_ADD_TICKET)
+		op_str = "add";
+	else if (cmd == CMD_DEL_TICKET)
+		op_str = "del";
 	else {
 		log_error("internal error reading reply result!");
 		return -1;
@@ -618,8 +1012,13 @@ static int test_reply(int reply_code, cmd_request_t cmd)
 		break;
 
 	case RLT_INVALID_ARG:
-		log_error("ticket \"%s\" does not exist",
-				cl.msg.ticket.id);
+		if (cmd == CMD_ADD_TICKET)
+			log_error("ticket \"%s\" exists already or has "
+					"invalid attributes (see the log of the site)",
+					cl.msg.ticket.id);
+		else
+			log_error("ticket \"%s\" does not exist",
+					cl.msg.ticket.id);
 		break;
 
 	case RLT_EXT_FAILED:
@@ -627,6 +1026,12 @@ static int test_reply(int reply_code, cmd_request_t cmd)
 				cl.msg.ticket.id);
 		break;
 
+	case RLT_BUSY:
+		log_error("ticket \"%s\" is busy, please try again later",
+				cl.msg.ticket.id);
+		rv = -1;
+		break;
+
 	case RLT_REDIRECT:
 		/* talk to another site */
 		rv = 1;
@@ -653,6 +1058,8 @@ static int do_command(cmd_request_t cmd)
 		op_str = "grant";
 	else if (cmd == CMD_REVOKE)
 		op_str = "revoke";
+	else if (cmd == CMD_MOVE)
+		op_str = "move";
 
 	rv = 0;
 	site = NULL;
@@ -671,6 +1078,15 @@ static int do_command(cmd_request_t cmd)
 		goto out_close;
 	}
 
+	if (cmd == CMD_MOVE) {
+		if (!*cl.site) {
+			log_error("No site to move the ticket to given.");
+			goto out_close;
+		}
+		/* the target; we ask it first, it redirects to the leader */
+		cl.msg.ticket.leader = htonl(get_node_id(site));
+	}
+
 	assert(site->type == SITE);
 
 	/* We don't check for existence of ticket, so that asking can be
@@ -686,6 +1102,10 @@ static int do_command(cmd_request_t cmd)
 		}
 	}
 
+	/* the daemon serving the ticket */
+	set_conf_port(booth_conf,
+			booth_conf->port + ticket_shard(cl.msg.ticket.id));
+
 redirect:
 	init_header(&cl.msg.header, cmd, 0, cl.options, 0, 0, sizeof(cl.msg));
 
@@ -740,6 +1160,55 @@ out_close:
 	return rv;
 }
 
+/* "booth add" and "booth del"; the site passes the change on to
+ * all others. */
+static int do_catalog(cmd_request_t cmd)
+{
+	struct booth_site *site;
+	struct boothc_attr_msg msg;
+	struct boothc_ticket_msg reply;
+	struct booth_transport const *tpt;
+	int len, rv;
+
+	site = local;
+	if (*cl.site && !find_site_by_name(cl.site, &site, 1)) {
+		log_error("Site \"%s\" not configured.", cl.site);
+		return -1;
+	}
+
+	if (!cl.msg.ticket.id[0]) {
+		log_error("No ticket given.");
+		return -1;
+	}
+
+	set_conf_port(booth_conf,
+			booth_conf->port + ticket_shard(cl.msg.ticket.id));
+
+	len = offsetof(struct boothc_attr_msg, attrs) + strlen(cl.attrs) + 1;
+	init_header(&msg.header, cmd, 0, cl.options, 0, 0, len);
+	msg.ticket = cl.msg.ticket;
+	strcpy(msg.attrs, cl.attrs);
+
+	tpt = booth_transport + TCP;
+	rv = tpt->open(site);
+	if (rv < 0)
+		goto out_close;
+
+	rv = tpt->send(site, &msg, len);
+	if (rv < 0)
+		goto out_close;
+
+	rv = tpt->recv(site, &reply, sizeof(reply));
+	if (rv < 0)
+		goto out_close;
+
+	rv = test_reply(ntohl(reply.header.result), cmd);
+
+out_close:
+	tpt->close(site);
+	return rv;
+}
+
 static int do_grant(void)
 {
 	return do_command(CMD_GRANT);
@@ -750,6 +1219,11 @@ static int do_revoke(void)
 	return do_command(CMD_REVOKE);
 }
 
+static int do_move(void)
+{
+	return do_command(CMD_MOVE);
+}
+
 
 
 static int _lockfile(int mode, int *fdp, pid_t *locked_by)
@@ -851,13 +1325,19 @@ static void print_usage(void)
 {
 	printf("Usages:\n");
 	printf("  booth daemon [-c config] [-D]\n");
-	printf("  booth [client] {list|grant|revoke} [options]\n");
+	printf("  booth [client] {list|grant|revoke|move} [options]\n");
+	printf("  booth [client] add [options] TICKET [key=value ...]\n");
+	printf("  booth [client] del [options] TICKET\n");
 	printf("  booth status [-c config] [-D]\n");
 	printf("\n");
 	printf("Client operations:\n");
 	printf("  list:	        List all the tickets\n");
+	printf("  stats:        Show the receive buffers and drops\n");
 	printf("  grant:        Grant ticket to site\n");
 	printf("  revoke:       Revoke ticket from site\n");
+	printf("  move:         Hand ticket over to site (-s) directly\n");
+	printf("  add:          Add ticket at runtime, on all sites\n");
+	printf("  del:          Remove ticket at runtime, on all sites\n");
 	printf("\n");
 	printf("Options:\n");
 	printf("  -c FILE       Specify config file [default " BOOTH_DEFAULT_CONF "]\n");
@@ -958,10 +1438,18 @@ static int read_arguments(int argc, char **argv)
     if (cl.type == CLIENT) {
 		if (!strcmp(op, "list"))
 			cl.op = CMD_LIST;
+		else if (!strcmp(op, "stats"))
+			cl.op = CMD_STATS;
 		else if (!strcmp(op, "grant"))
 			cl.op = CMD_GRANT;
 		else if (!strcmp(op, "revoke"))
 			cl.op = CMD_REVOKE;
+		else if (!strcmp(op, "move"))
+			cl.op = CMD_MOVE;
+		else if (!strcmp(op, "add"))
+			cl.op = CMD_ADD_TICKET;
+		else if (!strcmp(op, "del"))
+			cl.op = CMD_DEL_TICKET;
 		else {
 			fprintf(stderr, "client operation \"%s\" is unknown\n",
 					op);
@@ -1009,7 +1497,9 @@ static int read_arguments(int argc, char **argv)
 			safe_copy(cl.lockfile, optarg, sizeof(cl.lockfile), "lock file");
 			break;
 		case 't':
-			if (cl.op == CMD_GRANT || cl.op == CMD_REVOKE) {
+			if (cl.op == CMD_GRANT || cl.op == CMD_REVOKE ||
+					cl.op == CMD_MOVE || cl.op == CMD_ADD_TICKET ||
+					cl.op == CMD_DEL_TICKET) {
 				safe_copy(cl.msg.ticket.id, optarg,
 						sizeof(cl.msg.ticket.id), "ticket name");
 			} else {
@@ -1048,8 +1538,9 @@ static int read_arguments(int argc, char **argv)
 
 		case 'w':
 			if (cl.type != CLIENT ||
-					(cl.op != CMD_GRANT && cl.op != CMD_REVOKE)) {
-				log_error("use \"-w\" only for grant and revoke");
+					(cl.op != CMD_GRANT && cl.op != CMD_REVOKE &&
+					 cl.op != CMD_MOVE)) {
+				log_error("use \"-w\" only for grant, revoke, and move");
 				exit(EXIT_FAILURE);
 			}
 			cl.options |= OPT_WAIT;
@@ -1089,6 +1580,19 @@ extra_args:
 		optind++;
 	}
 
+	/* "booth add" takes the ticket attributes, "key=value" */
+	while (cl.op == CMD_ADD_TICKET && optind < argc) {
+		cp = argv[optind];
+		if (!strchr(cp, '=') || strchr(cp, '\n') || strchr(cp, '\t') ||
+				strlen(cl.attrs) + strlen(cp) + 2 > sizeof(cl.attrs)) {
+			fprintf(stderr, "invalid ticket attribute: %s\n", cp);
+			exit(EXIT_FAILURE);
+		}
+		strcat(cl.attrs, cp);
+		strcat(cl.attrs, "\n");
+		optind++;
+	}
+
 	if (optind == argc)
 		return 0;
 
@@ -1283,6 +1787,58 @@ static void sig_exit_handler(int sig)
 	exit(0);
 }
 
+/* Forks a daemon for each further shard, which reads the
+ * configuration again for its tickets and port. Returns in every
+ * daemon. */
+static int start_shards(int type)
+{
+	int k, len;
+	pid_t pid;
+
+	if (booth_conf->shards < 2)
+		return 0;
+
+	shard_pids = calloc(booth_conf->shards, sizeof(*shard_pids));
+	if (!shard_pids) {
+		log_error("out of memory");
+		return -ENOMEM;
+	}
+	/* before any of them can go; see check_shards() */
+	signal(SIGCHLD, (__sighandler_t)sig_chld_handler);
+
+	for (k = 1; k < booth_conf->shards; k++) {
+		pid = fork();
+		if (pid < 0) {
+			log_error("cannot start shard %d: %s", k,
+					strerror(errno));
+			return -errno;
+		}
+		if (pid) {
+			shard_pids[k] = pid;
+			continue;
+		}
+
+		/* not without the first one */
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+		signal(SIGCHLD, SIG_DFL);
+		free(shard_pids);
+		shard_pids = NULL;
+
+		booth_shard = k;
+		free_config(booth_conf);
+		booth_conf = NULL;
+		local = NULL;
+		len = strlen(cl.lockfile);
+		snprintf(cl.lockfile + len, sizeof(cl.lockfile) - len,
+				".%d", k);
+
+		if (setup_config(type) < 0)
+			exit(EXIT_FAILURE);
+		break;
+	}
+	return 0;
+}
+
 static int do_server(int type)
 {
 	int rv = -1;
@@ -1305,6 +1861,10 @@ static int do_server(int type)
 		}
 	}
 
+	rv = start_shards(type);
+	if (rv < 0)
+		return rv;
+
 	/* The lockfile must be written to _after_ the call to daemon(), so
 	 * that the lockfile contains the pid of the daemon, not the parent. */
 	lock_fd = create_lockfile();
@@ -1321,10 +1881,15 @@ static int do_server(int type)
 
 	log_info("BOOTH %s %s daemon is starting",
 			type_to_string(local->type), RELEASE_STR);
+	if (booth_conf->shards > 1)
+		log_info("serving shard %d of %d, %d tickets",
+				booth_shard, booth_conf->shards,
+				booth_conf->ticket_count);
 
 	signal(SIGUSR1, (__sighandler_t)tickets_log_info);
 	signal(SIGTERM, (__sighandler_t)sig_exit_handler);
 	signal(SIGINT, (__sighandler_t)sig_exit_handler);
+	signal(SIGHUP, (__sighandler_t)sig_reload_handler);
 
 	set_scheduler();
 	set_oom_adj(-16);
@@ -1362,7 +1927,11 @@ static int do_client(void)
 
 	switch (cl.op) {
 	case CMD_LIST:
-		rv = query_get_string_answer(CMD_LIST);
+		rv = query_all_shards(CMD_LIST);
+		break;
+
+	case CMD_STATS:
+		rv = query_all_shards(CMD_STATS);
 		break;
 
 	case CMD_GRANT:
@@ -1372,6 +1941,15 @@ static int do_client(void)
 	case CMD_REVOKE:
 		rv = do_revoke();
 		break;
+
+	case CMD_MOVE:
+		rv = do_move();
+		break;
+
+	case CMD_ADD_TICKET:
+	case CMD_DEL_TICKET:
+		rv = do_catalog(cl.op);
+		break;
 	}
 
 out:
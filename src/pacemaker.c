@@ -19,6 +19,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <inttypes.h>
 #include <sys/types.h>
@@ -26,6 +27,8 @@
 #include "log.h"
 #include "pacemaker.h"
 #include "inline-fn.h"
+#include "worker.h"
+#include "ticket.h"
 
 
 enum atomic_ticket_supported {
@@ -115,126 +118,145 @@ const char * interpret_rv(int rv)
 }
 
 
-static int pcmk_write_ticket_atomic(struct ticket_config *tk, int grant)
-{
+/* A CIB update, done by the worker thread. It gets a copy of the
+ * values, as the ticket keeps changing meanwhile. */
+struct cib_write {
+	char name[BOOTH_NAME_LEN];
+	int grant;
+	int32_t owner;
+	int64_t expires;
+	int64_t term;
+	/* the last (or failed) command and its result, for the log */
 	char cmd[COMMAND_MAX];
 	int rv;
+};
 
 
+static void cib_write_atomic(struct cib_write *w)
+{
 	/* The values are appended to "-v", so that NO_ONE
 	 * (which is -1) isn't seen as another option. */
-	snprintf(cmd, COMMAND_MAX,
+	snprintf(w->cmd, COMMAND_MAX,
 			"crm_ticket -t '%s' "
 			"%s --force "
 			"-S owner -v%" PRIi32 " "
 			"-S expires -v%" PRIi64 " "
 			"-S term -v%" PRIi64,
-			tk->name,
-			(grant > 0 ? "-g" :
-			 grant < 0 ? "-r" :
+			w->name,
+			(w->grant > 0 ? "-g" :
+			 w->grant < 0 ? "-r" :
 			 ""),
-			(int32_t)get_node_id(tk->leader),
-			(int64_t)wall_ts(tk->term_expires),
-			(int64_t)tk->current_term);
+			w->owner, w->expires, w->term);
 
-	rv = system(cmd);
-	log_debug("command: '%s' was executed", cmd);
-	if (rv != 0)
-		log_error("error: \"%s\" failed, %s", cmd, interpret_rv(rv));
-
-	return rv;
+	w->rv = system(w->cmd);
 }
 
 
-static int pcmk_store_ticket_nonatomic(struct ticket_config *tk);
-
-static int pcmk_grant_ticket(struct ticket_config *tk)
+static void crm_ticket_set(struct cib_write *w, const char *attr, int64_t val)
 {
 	char cmd[COMMAND_MAX];
-	int rv;
+	int i, rv;
 
 
-	test_atomicity();
-	if (atomicity == YES)
-		return pcmk_write_ticket_atomic(tk, +1);
+	snprintf(cmd, COMMAND_MAX,
+		 "crm_ticket -t '%s' -S '%s' -v %" PRIi64,
+		 w->name, attr, val);
+	/* If there are errors, there's not much we can do but retry ... */
+	for (i=0; i<3 &&
+			(rv = system(cmd));
+			i++) ;
 
+	if (rv && !w->rv) {
+		w->rv = rv;
+		strcpy(w->cmd, cmd);
+	}
+}
 
-	rv = pcmk_store_ticket_nonatomic(tk);
-	if (rv)
-		return rv;
 
-	snprintf(cmd, COMMAND_MAX, "crm_ticket -t %s -g --force",
-			tk->name);
-	log_debug("command: '%s' was executed", cmd);
-	rv = system(cmd);
-	if (rv != 0)
-		log_error("error: \"%s\" failed, %s", cmd, interpret_rv(rv));
-	return rv;
+static void cib_write_nonatomic(struct cib_write *w)
+{
+	/* Always try to store *each* attribute, even if there's an error
+	 * for one of them. */
+	crm_ticket_set(w, "owner", w->owner);
+	crm_ticket_set(w, "expires", w->expires);
+	crm_ticket_set(w, "term", w->term);
+	if (w->rv)
+		return;
+
+	snprintf(w->cmd, COMMAND_MAX, "crm_ticket -t %s %s --force",
+			w->name, w->grant > 0 ? "-g" : "-r");
+	w->rv = system(w->cmd);
 }
 
 
-static int pcmk_revoke_ticket(struct ticket_config *tk)
+/* In the worker thread; no logging there. */
+static void cib_write_run(void *arg)
 {
-	char cmd[COMMAND_MAX];
-	int rv;
+	struct cib_write *w = arg;
 
-
-	test_atomicity();
 	if (atomicity == YES)
-		return pcmk_write_ticket_atomic(tk, -1);
-
+		cib_write_atomic(w);
+	else
+		cib_write_nonatomic(w);
+}
 
-	rv = pcmk_store_ticket_nonatomic(tk);
-	if (rv)
-		return rv;
+/* Back in the event loop. */
+static void cib_write_done(void *arg)
+{
+	struct cib_write *w = arg;
+	struct ticket_config *tk;
 
-	snprintf(cmd, COMMAND_MAX, "crm_ticket -t %s -r --force",
-			tk->name);
-	log_debug("command: '%s' was executed", cmd);
-	rv = system(cmd);
-	if (rv != 0)
-		log_error("error: \"%s\" failed, %s", cmd, interpret_rv(rv));
-	return rv;
+	if (w->rv != 0)
+		log_error("error: \"%s\" failed, %s", w->cmd,
+				interpret_rv(w->rv));
+	else
+		log_debug("command: '%s' was executed", w->cmd);
+	/* the configuration might have been reloaded meanwhile */
+	if (find_ticket_by_name(w->name, &tk))
+		ticket_write_done(tk, w->term, w->grant, w->rv);
+	free(w);
 }
 
 
-static int crm_ticket_set(const struct ticket_config *tk, const char *attr, int64_t val)
+static int pcmk_write_ticket(struct ticket_config *tk, int grant)
 {
-	char cmd[COMMAND_MAX];
-	int i, rv;
+	struct cib_write *w;
+	int rv;
 
 
-	snprintf(cmd, COMMAND_MAX,
-		 "crm_ticket -t '%s' -S '%s' -v %" PRIi64,
-		 tk->name, attr, val);
-	/* If there are errors, there's not much we can do but retry ... */
-	for (i=0; i<3 &&
-			(rv = system(cmd));
-			i++) ;
+	/* before the first job, the worker only reads it */
+	test_atomicity();
 
-	log_debug("'%s' gave result %s", cmd, interpret_rv(rv));
+	w = malloc(sizeof(*w));
+	if (!w) {
+		log_error("out of memory");
+		return -ENOMEM;
+	}
 
+	strcpy(w->name, tk->name);
+	w->grant = grant;
+	w->owner = get_node_id(tk->leader);
+	w->expires = wall_ts(tk_hot(tk)->term_expires);
+	w->term = tk->current_term;
+	w->cmd[0] = 0;
+	w->rv = 0;
+
+	rv = worker_queue(WORKER_CIB, cib_write_run, cib_write_done, w);
+	if (rv < 0)
+		free(w);
 	return rv;
 }
 
 
-static int pcmk_store_ticket_nonatomic(struct ticket_config *tk)
+static int pcmk_grant_ticket(struct ticket_config *tk)
 {
-	int rv;
-
-	/* Always try to store *each* attribute, even if there's an error
-	 * for one of them. */
-	rv = crm_ticket_set(tk, "owner", (int32_t)get_node_id(tk->leader));
-	rv = crm_ticket_set(tk, "expires", wall_ts(tk->term_expires))  || rv;
-	rv = crm_ticket_set(tk, "term", tk->current_term)     || rv;
+	return pcmk_write_ticket(tk, +1);
+}
 
-	if (rv)
-		log_error("setting crm_ticket attributes failed; %s",
-				interpret_rv(rv));
-	else
-		log_info("setting crm_ticket attributes successful");
 
-	return rv;
+static int pcmk_revoke_ticket(struct ticket_config *tk)
+{
+	return pcmk_write_ticket(tk, -1);
 }
 
 
@@ -299,7 +321,7 @@ static int pcmk_load_ticket(struct ticket_config *tk)
 
 	rv = crm_ticket_get(tk, "expires", &v);
 	if (!rv) {
-		tk->term_expires = unwall_ts(v);
+		tk_hot(tk)->term_expires = unwall_ts(v);
 	}
 
 	rv = crm_ticket_get(tk, "term", &v);
@@ -29,6 +29,7 @@
 #include "raft.h"
 #include "ticket.h"
 #include "log.h"
+#include "journal.h"
 
 
 
@@ -87,11 +88,12 @@ static void update_term_from_msg(struct ticket_config *tk,
 	/* if we failed to start the election, then accept the term
 	 * from the leader
 	 * */
-	if (tk->state == ST_CANDIDATE) {
+	if (tk_hot(tk)->state == ST_CANDIDATE) {
 		tk->current_term = i;
 	} else {
 		tk->current_term = max(i, tk->current_term);
 	}
+	journal_note(tk);
 }
 
 
@@ -105,7 +107,7 @@ static void update_ticket_from_msg(struct ticket_config *tk,
 		site_string(sender),
 		ntohl(msg->ticket.term), ntohl(msg->ticket.term_valid_for));
 	duration = min(tk->term_duration, ntohl(msg->ticket.term_valid_for));
-	tk->term_expires = get_secs(NULL) + duration;
+	tk_hot(tk)->term_expires = get_secs(NULL) + duration;
 	update_term_from_msg(tk, msg);
 }
 
@@ -113,17 +115,48 @@ static void update_ticket_from_msg(struct ticket_config *tk,
 static void copy_ticket_from_msg(struct ticket_config *tk,
 		struct boothc_ticket_msg *msg)
 {
-	tk->term_expires = get_secs(NULL) + ntohl(msg->ticket.term_valid_for);
+	tk_hot(tk)->term_expires = get_secs(NULL) + ntohl(msg->ticket.term_valid_for);
 	tk->current_term = ntohl(msg->ticket.term);
 }
 
+/* only the leader decides about the successor */
+static void update_successor_from_msg(struct ticket_config *tk,
+		struct boothc_ticket_msg *msg)
+{
+	struct booth_site *successor;
+
+	if (!find_site_by_id(ntohl(msg->ticket.successor), &successor) ||
+			successor == no_leader)
+		successor = NULL;
+
+	if (successor != tk->successor)
+		tk_log_debug("successor is now %s", site_string(successor));
+	tk->successor = successor;
+}
+
+
+/* Ack a heartbeat or update; the result tells the leader whether
+ * we could take over the ticket. */
+static int send_ack(struct ticket_config *tk,
+		struct booth_site *dest,
+		struct boothc_ticket_msg *in_msg)
+{
+	struct boothc_ticket_msg msg;
+
+	init_ticket_msg(&msg, OP_ACK, ntohl(in_msg->header.cmd),
+			acquire_verdict(tk), 0, tk);
+	return transport()->send(dest, &msg, sizeof(msg));
+}
+
+
 static void become_follower(struct ticket_config *tk,
 		struct boothc_ticket_msg *msg)
 {
 	copy_ticket_from_msg(tk, msg);
-	tk->state = ST_FOLLOWER;
+	tk_hot(tk)->state = ST_FOLLOWER;
 	tk->delay_commit = 0;
 	tk->in_election = 0;
+	tk->in_prevote = 0;
 	/* if we're following and the ticket was granted here
 	 * then commit to CIB right away (we're probably restarting)
 	 */
@@ -137,16 +170,32 @@ static void become_follower(struct ticket_config *tk,
 static void won_elections(struct ticket_config *tk)
 {
 	tk->leader = local;
-	tk->state = ST_LEADER;
+	tk_hot(tk)->state = ST_LEADER;
 
-	tk->term_expires = get_secs(NULL) + tk->term_duration;
+	tk_hot(tk)->term_expires = get_secs(NULL) + tk->term_duration;
 	tk->election_end = 0;
 	tk->voted_for = NULL;
+	tk->successor = NULL;
+	tk->acquire_ok = 0;
 
 	ticket_broadcast(tk, OP_HEARTBEAT, OP_ACK, RLT_SUCCESS, 0);
 }
 
 
+/* A handover (see do_move_ticket()) didn't happen. Nobody but the
+ * target knows about the new term, hence we can take the ticket
+ * back; the CIB has it revoked by now. */
+void handover_failed(struct ticket_config *tk, int rv)
+{
+	no_resends(tk);
+	tk->last_request = 0;
+	won_elections(tk);
+	/* before ticket_write(), which may answer the client, too */
+	notify_client(tk, rv);
+	ticket_write(tk);
+}
+
+
 static int is_tie(struct ticket_config *tk)
 {
 	int i;
@@ -247,7 +296,7 @@ static int newer_term(struct ticket_config *tk,
 	term = ntohl(msg->ticket.term);
 	/* §5.1 */
 	if (term > tk->current_term) {
-		tk->state = ST_FOLLOWER;
+		tk_hot(tk)->state = ST_FOLLOWER;
 		if (!in_election) {
 			tk->leader = leader;
 			tk_log_info("from %s: higher term %d vs. %d, following %s",
@@ -261,6 +310,7 @@ static int newer_term(struct ticket_config *tk,
 		}
 
 		tk->current_term = term;
+		journal_note(tk);
 		return 1;
 	}
 
@@ -329,9 +379,10 @@ static int answer_HEARTBEAT (
 	assert(sender == leader || !leader);
 
 	tk->leader = leader;
+	update_successor_from_msg(tk, msg);
 
 	/* Ack the heartbeat (we comply). */
-	return send_msg(OP_ACK, tk, sender, msg);
+	return send_ack(tk, sender, msg);
 }
 
 
@@ -354,12 +405,13 @@ static int process_UPDATE (
 
 	tk->leader = leader;
 	copy_ticket_from_msg(tk, msg);
+	update_successor_from_msg(tk, msg);
 	ticket_write(tk);
 
 	/* run ticket_cron if the ticket expires */
 	set_ticket_wakeup(tk);
 
-	return send_msg(OP_ACK, tk, sender, msg);
+	return send_ack(tk, sender, msg);
 }
 
 static int process_REVOKE (
@@ -371,7 +423,7 @@ static int process_REVOKE (
 {
 	int rv;
 
-	if (tk->state == ST_INIT && tk->leader == no_leader) {
+	if (tk_hot(tk)->state == ST_INIT && tk->leader == no_leader) {
 		/* assume that our ack got lost */
 		rv = send_msg(OP_ACK, tk, sender, msg);
 	} else if (tk->leader != sender) {
@@ -379,11 +431,11 @@ static int process_REVOKE (
 				"but it is not granted there (ignoring)",
 				site_string(sender));
 		return 1;
-	} else if (tk->state != ST_FOLLOWER) {
+	} else if (tk_hot(tk)->state != ST_FOLLOWER) {
 		tk_log_error("unexpected ticket revoke from %s "
 				"(in state %s) (ignoring)",
 				site_string(sender),
-				state_to_string(tk->state));
+				state_to_string(tk_hot(tk)->state));
 		return 1;
 	} else {
 		tk_log_info("%s revokes ticket",
@@ -399,7 +451,8 @@ static int process_REVOKE (
 
 
 /* For leader. */
-static int process_ACK(
+/* The leader hands the ticket over to us (see do_move_ticket()). */
+static int process_HANDOVER(
 		struct ticket_config *tk,
 		struct booth_site *sender,
 		struct booth_site *leader,
@@ -410,6 +463,52 @@ static int process_ACK(
 
 	term = ntohl(msg->ticket.term);
 
+	if (leader != local) {
+		tk_log_error("%s wants to hand over the ticket to %s "
+				"(ignoring)",
+				site_string(sender), site_string(leader));
+		return -EINVAL;
+	}
+
+	if (tk->leader == local && term == tk->current_term) {
+		/* assume that our ack got lost */
+		return send_msg(OP_ACK, tk, sender, msg);
+	}
+
+	if (sender != tk->leader || term <= tk->current_term) {
+		tk_log_warn("%s wants to hand over the ticket, "
+				"but it is not the leader (term %d vs. %d)",
+				site_string(sender), term, tk->current_term);
+		return send_reject(sender, tk, RLT_TERM_OUTDATED, msg);
+	}
+
+	/* what we told the leader in our acks */
+	if (acquire_verdict(tk) != RLT_SUCCESS)
+		return send_reject(sender, tk, RLT_EXT_FAILED, msg);
+
+	tk_log_info("%s hands the ticket over", site_string(sender));
+	tk->current_term = term;
+	tk->delay_commit = 0;
+	tk->in_election = 0;
+	won_elections(tk);
+	/* the old leader revoked it already */
+	ticket_write(tk);
+
+	return send_msg(OP_ACK, tk, sender, msg);
+}
+
+
+static int process_ACK(
+		struct ticket_config *tk,
+		struct booth_site *sender,
+		struct booth_site *leader,
+		struct boothc_ticket_msg *msg
+	       )
+{
+	uint32_t term, req;
+
+	term = ntohl(msg->ticket.term);
+
 	if (newer_term(tk, sender, leader, msg, 0)) {
 		/* unexpected higher term */
 		tk_log_warn("got higher term from %s (%d vs. %d)",
@@ -429,9 +528,18 @@ static int process_ACK(
 		return 0;
 	}
 
+	/* remember who could take over */
+	req = ntohl(msg->header.request);
+	if (req == OP_HEARTBEAT || req == OP_UPDATE) {
+		if (ntohl(msg->header.result) == RLT_SUCCESS)
+			tk->acquire_ok |= sender->bitmask;
+		else
+			tk->acquire_ok &= ~sender->bitmask;
+	}
+
 	/* if the ticket is to be revoked, further processing is not
 	 * interesting (and dangerous) */
-	if (tk->next_state == ST_INIT || tk->state == ST_INIT)
+	if (tk->next_state == ST_INIT || tk_hot(tk)->state == ST_INIT)
 		return 0;
 
 	/* for heartbeats we make do with the majority */
@@ -439,7 +547,7 @@ static int process_ACK(
 			term == tk->current_term &&
 			leader == tk->leader) {
 
-		if (majority_of_bits(tk, tk->acks_received)) {
+		if (majority_of_bits(tk, tk_hot(tk)->acks_received)) {
 			/* OK, at least half of the nodes are reachable;
 			 * Update the ticket and send update messages out
 			 */
@@ -460,11 +568,11 @@ static int process_VOTE_FOR(
 {
 	/* leader wants to step down? */
 	if (leader == no_leader && sender == tk->leader &&
-			(tk->state == ST_FOLLOWER || tk->state == ST_CANDIDATE)) {
+			(tk_hot(tk)->state == ST_FOLLOWER || tk_hot(tk)->state == ST_CANDIDATE)) {
 		tk_log_info("%s wants to give the ticket away",
 			site_string(tk->leader));
 		reset_ticket(tk);
-		tk->state = ST_FOLLOWER;
+		tk_hot(tk)->state = ST_FOLLOWER;
 		if (local->type == SITE) {
 			ticket_write(tk);
 			schedule_election(tk, OR_STEPDOWN);
@@ -472,7 +580,7 @@ static int process_VOTE_FOR(
 		return 0;
 	}
 
-	if (tk->state != ST_CANDIDATE) {
+	if (tk_hot(tk)->state != ST_CANDIDATE) {
 		/* lost candidate status, somebody rejected our proposal */
 		tk_log_debug("candidate status lost, ignoring vote_for from %s",
 			site_string(sender));
@@ -490,9 +598,14 @@ static int process_VOTE_FOR(
 
 	/* only if all voted can we take the ticket now, otherwise
 	 * wait for timeout in ticket_cron */
-	if (!tk->acks_expected) {
+	if (!tk_hot(tk)->acks_expected) {
 		/* §5.2 */
 		elections_end(tk);
+	} else if (tk->election_reason == OR_SUCCESSOR &&
+			majority_votes(tk) == local) {
+		/* we were designated by the previous leader, nobody
+		 * else is competing; a majority is all we need */
+		elections_end(tk);
 	}
 
 	return 0;
@@ -510,7 +623,33 @@ static int process_REJECTED(
 
 	rv   = ntohl(msg->header.result);
 
-	if (tk->state == ST_CANDIDATE &&
+	if (ntohl(msg->header.request) == OP_HANDOVER &&
+			tk->last_request == OP_HANDOVER &&
+			sender == tk->leader) {
+		tk_log_warn("%s refused to take over the ticket (%s)",
+				site_string(sender), state_to_string(rv));
+		handover_failed(tk, rv);
+		return 0;
+	}
+
+	if (ntohl(msg->header.request) == OP_PREVOTE) {
+		if (!tk->in_prevote)
+			return 0;
+		if (rv == RLT_TERM_STILL_VALID &&
+				leader && leader != no_leader) {
+			/* no need for elections */
+			tk_log_info("ticket is still granted to %s, following",
+					site_string(leader));
+			tk->in_prevote = 0;
+			tk->election_end = 0;
+			no_resends(tk);
+			tk->leader = leader;
+			become_follower(tk, msg);
+		}
+		return 0;
+	}
+
+	if (tk_hot(tk)->state == ST_CANDIDATE &&
 			leader == local) {
 		/* the sender has us as the leader (!)
 		 * the elections will time out, then we can try again
@@ -521,7 +660,7 @@ static int process_REJECTED(
 		return 0;
 	}
 
-	if (tk->state == ST_CANDIDATE &&
+	if (tk_hot(tk)->state == ST_CANDIDATE &&
 			rv == RLT_TERM_OUTDATED) {
 		tk_log_warn("ticket outdated (term %d), granted to %s",
 				ntohl(msg->ticket.term),
@@ -533,7 +672,7 @@ static int process_REJECTED(
 		return 0;
 	}
 
-	if (tk->state == ST_CANDIDATE &&
+	if (tk_hot(tk)->state == ST_CANDIDATE &&
 			rv == RLT_TERM_STILL_VALID) {
 		if (tk->lost_leader == leader) {
 			if (tk->election_reason == OR_TKT_LOST) {
@@ -555,7 +694,7 @@ static int process_REJECTED(
 		return 0;
 	}
 
-	if (tk->state == ST_CANDIDATE &&
+	if (tk_hot(tk)->state == ST_CANDIDATE &&
 			rv == RLT_YOU_OUTDATED) {
 		tk->leader = leader;
 		tk->expect_more_rejects = 1;
@@ -566,7 +705,7 @@ static int process_REJECTED(
 		} else {
 			tk_log_warn("our ticket is outdated and revoked");
 			update_ticket_from_msg(tk, sender, msg);
-			tk->state = ST_INIT;
+			tk_hot(tk)->state = ST_INIT;
 		}
 		return 0;
 	}
@@ -574,7 +713,7 @@ static int process_REJECTED(
 	if (!tk->expect_more_rejects) {
 		tk_log_warn("from %s: in state %s, got %s (unexpected reject)",
 				site_string(sender),
-				state_to_string(tk->state),
+				state_to_string(tk_hot(tk)->state),
 				state_to_string(rv));
 	}
 
@@ -589,11 +728,11 @@ static int ticket_seems_ok(struct ticket_config *tk)
 	time_left = term_time_left(tk);
 	if (!time_left)
 		return 0; /* quite sure */
-	if (tk->state == ST_CANDIDATE)
+	if (tk_hot(tk)->state == ST_CANDIDATE)
 		return 0; /* in state of flux */
-	if (tk->state == ST_LEADER)
+	if (tk_hot(tk)->state == ST_LEADER)
 		return 1; /* quite sure */
-	if (tk->state == ST_FOLLOWER &&
+	if (tk_hot(tk)->state == ST_FOLLOWER &&
 			time_left >= tk->term_duration/3)
 		return 1; /* almost quite sure */
 	return 0;
@@ -611,12 +750,12 @@ static int test_reason(
 
 	reason = ntohl(msg->header.reason);
 	if (reason == OR_TKT_LOST) {
-		if (tk->state == ST_INIT &&
+		if (tk_hot(tk)->state == ST_INIT &&
 				tk->leader == no_leader) {
 			tk_log_warn("%s claims that the ticket is lost, "
 					"but it's in %s state (reject sent)",
 					site_string(sender),
-					state_to_string(tk->state)
+					state_to_string(tk_hot(tk)->state)
 				);
 			return RLT_YOU_OUTDATED;
 		}
@@ -649,7 +788,9 @@ static int answer_REQ_VOTE(
 
 	valid = term_time_left(tk);
 
-	/* allow the leader to start new elections on valid tickets */
+	/* allow the leader to start new elections on valid tickets;
+	 * the designated successor, too, has to wait until the lease
+	 * ran out here */
 	if (sender != tk->leader && valid) {
 		tk_log_warn("election from %s rejected "
 			"(we have %s as ticket owner), ticket still valid for %ds",
@@ -679,31 +820,72 @@ static int answer_REQ_VOTE(
 	/* §5.2, §5.4 */
 	if (!tk->voted_for) {
 vote_for_sender:
+		tk->in_prevote = 0;
 		tk->voted_for = sender;
 		record_vote(tk, sender, leader);
+		journal_note(tk);
 	}
 
 
 	init_ticket_msg(&omsg, OP_VOTE_FOR, OP_REQ_VOTE, RLT_SUCCESS, 0, tk);
 	omsg.ticket.leader = htonl(get_node_id(tk->voted_for));
-	return booth_udp_send(sender, &omsg, sizeof(omsg));
+	return transport()->send(sender, &omsg, sizeof(omsg));
 }
 
 
-int new_election(struct ticket_config *tk,
-	struct booth_site *preference, int update_term, cmd_reason_t reason)
+/* Elections that somebody asked for (or which the previous
+ * leader prepared) go ahead at once; otherwise we first make sure
+ * that we could win, so that a site which was cut off doesn't
+ * disturb the others with higher terms. */
+static int needs_prevote(struct ticket_config *tk,
+		struct booth_site *preference, cmd_reason_t reason)
 {
-	struct booth_site *new_leader;
-	time_t now;
+	struct booth_site *site;
+	int i;
 
-	if (local->type != SITE)
-		return 0;
+	if (reason == OR_AGAIN)
+		reason = tk->election_reason;
 
-	get_secs(&now);
-	tk_log_debug("start new election?, now=%" PRIi64 ", end %" PRIi64,
-			(int64_t)wall_ts(now), (int64_t)(wall_ts(tk->election_end)));
-	if (now < tk->election_end)
-		return 1;
+	/* older sites wouldn't answer; of those we haven't heard from
+	 * yet, we don't know, but they answer our status request */
+	foreach_node(i, site) {
+		if (site != local && site->last_recv &&
+				!(site->caps & CAP_PREVOTE))
+			return 0;
+	}
+
+	return (!preference || preference == local) &&
+		tk_hot(tk)->state != ST_CANDIDATE &&
+		reason != OR_ADMIN &&
+		reason != OR_SUCCESSOR &&
+		reason != OR_REACQUIRE;
+}
+
+
+static int start_prevote(struct ticket_config *tk,
+		cmd_reason_t reason, time_t now)
+{
+	if (reason != OR_AGAIN)
+		tk->election_reason = reason;
+
+	tk_log_debug("asking whether we could win an election (term=%d)",
+			tk->current_term);
+	tk->election_end = now + tk->timeout;
+	tk->in_prevote = 1;
+	tk->prevotes = local->bitmask;
+
+	ticket_broadcast(tk, OP_PREVOTE, OP_VOTE_FOR, RLT_SUCCESS,
+			tk->election_reason);
+	add_random_delay(tk);
+	return 0;
+}
+
+
+static int start_election(struct ticket_config *tk,
+	struct booth_site *preference, int update_term, cmd_reason_t reason,
+	time_t now)
+{
+	struct booth_site *new_leader;
 
 	/* §5.2 */
 	/* If there was _no_ answer, don't keep incrementing the term number
@@ -714,13 +896,13 @@ int new_election(struct ticket_config *tk,
 	if (update_term) {
 		/* save the previous term, we may need to send out the
 		 * MY_INDEX message */
-		if (tk->state != ST_CANDIDATE) {
-			memcpy(tk->last_valid_tk, tk, sizeof(struct ticket_config));
+		if (tk_hot(tk)->state != ST_CANDIDATE) {
+			status_ticket(tk, &tk->last_valid);
 		}
 		tk->current_term++;
 	}
 
-	tk->term_expires = 0;
+	tk_hot(tk)->term_expires = 0;
 	tk->election_end = now + tk->timeout;
 	tk->in_election = 1;
 
@@ -734,9 +916,10 @@ int new_election(struct ticket_config *tk,
 		new_leader = (local->type == SITE) ? local : NULL;
 	record_vote(tk, local, new_leader);
 	tk->voted_for = new_leader;
+	journal_note(tk);
 
 	tk->leader = no_leader;
-	tk->state = ST_CANDIDATE;
+	tk_hot(tk)->state = ST_CANDIDATE;
 
 	/* some callers may want just to repeat on timeout */
 	if (reason == OR_AGAIN) {
@@ -751,6 +934,82 @@ int new_election(struct ticket_config *tk,
 }
 
 
+int new_election(struct ticket_config *tk,
+	struct booth_site *preference, int update_term, cmd_reason_t reason)
+{
+	time_t now;
+
+	if (local->type != SITE)
+		return 0;
+
+	get_secs(&now);
+	tk_log_debug("start new election?, now=%" PRIi64 ", end %" PRIi64,
+			(int64_t)wall_ts(now), (int64_t)(wall_ts(tk->election_end)));
+	if (now < tk->election_end)
+		return 1;
+
+	tk->in_prevote = 0;
+	if (update_term && needs_prevote(tk, preference, reason))
+		return start_prevote(tk, reason, now);
+
+	return start_election(tk, preference, update_term, reason, now);
+}
+
+
+/* Pre-vote (§9.6 of the Raft thesis): nothing changes here, we
+ * only tell whether we would vote for the sender. */
+static int answer_PREVOTE(
+		struct ticket_config *tk,
+		struct booth_site *sender,
+		struct booth_site *leader,
+		struct boothc_ticket_msg *msg
+		)
+{
+	struct boothc_ticket_msg omsg;
+	int valid;
+
+	valid = term_time_left(tk);
+	if (valid && sender != tk->leader) {
+		tk_log_debug("pre-vote from %s rejected "
+				"(we have %s as ticket owner)",
+				site_string(sender), site_string(tk->leader));
+		return send_reject(sender, tk, RLT_TERM_STILL_VALID, msg);
+	}
+
+	if (ntohl(msg->ticket.term) < tk->current_term) {
+		tk_log_debug("pre-vote from %s rejected (term %d vs. %d)",
+				site_string(sender),
+				ntohl(msg->ticket.term), tk->current_term);
+		return send_reject(sender, tk, RLT_TERM_OUTDATED, msg);
+	}
+
+	init_ticket_msg(&omsg, OP_VOTE_FOR, OP_PREVOTE, RLT_SUCCESS, 0, tk);
+	omsg.ticket.leader = htonl(get_node_id(sender));
+	return transport()->send(sender, &omsg, sizeof(omsg));
+}
+
+
+static int process_PREVOTE_granted(
+		struct ticket_config *tk,
+		struct booth_site *sender
+		)
+{
+	time_t now;
+
+	if (!tk->in_prevote)
+		return 0;
+
+	tk->prevotes |= sender->bitmask;
+	if (!majority_of_bits(tk, tk->prevotes))
+		return 0;
+
+	tk_log_debug("majority agrees, starting the election");
+	tk->in_prevote = 0;
+	get_secs(&now);
+	return start_election(tk, NULL, 1, OR_AGAIN, now);
+}
+
+
 /* we were a leader and somebody says that they have a more up
  * to date ticket
  * there was probably connectivity loss
@@ -803,7 +1062,7 @@ static int process_MY_INDEX (
 		 * valid yet, don't send it */
 		if (!tk->in_election)
 			send_msg(OP_MY_INDEX, tk, sender, msg);
-		if (tk->state == ST_LEADER) {
+		if (tk_hot(tk)->state == ST_LEADER) {
 			tk_log_info("sending ticket update to %s",
 					site_string(sender));
 			return send_msg(OP_UPDATE, tk, sender, msg);
@@ -816,7 +1075,7 @@ static int process_MY_INDEX (
 		return 0;
 	}
 
-	if (tk->state == ST_LEADER) {
+	if (tk_hot(tk)->state == ST_LEADER) {
 		/* we're the leader, thread carefully */
 		if (expired) {
 			/* if their ticket is expired,
@@ -876,18 +1135,36 @@ int raft_answer(
 	case OP_REQ_VOTE:
 		rv = answer_REQ_VOTE(tk, sender, leader, msg);
 		break;
+	case OP_PREVOTE:
+		rv = answer_PREVOTE(tk, sender, leader, msg);
+		break;
 	case OP_VOTE_FOR:
-		rv = process_VOTE_FOR(tk, sender, leader, msg);
+		if (req == OP_PREVOTE)
+			rv = process_PREVOTE_granted(tk, sender);
+		else
+			rv = process_VOTE_FOR(tk, sender, leader, msg);
 		break;
 	case OP_ACK:
 		if (tk->leader == local &&
-				tk->state == ST_LEADER)
+				tk_hot(tk)->state == ST_LEADER)
 			rv = process_ACK(tk, sender, leader, msg);
+		else if (req == OP_HANDOVER && sender == tk->leader &&
+				tk->last_request == OP_HANDOVER) {
+			tk_log_info("handed the ticket over to %s",
+					site_string(sender));
+			/* acks for our resends find nothing to do */
+			no_resends(tk);
+			tk->last_request = 0;
+			notify_client(tk, RLT_SUCCESS);
+		}
+		break;
+	case OP_HANDOVER:
+		rv = process_HANDOVER(tk, sender, leader, msg);
 		break;
 	case OP_HEARTBEAT:
 		if ((tk->leader != local || !term_time_left(tk)) &&
-				(tk->state == ST_INIT || tk->state == ST_FOLLOWER ||
-				tk->state == ST_CANDIDATE))
+				(tk_hot(tk)->state == ST_INIT || tk_hot(tk)->state == ST_FOLLOWER ||
+				tk_hot(tk)->state == ST_CANDIDATE))
 			rv = answer_HEARTBEAT(tk, sender, leader, msg);
 		else {
 			tk_log_warn("unexpected message %s, from %s",
@@ -900,8 +1177,8 @@ int raft_answer(
 		break;
 	case OP_UPDATE:
 		if (((tk->leader != local && tk->leader == leader) || !is_owned(tk)) &&
-				(tk->state == ST_INIT || tk->state == ST_FOLLOWER ||
-				tk->state == ST_CANDIDATE)) {
+				(tk_hot(tk)->state == ST_INIT || tk_hot(tk)->state == ST_FOLLOWER ||
+				tk_hot(tk)->state == ST_CANDIDATE)) {
 			rv = process_UPDATE(tk, sender, leader, msg);
 		} else {
 			tk_log_warn("unexpected message %s, from %s",
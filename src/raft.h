@@ -38,6 +38,7 @@ int raft_answer(struct ticket_config *tk,
 int new_election(struct ticket_config *tk,
 		struct booth_site *new_leader, int update_term, cmd_reason_t reason);
 void elections_end(struct ticket_config *tk);
+void handover_failed(struct ticket_config *tk, int rv);
 
 
 #endif /* _RAFT_H */
@@ -0,0 +1,313 @@
+/* 
+ * Copyright (C) 2026 agent <agent@local>
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <endian.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "ticket.h"
+#include "config.h"
+#include "inline-fn.h"
+#include "log.h"
+#include "booth.h"
+#include "snapshot.h"
+
+
+/* The state of all tickets is kept in a memory mapped file, so
+ * that after a restart we know at once about the terms, leaders,
+ * and votes (arbitrators have no CIB to ask). Records are written
+ * only when they change; each has its own checksum, so a torn
+ * write spoils just one ticket. The records are in configuration
+ * order; when that changes, they're looked up by name and laid out
+ * anew. */
+
+#define SNAPSHOT_MAGIC		0x426f5374
+#define SNAPSHOT_VERSION	1
+
+struct snapshot_record {
+	char name[BOOTH_NAME_LEN];
+	uint32_t leader;
+	uint32_t term;
+	uint32_t voted_for;
+	int64_t expires;
+	/* over all of the above */
+	uint32_t crc;
+} __attribute__((packed));
+
+struct snapshot_file {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t ticket_count;
+	uint32_t record_size;
+	struct snapshot_record rec[0];
+} __attribute__((packed));
+
+static struct snapshot_file *snap;
+static size_t snap_size;
+
+
+static uint32_t record_crc(struct snapshot_record *r)
+{
+	return crc32(crc32(0L, NULL, 0), (void *)r,
+			offsetof(struct snapshot_record, crc));
+}
+
+
+static int record_cmp(const void *a, const void *b)
+{
+	return strncmp(((const struct snapshot_record *)a)->name,
+			((const struct snapshot_record *)b)->name,
+			BOOTH_NAME_LEN);
+}
+
+
+/* The records in the file as it is, sorted by name; NULL if it has
+ * none we could use. */
+static struct snapshot_record *read_records(int fd, off_t size,
+		int *cnt)
+{
+	struct snapshot_file hdr;
+	struct snapshot_record *rec;
+	size_t len;
+
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+			hdr.magic != htonl(SNAPSHOT_MAGIC) ||
+			hdr.version != htonl(SNAPSHOT_VERSION) ||
+			hdr.record_size != htonl(sizeof(*rec)))
+		return NULL;
+
+	*cnt = ntohl(hdr.ticket_count);
+	len = (size_t)*cnt * sizeof(*rec);
+	if (!*cnt || sizeof(hdr) + len > size)
+		return NULL;
+
+	rec = malloc(len);
+	if (!rec) {
+		log_error("out of memory");
+		return NULL;
+	}
+	if (pread(fd, rec, len, sizeof(hdr)) != len) {
+		free(rec);
+		return NULL;
+	}
+
+	qsort(rec, *cnt, sizeof(*rec), record_cmp);
+	return rec;
+}
+
+
+/* Are the records where the configuration has the tickets? */
+static int same_layout(struct snapshot_file *p)
+{
+	struct ticket_config *tk;
+	int i;
+
+	if (ntohl(p->ticket_count) != booth_conf->ticket_count)
+		return 0;
+	foreach_ticket(i, tk) {
+		/* not written yet is fine */
+		if (p->rec[i].name[0] &&
+				strncmp(p->rec[i].name, tk->name,
+					sizeof(p->rec[i].name)))
+			return 0;
+	}
+	return 1;
+}
+
+
+int snapshot_open(void)
+{
+	char path[BOOTH_PATH_LEN + 1];
+	struct snapshot_file *p;
+	struct snapshot_record *old, key, *r;
+	struct ticket_config *tk;
+	size_t size;
+	struct stat st;
+	int fd, rv, i, old_cnt, found;
+
+	/* again after a configuration reload */
+	if (snap) {
+		munmap(snap, snap_size);
+		snap = NULL;
+	}
+
+	size = sizeof(*snap) +
+		booth_conf->ticket_count * sizeof(snap->rec[0]);
+
+	/* After reboot the directory may not yet exist.
+	 * Try to create it, but ignore errors. */
+	mkdir(BOOTH_LIB_DIR, 0775);
+	snprintf(path, sizeof(path), "%s%s-%s.state",
+			BOOTH_LIB_DIR, shard_file_name(), site_string(local));
+
+	fd = open(path, O_RDWR | O_CREAT, 0640);
+	if (fd < 0) {
+		log_warn("cannot open state file %s: %s",
+				path, strerror(errno));
+		return -errno;
+	}
+
+	old = NULL;
+	rv = fstat(fd, &st);
+	if (!rv && st.st_size != size) {
+		/* before it gets cut off */
+		old = read_records(fd, st.st_size, &old_cnt);
+		rv = ftruncate(fd, size);
+	}
+	if (rv) {
+		log_warn("cannot resize state file %s: %s",
+				path, strerror(errno));
+		rv = -errno;
+		goto out;
+	}
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		log_warn("cannot map state file %s: %s",
+				path, strerror(errno));
+		rv = -errno;
+		goto out;
+	}
+
+	if (!old && !same_layout(p))
+		old = read_records(fd, size, &old_cnt);
+
+	if (old) {
+		/* another configuration; keep what we know per ticket */
+		found = 0;
+		foreach_ticket(i, tk) {
+			memset(&key, 0, sizeof(key));
+			strncpy(key.name, tk->name, sizeof(key.name));
+			r = bsearch(&key, old, old_cnt, sizeof(*old),
+					record_cmp);
+			if (r) {
+				p->rec[i] = *r;
+				found++;
+			} else {
+				memset(p->rec + i, 0, sizeof(p->rec[i]));
+			}
+		}
+		p->ticket_count = htonl(booth_conf->ticket_count);
+		log_info("state file %s rearranged, %d of %d tickets kept",
+				path, found, old_cnt);
+		free(old);
+	} else if (p->magic != htonl(SNAPSHOT_MAGIC) ||
+			p->version != htonl(SNAPSHOT_VERSION) ||
+			p->record_size != htonl(sizeof(p->rec[0])) ||
+			ntohl(p->ticket_count) != booth_conf->ticket_count) {
+		log_info("initializing state file %s", path);
+		memset(p, 0, size);
+		p->magic = htonl(SNAPSHOT_MAGIC);
+		p->version = htonl(SNAPSHOT_VERSION);
+		p->record_size = htonl(sizeof(p->rec[0]));
+		p->ticket_count = htonl(booth_conf->ticket_count);
+	}
+
+	snap = p;
+	snap_size = size;
+	rv = 0;
+
+out:
+	close(fd);
+	return rv;
+}
+
+
+static struct snapshot_record *ticket_record(struct ticket_config *tk)
+{
+	if (!snap)
+		return NULL;
+	return snap->rec + (tk - booth_conf->ticket);
+}
+
+
+/* Take over what we knew before the restart, unless the CIB told
+ * us about something newer. Returns 0 if anything was restored. */
+int snapshot_restore(struct ticket_config *tk)
+{
+	struct snapshot_record *r;
+	struct booth_site *leader, *voted_for;
+	uint32_t term;
+	time_t expires;
+
+	r = ticket_record(tk);
+	if (!r || ntohl(r->crc) != record_crc(r) ||
+			strncmp(r->name, tk->name, sizeof(r->name)))
+		return -ENOENT;
+
+	term = ntohl(r->term);
+	if (term < tk->current_term)
+		return -ENOENT;
+
+	if (!find_site_by_id(ntohl(r->voted_for), &voted_for) ||
+			voted_for == no_leader)
+		voted_for = NULL;
+	tk->current_term = term;
+	tk->voted_for = voted_for;
+
+	expires = unwall_ts((time_t)(int64_t)be64toh(r->expires));
+	if (expires <= get_secs(NULL) ||
+			!find_site_by_id(ntohl(r->leader), &leader) ||
+			leader == no_leader || !leader)
+		return 0;
+
+	/* if granted here, only the CIB knows for sure */
+	if (leader == local && !tk->is_granted &&
+			local->type == SITE)
+		return 0;
+
+	tk->leader = leader;
+	tk_hot(tk)->term_expires = expires;
+	tk_log_info("restored state: term %d, leader %s",
+			term, site_string(leader));
+	return 0;
+}
+
+
+void snapshot_update(struct ticket_config *tk)
+{
+	struct snapshot_record *r, new;
+	struct ticket_status st;
+
+	r = ticket_record(tk);
+	if (!r)
+		return;
+
+	/* While in elections, keep the last valid ticket, but
+	 * remember our vote. */
+	status_ticket(tk, &st);
+	memset(&new, 0, sizeof(new));
+	strncpy(new.name, tk->name, sizeof(new.name));
+	new.leader = htonl(get_node_id(status_leader(&st)));
+	new.term = htonl(tk->current_term);
+	new.voted_for = htonl(get_node_id(tk->voted_for));
+	new.expires = htobe64((int64_t)(st.term_expires ?
+				wall_ts(st.term_expires) : 0));
+	new.crc = htonl(record_crc(&new));
+
+	if (memcmp(r, &new, sizeof(new)))
+		memcpy(r, &new, sizeof(new));
+}
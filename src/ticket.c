@@ -34,9 +34,16 @@
 #include "booth.h"
 #include "raft.h"
 #include "handler.h"
+#include "digest.h"
+#include "snapshot.h"
+#include "journal.h"
+#include "catalog.h"
 
 #define TK_LINE			256
 
+/** Minimal length of an election slot, see weighted_delay_ms(). */
+#define ELECTION_SLOT_MIN_MS	100
+
 
 /* Untrusted input, must fit (incl. \0) in a buffer of max chars. */
 int check_max_len_valid(const char *s, int max)
@@ -123,16 +130,22 @@ static int ticket_dangerous(struct ticket_config *tk)
 
 int ticket_write(struct ticket_config *tk)
 {
+	int rv;
+
 	if (local->type != SITE)
 		return -EINVAL;
 
 	if (ticket_dangerous(tk))
 		return 1;
 
-	if (tk->leader == local) {
-		pcmk_handler.grant_ticket(tk);
-	} else {
-		pcmk_handler.revoke_ticket(tk);
+	if (tk->leader == local)
+		rv = pcmk_handler.grant_ticket(tk);
+	else
+		rv = pcmk_handler.revoke_ticket(tk);
+	/* not queued; next time, see ticket_cron() */
+	if (rv < 0) {
+		tk->update_cib = 1;
+		return 1;
 	}
 	tk->update_cib = 0;
 
@@ -140,47 +153,177 @@ int ticket_write(struct ticket_config *tk)
 }
 
 
-/* Ask an external program whether getting the ticket
- * makes sense.
-* Eg. if the services have a failcount of INFINITY,
-* we can't serve here anyway. */
-int test_external_prog(struct ticket_config *tk,
-		int start_election)
+static void send_handover(struct ticket_config *tk)
 {
-	int rv;
+	struct booth_site *target = tk->leader;
 
-	rv = run_handler(tk, tk->ext_verifier, 1);
+	/* only the target needs to answer; else we resend, see
+	 * handle_resends() */
+	expect_replies(tk, OP_ACK);
+	tk_hot(tk)->acks_received = booth_conf->all_bits & ~target->bitmask;
+	ticket_activate_timeout(tk);
+	(void)send_msg(OP_HANDOVER, tk, target, NULL);
+}
+
+/* The CIB update queued by ticket_write() is through, see
+ * cib_write_done(). A client waiting for the grant gets its
+ * answer now. */
+void ticket_write_done(struct ticket_config *tk, uint32_t term,
+		int grant, int rv)
+{
 	if (rv) {
-		tk_log_warn("we are not allowed to acquire ticket");
+		/* again, see ticket_cron() */
+		tk->update_cib = 1;
+	}
 
-		/* Give it to somebody else.
-		 * Just send a VOTE_FOR message, so the
-		 * others can start elections. */
-		if (leader_and_valid(tk)) {
-			reset_ticket(tk);
-			ticket_write(tk);
-			if (start_election) {
-				ticket_broadcast(tk, OP_VOTE_FOR, OP_REQ_VOTE, RLT_SUCCESS, OR_LOCAL_FAIL);
-			}
+	if (grant > 0 && tk->leader == local && tk->current_term == term)
+		notify_client(tk, rv ? RLT_CIB_PENDING : RLT_SUCCESS);
+
+	/* a move waits for the revoke, see do_move_ticket() */
+	if (grant < 0 && tk->last_request == OP_HANDOVER &&
+			!tk_hot(tk)->acks_expected && tk->current_term == term) {
+		if (!rv)
+			send_handover(tk);
+		else {
+			tk_log_error("cannot revoke the ticket, keeping it");
+			handover_failed(tk, RLT_SYNC_FAIL);
 		}
 	}
+}
 
-	return rv;
+
+/* The external program said no, eg. as the services have a
+ * failcount of INFINITY and we can't serve here anyway. */
+static void ext_prog_failed(struct ticket_config *tk,
+		int start_election)
+{
+	tk_log_warn("we are not allowed to acquire ticket");
+
+	/* Give it to somebody else.
+	 * Just send a VOTE_FOR message, so the
+	 * others can start elections. */
+	if (leader_and_valid(tk)) {
+		reset_ticket(tk);
+		ticket_write(tk);
+		if (start_election) {
+			ticket_broadcast(tk, OP_VOTE_FOR, OP_REQ_VOTE, RLT_SUCCESS, OR_LOCAL_FAIL);
+		}
+	}
+}
+
+
+static void verdict_done(struct ticket_config *tk, int rv, int unused)
+{
+	tk->acquire_verdict = rv ? RLT_EXT_FAILED : RLT_SUCCESS;
+	tk->acquire_verdict_at = get_secs(NULL);
+	tk->verdict_pending = 0;
+}
+
+/* Could we take over the ticket? The answer goes with our acks
+ * to the leader, which picks the successor based on it. Only the
+ * last answer of the external program is used here, see
+ * refresh_verdict(); until there is one, we couldn't.
+ */
+int acquire_verdict(struct ticket_config *tk)
+{
+	if (local->type != SITE)
+		return RLT_EXT_FAILED;
+	if (!tk->ext_verifier)
+		return RLT_SUCCESS;
+
+	return tk->acquire_verdict_at ? tk->acquire_verdict : RLT_EXT_FAILED;
+}
+
+/* Following another leader, ask the external program at most
+ * once per renewal period; it runs off the loop. */
+static void refresh_verdict(struct ticket_config *tk)
+{
+	if (local->type != SITE || !tk->ext_verifier ||
+			tk->verdict_pending ||
+			!is_owned(tk) || tk->leader == local)
+		return;
+
+	if (tk->acquire_verdict_at &&
+			get_secs(NULL) - tk->acquire_verdict_at < tk->renewal_freq)
+		return;
+
+	tk->verdict_pending = 1;
+	if (run_handler(tk, tk->ext_verifier, verdict_done, 0) < 0)
+		tk->verdict_pending = 0;
 }
 
 
+static void acquire_test_done(struct ticket_config *tk, int rv, int reason)
+{
+	tk->test_pending = 0;
+
+	if (rv) {
+		ext_prog_failed(tk, 0);
+		tk->acquire_rv = RLT_EXT_FAILED;
+	} else if (reason == OR_ADMIN && is_owned(tk)) {
+		/* somebody was faster */
+		tk->acquire_rv = RLT_OVERGRANT;
+	} else {
+		tk->acquire_rv = new_election(tk, local, 1, reason) ?
+			RLT_SYNC_FAIL : 0;
+	}
+	if (!tk->acquire_rv)
+		return;
+
+	if (reason == OR_ADMIN) {
+		tk->delay_commit = 0;
+		notify_client(tk, tk->acquire_rv);
+	} else if (reason == OR_SUCCESSOR) {
+		schedule_election(tk, OR_TKT_LOST);
+	}
+}
+
 /* Try to acquire a ticket
  * Could be manual grant or after ticket loss
+ * The before-acquire-handler runs first, off the loop; the
+ * elections start once it agrees (see acquire_test_done()).
+ * Without the worker thread that's all done on return.
  */
 int acquire_ticket(struct ticket_config *tk, cmd_reason_t reason)
 {
-	int rc;
+	if (tk->test_pending)
+		return RLT_BUSY;
+
+	tk->test_pending = 1;
+	tk->acquire_rv = 0;
+	if (run_handler(tk, tk->ext_verifier, acquire_test_done, reason) < 0) {
+		tk->test_pending = 0;
+		return RLT_SYNC_FAIL;
+	}
+
+	return tk->test_pending ? 0 : tk->acquire_rv;
+}
 
-	if (test_external_prog(tk, 0))
-		return RLT_EXT_FAILED;
 
-	rc = new_election(tk, local, 1, reason);
-	return rc ? RLT_SYNC_FAIL : 0;
+static void renewal_test_done(struct ticket_config *tk, int rv, int unused)
+{
+	tk->test_pending = 0;
+
+	/* lost it meanwhile, or busy with something else */
+	if (tk->leader != local || tk_hot(tk)->state != ST_LEADER ||
+			tk_hot(tk)->acks_expected)
+		return;
+
+	if (rv)
+		ext_prog_failed(tk, 1);
+	else
+		ticket_broadcast(tk, OP_HEARTBEAT, OP_ACK, RLT_SUCCESS, 0);
+}
+
+/* On ticket renewal, check locally first. */
+static void renew_ticket(struct ticket_config *tk)
+{
+	if (tk->test_pending)
+		return;
+
+	tk->test_pending = 1;
+	if (run_handler(tk, tk->ext_verifier, renewal_test_done, 0) < 0)
+		tk->test_pending = 0;
 }
 
 
@@ -231,7 +374,7 @@ static void start_revoke_ticket(struct ticket_config *tk)
  * Only to be started from the leader. */
 int do_revoke_ticket(struct ticket_config *tk)
 {
-	if (tk->acks_expected) {
+	if (tk_hot(tk)->acks_expected) {
 		tk_log_info("delay ticket revoke until the current operation finishes");
 		tk->next_state = ST_INIT;
 		return RLT_MORE;
@@ -242,6 +385,52 @@ int do_revoke_ticket(struct ticket_config *tk)
 }
 
 
+/** Hand the ticket over to another site.
+ * Only to be started from the leader. The ticket is revoked here
+ * first, then the target takes over with the next term; should it
+ * refuse, the ticket is taken back (see process_REJECTED()). */
+int do_move_ticket(struct ticket_config *tk, struct booth_site *target)
+{
+	if (target == local)
+		return RLT_SUCCESS;
+
+	if (tk_hot(tk)->state != ST_LEADER || tk->next_state) {
+		tk_log_info("cannot move ticket in state %s",
+				state_to_string(tk_hot(tk)->state));
+		return RLT_BUSY;
+	}
+
+	if (!(target->caps & CAP_HANDOVER)) {
+		tk_log_warn("%s runs a booth version without handover",
+				site_string(target));
+		return RLT_INVALID_ARG;
+	}
+
+	if (!(tk->acquire_ok & target->bitmask)) {
+		tk_log_warn("%s cannot take over the ticket",
+				site_string(target));
+		return RLT_EXT_FAILED;
+	}
+
+	tk_log_info("handing the ticket over to %s", site_string(target));
+
+	tk->leader = target;
+	tk_hot(tk)->state = ST_FOLLOWER;
+	tk->current_term++;
+	tk_hot(tk)->term_expires = get_secs(NULL) + tk->term_duration;
+	tk->delay_commit = 0;
+	tk->successor = NULL;
+
+	/* The target takes over as soon as it hears from us, so it
+	 * is told only once the ticket is revoked here, see
+	 * ticket_write_done(); no replies until then. */
+	tk->last_request = OP_HANDOVER;
+	no_resends(tk);
+	ticket_write(tk);
+	return RLT_MORE;
+}
+
+
 int list_ticket(char **pdata, unsigned int *len)
 {
 	struct ticket_config *tk;
@@ -262,8 +451,8 @@ int list_ticket(char **pdata, unsigned int *len)
 
 	cp = data;
 	foreach_ticket(i, tk) {
-		if (tk->term_expires != 0) {
-			ts = wall_ts(tk->term_expires);
+		if (tk_hot(tk)->term_expires != 0) {
+			ts = wall_ts(tk_hot(tk)->term_expires);
 			strftime(timeout_str, sizeof(timeout_str), "%F %T",
 					localtime(&ts));
 		} else
@@ -308,7 +497,7 @@ int list_ticket(char **pdata, unsigned int *len)
 void reset_ticket(struct ticket_config *tk)
 {
 	disown_ticket(tk);
-	tk->state = ST_INIT;
+	tk_hot(tk)->state = ST_INIT;
 	tk->voted_for = NULL;
 }
 
@@ -319,7 +508,7 @@ static void reacquire_ticket(struct ticket_config *tk)
 	const char *where_granted = "\0";
 	char buff[64];
 
-	valid = (tk->term_expires >= get_secs(NULL));
+	valid = (tk_hot(tk)->term_expires >= get_secs(NULL));
 
 	if (tk->leader == local) {
 		where_granted = "granted here";
@@ -352,7 +541,7 @@ static void reacquire_ticket(struct ticket_config *tk)
 
 void update_ticket_state(struct ticket_config *tk, struct booth_site *sender)
 {
-	if (tk->state == ST_CANDIDATE) {
+	if (tk_hot(tk)->state == ST_CANDIDATE) {
 		tk_log_info("learned from %s about "
 				"newer ticket, stopping elections",
 				site_string(sender));
@@ -374,11 +563,11 @@ void update_ticket_state(struct ticket_config *tk, struct booth_site *sender)
 			}
 			disown_ticket(tk);
 			ticket_write(tk);
-			tk->state = ST_FOLLOWER;
+			tk_hot(tk)->state = ST_FOLLOWER;
 			tk->next_state = ST_FOLLOWER;
 		} else {
-			if (tk->state == ST_CANDIDATE) {
-				tk->state = ST_FOLLOWER;
+			if (tk_hot(tk)->state == ST_CANDIDATE) {
+				tk_hot(tk)->state = ST_FOLLOWER;
 			}
 			tk->next_state = ST_LEADER;
 		}
@@ -388,7 +577,7 @@ void update_ticket_state(struct ticket_config *tk, struct booth_site *sender)
 				tk_log_info("ticket is not granted");
 			else
 				tk_log_info("ticket is not granted (from CIB)");
-			tk->state = ST_INIT;
+			tk_hot(tk)->state = ST_INIT;
 		} else {
 			if (sender)
 				tk_log_info("ticket granted to %s (says %s)",
@@ -397,35 +586,207 @@ void update_ticket_state(struct ticket_config *tk, struct booth_site *sender)
 			else
 				tk_log_info("ticket granted to %s (from CIB)",
 					site_string(tk->leader));
-			tk->state = ST_FOLLOWER;
+			tk_hot(tk)->state = ST_FOLLOWER;
 			/* just make sure that we check the ticket soon */
 			tk->next_state = ST_FOLLOWER;
 		}
 	}
 }
 
+/* Sites which sent us the state of all tickets at startup. */
+static uint64_t bulk_replied;
+
+/* Find out what we know about the ticket locally, then wait
+ * for the status from the others. */
+static void init_ticket_state(struct ticket_config *tk)
+{
+	int loaded;
+
+	reset_ticket(tk);
+
+	loaded = 0;
+	if (local->type == SITE) {
+		loaded = !pcmk_handler.load_ticket(tk);
+		tk->update_cib = 1;
+	}
+	if (!journal_restore(tk))
+		loaded = 1;
+	if (!snapshot_restore(tk))
+		loaded = 1;
+	if (loaded)
+		update_ticket_state(tk, NULL);
+
+	/* wait until the majority sent their status (or the
+	 * first timeout) */
+	tk->start_postpone = 1;
+	tk->last_request = OP_STATUS;
+	expect_replies(tk, OP_MY_INDEX);
+	ticket_activate_timeout(tk);
+}
+
 int setup_ticket(void)
 {
 	struct ticket_config *tk;
+	struct boothc_compact_msg req;
 	int i;
 
+	catalog_load();
+	snapshot_open();
+	journal_open();
+
 	foreach_ticket(i, tk) {
-		reset_ticket(tk);
+		init_ticket_state(tk);
+	}
 
-		if (local->type == SITE) {
-			if (!pcmk_handler.load_ticket(tk)) {
-				update_ticket_state(tk, NULL);
-			}
-			tk->update_cib = 1;
+	log_info("broadcasting state query");
+	bulk_replied = local->bitmask;
+	/* the answers come by ticket ID, if possible */
+	init_header(&req.header, OP_BULK_STATUS, 0, 0, RLT_SUCCESS, 0, sizeof(req));
+	req.ticket_ids = htonl(booth_conf->ticket_ids);
+	return transport()->broadcast(&req, sizeof(req));
+}
+
+
+static int same_sites(struct booth_config *conf)
+{
+	struct booth_site *a, *b;
+	int i;
+
+	if (conf->site_count != booth_conf->site_count)
+		return 0;
+
+	for (i = 0; i < conf->site_count; i++) {
+		a = booth_conf->site + i;
+		b = conf->site + i;
+		if (a->type != b->type || a->site_id != b->site_id ||
+				strcmp(a->addr_string, b->addr_string) ||
+				a->alt_count != b->alt_count ||
+				memcmp(a->alt, b->alt, sizeof(a->alt)))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Keep the runtime state of 'old', take the configuration
+ * from 'tk'. */
+static void merge_ticket(struct ticket_config *tk,
+		struct ticket_config *old)
+{
+	struct ticket_config cfg;
+
+	cfg = *tk;
+	free(old->ext_verifier);
+	*tk = *old;
+
+	tk->timeout = cfg.timeout;
+	tk->term_duration = cfg.term_duration;
+	tk->retries = cfg.retries;
+	tk->acquire_after = cfg.acquire_after;
+	tk->renewal_freq = cfg.renewal_freq;
+	tk->ext_verifier = cfg.ext_verifier;
+	tk->election_delay = cfg.election_delay;
+	memcpy(tk->weight, cfg.weight, sizeof(tk->weight));
+}
+
+/* Ticket is not configured anymore. */
+static void release_ticket(struct ticket_config *tk)
+{
+	tk_log_info("removed from the configuration");
+	notify_client(tk, RLT_INVALID_ARG);
+	if (tk->leader == local || tk->is_granted) {
+		tk_log_warn("was granted here, revoking");
+		disown_ticket(tk);
+		ticket_write(tk);
+	}
+	free_ticket(tk);
+}
+
+/** Switch to a newly read (or, see catalog.c, changed) configuration.
+ * The sites must stay the same. Tickets that are still
+ * configured keep their state, new ones start like on startup,
+ * removed ones are revoked here. Takes ownership of 'conf'. */
+int apply_config(struct booth_config *conf)
+{
+	struct ticket_config *tk, *old;
+	char *keep;
+	int i, added;
+
+	if (!same_sites(conf)) {
+		log_error("sites or arbitrators changed, "
+				"restart needed (keeping the old configuration)");
+		free_config(conf);
+		return -EINVAL;
+	}
+
+	if (conf->proto != booth_conf->proto ||
+			conf->port != booth_conf->port ||
+			strcmp(conf->name, booth_conf->name) ||
+			strcmp(conf->authfile, booth_conf->authfile) ||
+			memcmp(&conf->mcast6, &booth_conf->mcast6,
+				sizeof(conf->mcast6)) ||
+			conf->mcast_ttl != booth_conf->mcast_ttl)
+		log_warn("changes of transport, port, name, authfile, "
+				"or multicast need a restart (ignored)");
+
+	keep = calloc(booth_conf->ticket_count, 1);
+	if (!keep) {
+		log_error("out of memory");
+		free_config(conf);
+		return -ENOMEM;
+	}
+
+	added = 0;
+	for (i = 0; i < conf->ticket_count; i++) {
+		tk = conf->ticket + i;
+		if (find_ticket_by_name(tk->name, &old)) {
+			merge_ticket(tk, old);
+			conf->next_cron[i] = *tk_next_cron(old);
+			conf->hot[i] = *tk_hot(old);
+			keep[old - booth_conf->ticket] = 1;
+		} else {
+			/* mark as new */
+			conf->hot[i].state = 0;
+			added++;
 		}
+	}
 
-		tk_log_info("broadcasting state query");
-		/* wait until all send their status (or the first
-		 * timeout) */
-		tk->start_postpone = 1;
-		ticket_broadcast(tk, OP_STATUS, OP_MY_INDEX, RLT_SUCCESS, 0);
+	foreach_ticket(i, tk) {
+		if (!keep[i])
+			release_ticket(tk);
 	}
+	free(keep);
+
+	free(booth_conf->ticket);
+	free(booth_conf->next_cron);
+	free(booth_conf->hot);
+	booth_conf->ticket = conf->ticket;
+	booth_conf->next_cron = conf->next_cron;
+	booth_conf->hot = conf->hot;
+	booth_conf->ticket_count = conf->ticket_count;
+	booth_conf->ticket_allocated = conf->ticket_allocated;
+	booth_conf->ticket_ids = conf->ticket_ids;
+	free(booth_conf->defaults.ext_verifier);
+	booth_conf->defaults = conf->defaults;
+	free(conf);
+
+	/* ticket indices may have changed */
+	journal_open();
+	snapshot_open();
 
+	foreach_ticket(i, tk) {
+		if (!tk_hot(tk)->state) {
+			tk_log_info("added to the configuration");
+			init_ticket_state(tk);
+			ticket_broadcast(tk, OP_STATUS, OP_MY_INDEX,
+					RLT_SUCCESS, 0);
+		}
+		journal_note(tk);
+		snapshot_update(tk);
+	}
+
+	log_info("configuration applied, %d tickets (%d new)",
+			booth_conf->ticket_count, added);
 	return 0;
 }
 
@@ -450,6 +811,7 @@ int process_client_request(struct client *req_client, struct boothc_ticket_msg *
 {
 	int rv;
 	struct ticket_config *tk;
+	struct booth_site *target = NULL;
 	int cmd;
 
 	cmd = ntohl(msg->header.cmd);
@@ -467,14 +829,24 @@ int process_client_request(struct client *req_client, struct boothc_ticket_msg *
 		goto reply;
 	}
 
-	if ((cmd == CMD_REVOKE) && !is_owned(tk)) {
-		log_info("client wants to revoke a free ticket %s",
+	if ((cmd == CMD_REVOKE || cmd == CMD_MOVE) && !is_owned(tk)) {
+		log_info("client wants to %s a free ticket %s",
+				cmd == CMD_REVOKE ? "revoke" : "move",
 				msg->ticket.id);
 		rv = RLT_TICKET_IDLE;
 		goto reply;
 	}
 
-	if ((cmd == CMD_REVOKE) && tk->leader != local) {
+	if (cmd == CMD_MOVE &&
+			(!find_site_by_id(ntohl(msg->ticket.leader), &target) ||
+			 target->type != SITE)) {
+		log_warn("client wants to move ticket %s to an unknown site",
+				msg->ticket.id);
+		rv = RLT_INVALID_ARG;
+		goto reply;
+	}
+
+	if ((cmd == CMD_REVOKE || cmd == CMD_MOVE) && tk->leader != local) {
 		log_info("the ticket %s is not granted here, "
 				"redirect to %s",
 				msg->ticket.id, ticket_leader_string(tk));
@@ -484,6 +856,8 @@ int process_client_request(struct client *req_client, struct boothc_ticket_msg *
 
 	if (cmd == CMD_REVOKE)
 		rv = do_revoke_ticket(tk);
+	else if (cmd == CMD_MOVE)
+		rv = do_move_ticket(tk, target);
 	else
 		rv = do_grant_ticket(tk, ntohl(msg->header.options));
 
@@ -491,6 +865,8 @@ int process_client_request(struct client *req_client, struct boothc_ticket_msg *
 		/* client may receive further notifications */
 		tk->req_client = req_client;
 	}
+	journal_note(tk);
+	snapshot_update(tk);
 
 reply:
 	init_ticket_msg(msg, CL_RESULT, 0, rv, 0, tk);
@@ -547,6 +923,29 @@ int ticket_broadcast(struct ticket_config *tk,
    send out the update message to others with the new expiry
    time
 */
+/* Choose the site to take over if we go away: among the sites
+ * which acked and said they could acquire the ticket, the one
+ * with the highest weight. */
+static void pick_successor(struct ticket_config *tk)
+{
+	struct booth_site *n, *best = NULL;
+	int i;
+
+	foreach_node(i, n) {
+		if (n == local || n->type != SITE ||
+				!(tk_hot(tk)->acks_received & n->bitmask) ||
+				!(tk->acquire_ok & n->bitmask))
+			continue;
+		if (!best || site_preferred(tk, n, best))
+			best = n;
+	}
+
+	if (best != tk->successor)
+		tk_log_info("successor is now %s", site_string(best));
+	tk->successor = best;
+}
+
+
 int leader_update_ticket(struct ticket_config *tk)
 {
 	int rv = 0, rv2;
@@ -558,7 +957,8 @@ int leader_update_ticket(struct ticket_config *tk)
 	if (tk->ticket_updated < 1) {
 		tk->ticket_updated = 1;
 		tk->last_renewal = now;
-		tk->term_expires = now + tk->term_duration;
+		tk_hot(tk)->term_expires = now + tk->term_duration;
+		pick_successor(tk);
 		rv = ticket_broadcast(tk, OP_UPDATE, OP_ACK, RLT_SUCCESS, 0);
 	}
 
@@ -566,8 +966,8 @@ int leader_update_ticket(struct ticket_config *tk)
 		rv2 = ticket_write(tk);
 		switch(rv2) {
 		case 0:
+			/* queued; the client hears from ticket_write_done() */
 			tk->ticket_updated = 2;
-			notify_client(tk, RLT_SUCCESS);
 			break;
 		case 1:
 			tk_log_info("delaying ticket commit to CIB for %ds "
@@ -597,7 +997,7 @@ static void log_lost_servers(struct ticket_config *tk)
 
 	for (i = 0; i < booth_conf->site_count; i++) {
 		n = booth_conf->site + i;
-		if (!(tk->acks_received & n->bitmask)) {
+		if (!(tk_hot(tk)->acks_received & n->bitmask)) {
 			tk_log_warn("%s %s didn't acknowledge our %s, "
 			"will retry %d times",
 			(n->type == ARBITRATOR ? "arbitrator" : "site"),
@@ -613,12 +1013,12 @@ static void resend_msg(struct ticket_config *tk)
 	struct booth_site *n;
 	int i;
 
-	if (!(tk->acks_received ^ local->bitmask)) {
+	if (!(tk_hot(tk)->acks_received ^ local->bitmask)) {
 		ticket_broadcast(tk, tk->last_request, 0, RLT_SUCCESS, 0);
 	} else {
 		for (i = 0; i < booth_conf->site_count; i++) {
 			n = booth_conf->site + i;
-			if (!(tk->acks_received & n->bitmask)) {
+			if (!(tk_hot(tk)->acks_received & n->bitmask)) {
 				tk_log_debug("resending %s to %s",
 						state_to_string(tk->last_request),
 						site_string(n)
@@ -636,6 +1036,12 @@ static void handle_resends(struct ticket_config *tk)
 
 	if (++tk->retry_number > tk->retries) {
 		tk_log_debug("giving up on sending retries");
+		if (tk->last_request == OP_HANDOVER) {
+			tk_log_warn("%s did not confirm the handover",
+					site_string(tk->leader));
+			notify_client(tk, RLT_SYNC_FAIL);
+			tk->last_request = 0;
+		}
 		no_resends(tk);
 		set_ticket_wakeup(tk);
 		return;
@@ -649,8 +1055,8 @@ static void handle_resends(struct ticket_config *tk)
 		goto just_resend;
 	}
 
-	if (!majority_of_bits(tk, tk->acks_received)) {
-		ack_cnt = count_bits(tk->acks_received) - 1;
+	if (!majority_of_bits(tk, tk_hot(tk)->acks_received)) {
+		ack_cnt = count_bits(tk_hot(tk)->acks_received) - 1;
 		if (!ack_cnt) {
 			tk_log_warn("no answers to our request (try #%d), "
 			"we are alone",
@@ -701,33 +1107,57 @@ static void process_next_state(struct ticket_config *tk)
 
 static void ticket_lost(struct ticket_config *tk)
 {
+	struct booth_site *successor;
+	timetype delay, tv;
+
 	if (tk->leader != local) {
 		tk_log_warn("lost at %s", site_string(tk->leader));
 	} else {
 		tk_log_warn("lost majority (revoking locally)");
 	}
 
+	successor = tk->successor;
+	tk->successor = NULL;
 	tk->lost_leader = tk->leader;
 	reset_ticket(tk);
-	tk->state = ST_FOLLOWER;
-	if (local->type == SITE) {
-		ticket_write(tk);
-		schedule_election(tk, OR_TKT_LOST);
+	tk_hot(tk)->state = ST_FOLLOWER;
+	if (local->type != SITE)
+		return;
+
+	ticket_write(tk);
+	if (successor == local) {
+		tk_log_info("taking over as the designated successor");
+		if (!acquire_ticket(tk, OR_SUCCESSOR))
+			return;
+	}
+
+	schedule_election(tk, OR_TKT_LOST);
+	if (successor && successor != local) {
+		/* give the successor a head start */
+		set_time_ms(delay, tk->timeout * 1000);
+		time_add(tk_next_cron(tk), &delay, &tv);
+		ticket_next_cron_at(tk, tv);
 	}
 }
 
 static void next_action(struct ticket_config *tk)
 {
-	switch(tk->state) {
+	switch(tk_hot(tk)->state) {
 	case ST_INIT:
 		/* init state, handle resends for ticket revoke */
 		/* and rebroadcast if stepping down */
-		if (tk->acks_expected) {
+		if (tk_hot(tk)->acks_expected) {
 			handle_resends(tk);
 		}
 		break;
 
 	case ST_FOLLOWER:
+		/* handed the ticket over, but no answer yet */
+		if (tk_hot(tk)->acks_expected && tk->last_request == OP_HANDOVER) {
+			handle_resends(tk);
+			break;
+		}
+
 		/* leader/ticket lost? and we didn't vote yet */
 		tk_log_debug("leader: %s, voted_for: %s",
 				site_string(tk->leader),
@@ -754,13 +1184,11 @@ static void next_action(struct ticket_config *tk)
 
 	case ST_LEADER:
 		/* timeout or ticket renewal? */
-		if (tk->acks_expected) {
+		if (tk_hot(tk)->acks_expected) {
 			handle_resends(tk);
 		} else {
 			/* this is ticket renewal, run local test */
-			if (!test_external_prog(tk, 1)) {
-				ticket_broadcast(tk, OP_HEARTBEAT, OP_ACK, RLT_SUCCESS, 0);
-			}
+			renew_ticket(tk);
 		}
 		break;
 
@@ -784,7 +1212,7 @@ static void ticket_cron(struct ticket_config *tk)
 
 	/* no need for status resends, we hope we got at least one
 	 * my_index back */
-	if (tk->acks_expected == OP_MY_INDEX) {
+	if (tk_hot(tk)->acks_expected == OP_MY_INDEX) {
 		no_resends(tk);
 	}
 
@@ -801,9 +1229,9 @@ static void ticket_cron(struct ticket_config *tk)
 	 * Losing the ticket must happen in _every_ state. */
 	now = get_secs(NULL);
 	if (!tk->in_election &&
-			tk->term_expires &&
+			tk_hot(tk)->term_expires &&
 			is_owned(tk) &&
-			now >= tk->term_expires) {
+			now >= tk_hot(tk)->term_expires) {
 		ticket_lost(tk);
 		goto out;
 	}
@@ -825,19 +1253,24 @@ void process_tickets(void)
 
 	get_time(&now);
 
-	foreach_ticket(i, tk) {
-		if (time_cmp(&tk->next_cron, &now, >))
+	for (i = 0; i < booth_conf->ticket_count; i++) {
+		tk = booth_conf->ticket + i;
+		refresh_verdict(tk);
+
+		if (time_cmp(booth_conf->next_cron + i, &now, >))
 			continue;
 
 		tk_log_debug("ticket cron");
 
 
-		last_cron = tk->next_cron;
+		last_cron = booth_conf->next_cron[i];
 		ticket_cron(tk);
-		if (!time_cmp(&last_cron, &tk->next_cron, !=)) {
+		if (!time_cmp(&last_cron, booth_conf->next_cron + i, !=)) {
 			tk_log_debug("nobody set ticket wakeup");
 			set_ticket_wakeup(tk);
 		}
+		journal_note(tk);
+		snapshot_update(tk);
 	}
 }
 
@@ -850,12 +1283,12 @@ void tickets_log_info(void)
 	time_t ts;
 
 	foreach_ticket(i, tk) {
-		ts = wall_ts(tk->term_expires);
+		ts = wall_ts(tk_hot(tk)->term_expires);
 		tk_log_info("state '%s' "
 				"term %d "
 				"leader %s "
 				"expires %-24.24s",
-				state_to_string(tk->state),
+				state_to_string(tk_hot(tk)->state),
 				tk->current_term,
 				ticket_leader_string(tk),
 				ctime(&ts));
@@ -863,6 +1296,27 @@ void tickets_log_info(void)
 }
 
 
+/* Measure the round-trip time to a site; only answers to the
+ * first transmission are used, as resends would skew the value. */
+static void update_rtt(struct ticket_config *tk, struct booth_site *sender)
+{
+	timetype now, res;
+	int sample;
+
+	if (tk->retry_number || !tk->req_sent_at.tv_sec)
+		return;
+
+	get_time(&now);
+	time_sub(&now, &tk->req_sent_at, &res);
+	sample = time_to_ms(res);
+	if (sample < 0)
+		return;
+
+	sender->rtt_ms = sender->rtt_ms ?
+		(7 * sender->rtt_ms + sample) / 8 :
+		max(sample, 1);
+}
+
 static void update_acks(
 		struct ticket_config *tk,
 		struct booth_site *sender,
@@ -876,17 +1330,19 @@ static void update_acks(
 	cmd = ntohl(msg->header.cmd);
 	req = ntohl(msg->header.request);
 	if (req != tk->last_request ||
-			(tk->acks_expected != cmd &&
-			tk->acks_expected != OP_REJECTED))
+			(tk_hot(tk)->acks_expected != cmd &&
+			tk_hot(tk)->acks_expected != OP_REJECTED))
 		return;
 
 	/* got an ack! */
-	tk->acks_received |= sender->bitmask;
+	if (!(tk_hot(tk)->acks_received & sender->bitmask))
+		update_rtt(tk, sender);
+	tk_hot(tk)->acks_received |= sender->bitmask;
 
 	if (cmd == OP_HEARTBEAT)
 	tk_log_debug("got ACK from %s, %d/%d agree.",
 			site_string(sender),
-			count_bits(tk->acks_received),
+			count_bits(tk_hot(tk)->acks_received),
 			booth_conf->site_count);
 
 	if (tk->delay_commit && all_sites_replied(tk)) {
@@ -903,18 +1359,274 @@ static void update_acks(
 	}
 }
 
+static int send_bulk_chunk(struct booth_site *dest,
+		struct boothc_bulk_msg *bmsg, int cnt, cmd_result_t res)
+{
+	int len;
+
+	len = sizeof(bmsg->header) + cnt * sizeof(bmsg->ticket[0]);
+	init_header(&bmsg->header, OP_BULK_INDEX, OP_BULK_STATUS, 0,
+			res, 0, len);
+	return transport()->send(dest, bmsg, len);
+}
+
+/** Sends the state of the tickets in one OP_BULK_COMPACT; there
+ * must be at most BOOTH_COMPACT_RECORDS(transport()->max_msg) of
+ * them, and 'dest' must have the same ticket IDs. */
+int send_compact_status(struct booth_site *dest, cmd_request_t request,
+		struct ticket_config **tks, int cnt, cmd_result_t res)
+{
+	char buf[FRAME_SIZE_MAX];
+	struct boothc_compact_msg *cmsg = (void *)buf;
+	struct compact_ticket_msg *rec;
+	struct boothc_ticket_msg msg;
+	int i, len;
+
+	assert(cnt <= BOOTH_COMPACT_RECORDS(transport()->max_msg));
+	for (i = 0; i < cnt; i++) {
+		init_status_msg(&msg, OP_MY_INDEX, OP_STATUS, tks[i]);
+		rec = cmsg->ticket + i;
+		rec->id = htonl(tks[i] - booth_conf->ticket);
+		rec->leader = msg.ticket.leader;
+		rec->term = msg.ticket.term;
+		rec->term_valid_for = msg.ticket.term_valid_for;
+		rec->successor = msg.ticket.successor;
+	}
+
+	len = sizeof(*cmsg) + cnt * sizeof(cmsg->ticket[0]);
+	init_header(&cmsg->header, OP_BULK_COMPACT, request, 0, res, 0, len);
+	cmsg->ticket_ids = htonl(booth_conf->ticket_ids);
+	return transport()->send(dest, cmsg, len);
+}
+
+static int answer_bulk_compact(struct booth_site *dest)
+{
+	struct ticket_config *tk, *tks[BOOTH_COMPACT_RECORDS(FRAME_SIZE_MAX)];
+	int i, cnt, max, rv;
+
+	max = BOOTH_COMPACT_RECORDS(transport()->max_msg);
+	cnt = 0;
+	foreach_ticket(i, tk) {
+		if (tk->in_election)
+			continue;
+		if (cnt == max) {
+			rv = send_compact_status(dest, OP_BULK_STATUS,
+					tks, cnt, RLT_MORE);
+			if (rv)
+				return rv;
+			cnt = 0;
+		}
+		tks[cnt++] = tk;
+	}
+
+	return send_compact_status(dest, OP_BULK_STATUS, tks, cnt, RLT_SUCCESS);
+}
+
+/* Send the state of all tickets at once. Tickets in elections
+ * are left out, just like we don't answer OP_STATUS for them.
+ * Sites with the same ticket IDs get the compact form. */
+static int answer_bulk_status(struct booth_site *dest,
+		struct boothc_compact_msg *req, int len)
+{
+	char buf[FRAME_SIZE_MAX];
+	struct boothc_bulk_msg *bmsg = (void *)buf;
+	struct boothc_ticket_msg msg;
+	struct ticket_config *tk;
+	int i, cnt, max, rv;
+
+	log_info("sending status of all tickets to %s",
+			site_string(dest));
+	if (len >= sizeof(*req) &&
+			ntohl(req->ticket_ids) == booth_conf->ticket_ids)
+		return answer_bulk_compact(dest);
+
+	max = BOOTH_BULK_RECORDS(transport()->max_msg);
+	cnt = 0;
+	foreach_ticket(i, tk) {
+		if (tk->in_election)
+			continue;
+		if (cnt == max) {
+			rv = send_bulk_chunk(dest, bmsg, cnt, RLT_MORE);
+			if (rv)
+				return rv;
+			cnt = 0;
+		}
+		init_status_msg(&msg, OP_MY_INDEX, OP_STATUS, tk);
+		bmsg->ticket[cnt++] = msg.ticket;
+	}
+
+	return send_bulk_chunk(dest, bmsg, cnt, RLT_SUCCESS);
+}
+
+/* With a majority of the sites heard from, we know about every
+ * granted ticket; no need to wait for the others. */
+static void bulk_status_done(struct booth_site *source)
+{
+	struct ticket_config *tk;
+	timetype now;
+	int i;
+
+	if (!bulk_replied)
+		return;
+
+	bulk_replied |= source->bitmask;
+	if (!majority_of_bits(NULL, bulk_replied))
+		return;
+
+	log_info("got the status of all tickets from the majority");
+	bulk_replied = 0;
+	get_time(&now);
+	foreach_ticket(i, tk) {
+		if (!tk->start_postpone)
+			continue;
+		tk->start_postpone = 0;
+		ticket_next_cron_at(tk, now);
+	}
+}
+
+static int handle_ticket_msg(struct booth_site *source,
+		struct ticket_config *tk, struct boothc_ticket_msg *msg)
+{
+	struct booth_site *leader;
+	uint32_t leader_u;
+	int rv;
+
+	leader_u = ntohl(msg->ticket.leader);
+	if (!find_site_by_id(leader_u, &leader)) {
+		tk_log_error("message with unknown leader %u received", leader_u);
+		return -EINVAL;
+	}
+
+	update_acks(tk, source, leader, msg);
+
+	rv = raft_answer(tk, source, leader, msg);
+	journal_note(tk);
+	snapshot_update(tk);
+	return rv;
+}
+
+static int process_ticket_msg(struct booth_site *source,
+		struct boothc_ticket_msg *msg)
+{
+	struct ticket_config *tk;
+
+	if (!check_ticket(msg->ticket.id, &tk)) {
+		log_warn("got invalid ticket name %s from %s",
+				msg->ticket.id, site_string(source));
+		return -EINVAL;
+	}
+
+	return handle_ticket_msg(source, tk, msg);
+}
+
+/* Each record is handled as if it came in its own OP_MY_INDEX. */
+static int process_bulk_index(struct booth_site *source,
+		struct boothc_bulk_msg *bmsg, int len)
+{
+	struct boothc_ticket_msg msg;
+	int i, cnt;
+
+	len -= sizeof(bmsg->header);
+	if (len % sizeof(bmsg->ticket[0])) {
+		log_error("bulk status from %s with bad length %d",
+				site_string(source), len);
+		return -EINVAL;
+	}
+
+	cnt = len / sizeof(bmsg->ticket[0]);
+	for (i = 0; i < cnt; i++) {
+		msg.header = bmsg->header;
+		msg.header.length = htonl(sizeof(msg));
+		msg.header.cmd = htonl(OP_MY_INDEX);
+		msg.header.request = htonl(OP_STATUS);
+		msg.header.result = htonl(RLT_SUCCESS);
+		msg.ticket = bmsg->ticket[i];
+		(void)process_ticket_msg(source, &msg);
+	}
+
+	if (ntohl(bmsg->header.result) != RLT_MORE)
+		bulk_status_done(source);
+	return 0;
+}
+
+/* The same by ticket ID; no name lookups needed. */
+static int process_bulk_compact(struct booth_site *source,
+		struct boothc_compact_msg *cmsg, int len)
+{
+	struct boothc_ticket_msg msg;
+	struct compact_ticket_msg *rec;
+	struct ticket_config *tk;
+	struct boothc_header req;
+	uint32_t id;
+	int i, cnt;
+
+	len -= sizeof(*cmsg);
+	if (len < 0 || len % sizeof(cmsg->ticket[0])) {
+		log_error("compact status from %s with bad length %d",
+				site_string(source), len);
+		return -EINVAL;
+	}
+
+	if (ntohl(cmsg->ticket_ids) != booth_conf->ticket_ids) {
+		/* the configuration changed in the meantime */
+		log_info("ticket IDs of %s differ, asking for the "
+				"status by name", site_string(source));
+		init_header(&req, OP_BULK_STATUS, 0, 0, RLT_SUCCESS, 0, sizeof(req));
+		return transport()->send(source, &req, sizeof(req));
+	}
+
+	cnt = len / sizeof(cmsg->ticket[0]);
+	for (i = 0; i < cnt; i++) {
+		rec = cmsg->ticket + i;
+		id = ntohl(rec->id);
+		if (id >= booth_conf->ticket_count) {
+			log_error("bad ticket ID %u from %s",
+					id, site_string(source));
+			return -EINVAL;
+		}
+		tk = booth_conf->ticket + id;
+
+		msg.header = cmsg->header;
+		msg.header.length = htonl(sizeof(msg));
+		msg.header.cmd = htonl(OP_MY_INDEX);
+		msg.header.request = htonl(OP_STATUS);
+		msg.header.result = htonl(RLT_SUCCESS);
+		memcpy(msg.ticket.id, tk->name, sizeof(msg.ticket.id));
+		msg.ticket.leader = rec->leader;
+		msg.ticket.term = rec->term;
+		msg.ticket.term_valid_for = rec->term_valid_for;
+		msg.ticket.successor = rec->successor;
+		(void)handle_ticket_msg(source, tk, &msg);
+	}
+
+	if (ntohl(cmsg->header.request) == OP_BULK_STATUS &&
+			ntohl(cmsg->header.result) != RLT_MORE)
+		bulk_status_done(source);
+	return 0;
+}
+
 /* UDP message receiver. */
+static void learn_caps(struct booth_site *source, uint32_t options)
+{
+	uint32_t caps;
+
+	caps = (options & CAP_VALID) ? (options & ~CAP_VALID) : 0;
+	if (caps == source->caps)
+		return;
+
+	log_info("%s speaks protocol capabilities %#x (was %#x)",
+			site_string(source), caps, source->caps);
+	source->caps = caps;
+}
+
 int message_recv(struct boothc_ticket_msg *msg, int msglen)
 {
 	uint32_t from;
 	struct booth_site *source;
-	struct ticket_config *tk;
-	struct booth_site *leader;
-	uint32_t leader_u;
+	time_t now;
 
 
-	if (check_boothc_header(&msg->header, sizeof(*msg)) < 0 ||
-			msglen != sizeof(*msg)) {
+	if (check_boothc_header(&msg->header, msglen) < 0) {
 		log_error("message receive error");
 		return -1;
 	}
@@ -925,22 +1637,56 @@ int message_recv(struct boothc_ticket_msg *msg, int msglen)
 		return -1;
 	}
 
-	if (!check_ticket(msg->ticket.id, &tk)) {
-		log_warn("got invalid ticket name %s from %s",
-				msg->ticket.id, site_string(source));
-		return -EINVAL;
+	learn_caps(source, ntohl(msg->header.options));
+	now = get_secs(NULL);
+	/* back after a while, it may have missed ticket changes */
+	if (source->last_recv && now - source->last_recv >
+			booth_conf->defaults.timeout *
+			(booth_conf->defaults.retries + 1))
+		catalog_resend(source);
+	source->last_recv = now;
+
+	switch (ntohl(msg->header.cmd)) {
+	case OP_DIGEST:
+		/* older sites don't send a catalog hash; there's room */
+		if (msglen == BOOTHC_DIGEST_V1_LEN) {
+			((struct boothc_digest_msg *)msg)->digest.catalog =
+				htonl(catalog_hash());
+			msglen = sizeof(struct boothc_digest_msg);
+		}
+		if (msglen != sizeof(struct boothc_digest_msg)) {
+			log_error("message receive error");
+			return -1;
+		}
+		return process_digest(source, (void *)msg);
+	case OP_BULK_STATUS:
+		return answer_bulk_status(source, (void *)msg, msglen);
+	case OP_BULK_COMPACT:
+		return process_bulk_compact(source, (void *)msg, msglen);
+	case OP_BULK_INDEX:
+		return process_bulk_index(source, (void *)msg, msglen);
+	case OP_ADD_TICKET:
+	case OP_DEL_TICKET:
+		return catalog_recv(source, (void *)msg, msglen);
 	}
 
+	/* The receive buffer has room for the missing successor. */
+	if (msglen == BOOTHC_CLASSIC_LEN) {
+		msg->ticket.successor = htonl(NO_ONE);
+		msglen = sizeof(*msg);
+	}
 
-	leader_u = ntohl(msg->ticket.leader);
-	if (!find_site_by_id(leader_u, &leader)) {
-		tk_log_error("message with unknown leader %u received", leader_u);
-		return -EINVAL;
+	if (msglen != sizeof(*msg)) {
+		log_error("message receive error");
+		return -1;
 	}
 
-	update_acks(tk, source, leader, msg);
+	if (ntohl(msg->header.cmd) == OP_ACK &&
+			(ntohl(msg->header.request) == OP_ADD_TICKET ||
+			 ntohl(msg->header.request) == OP_DEL_TICKET))
+		return catalog_ack(source, msg);
 
-	return raft_answer(tk, source, leader, msg);
+	return process_ticket_msg(source, msg);
 }
 
 
@@ -949,19 +1695,55 @@ static void log_next_wakeup(struct ticket_config *tk)
 	timetype now, res;
 
 	get_time(&now);
-	time_sub(&tk->next_cron, &now, &res);
+	time_sub(tk_next_cron(tk), &now, &res);
 	tk_log_debug("set ticket wakeup in %d.%03d",
 		(int)res.tv_sec, (int)msecs(res));
 }
 
+/* Ranked election start: wait one slot for each site that is
+ * preferred over us (see site_preferred()) and that we heard from
+ * within the ticket timeout; one that went quiet, likely the
+ * failed leader, doesn't hold us back. A slot must be long enough
+ * for the REQ_VOTE of the better site to reach us, so it follows
+ * the measured round-trip times. */
+static int weighted_delay_ms(struct ticket_config *tk)
+{
+	struct booth_site *site;
+	int i, rank, slot;
+	time_t now;
+
+	rank = 0;
+	slot = ELECTION_SLOT_MIN_MS;
+	now = get_secs(NULL);
+	foreach_node(i, site) {
+		if (site == local || site->type != SITE ||
+				!site->last_recv ||
+				now - site->last_recv > tk->timeout ||
+				!site_preferred(tk, site, local))
+			continue;
+		rank++;
+		slot = max(slot, 2 * site->rtt_ms);
+	}
+
+	tk_log_debug("election rank %d, slot %dms", rank, slot);
+	return rank * slot;
+}
+
 /* New vote round; §5.2 */
-/* delay the next election start for up to 1s */
+/* delay the next election start for up to 1s, or according to
+ * our rank if the ticket has "election-delay = weighted" */
 void add_random_delay(struct ticket_config *tk)
 {
 	timetype delay, tv;
+	int ms;
 
-	rand_time_ms(delay, 1000);
-	time_add(&tk->next_cron, &delay, &tv);
+	if (tk->election_delay == ELECTION_DELAY_WEIGHTED) {
+		ms = weighted_delay_ms(tk);
+		set_time_ms(delay, ms);
+	} else {
+		rand_time_ms(delay, 1000);
+	}
+	time_add(tk_next_cron(tk), &delay, &tv);
 	ticket_next_cron_at(tk, tv);
 	if (ANYDEBUG) {
 		log_next_wakeup(tk);
@@ -976,7 +1758,7 @@ void set_ticket_wakeup(struct ticket_config *tk)
 	ticket_next_cron_in(tk, 3600);
 	get_time(&now);
 
-	switch (tk->state) {
+	switch (tk_hot(tk)->state) {
 	case ST_LEADER:
 		assert(tk->leader == local);
 
@@ -1007,16 +1789,18 @@ void set_ticket_wakeup(struct ticket_config *tk)
 		if (is_owned(tk) &&
 				(local->type == SITE))
 			ticket_next_cron_at_coarse(tk,
-					tk->term_expires + tk->acquire_after);
+					tk_hot(tk)->term_expires + tk->acquire_after);
+		else if (tk->in_prevote)
+			ticket_next_cron_at_coarse(tk, tk->election_end);
 		break;
 
 	default:
-		tk_log_error("unknown ticket state: %d", tk->state);
+		tk_log_error("unknown ticket state: %d", tk_hot(tk)->state);
 	}
 
 	if (tk->next_state) {
 		/* we need to do something soon here */
-		if (!tk->acks_expected) {
+		if (!tk_hot(tk)->acks_expected) {
 			ticket_next_cron_at(tk, now);
 		} else {
 			ticket_activate_timeout(tk);
@@ -1035,7 +1819,7 @@ void schedule_election(struct ticket_config *tk, cmd_reason_t reason)
 		return;
 
 	tk->election_reason = reason;
-	get_time(&tk->next_cron);
+	get_time(tk_next_cron(tk));
 	/* introduce a short delay before starting election */
 	add_random_delay(tk);
 }
@@ -1073,7 +1857,7 @@ int send_reject(struct booth_site *dest, struct ticket_config *tk,
 	tk_log_debug("sending reject to %s",
 			site_string(dest));
 	init_ticket_msg(&msg, OP_REJECTED, req, code, 0, tk);
-	return booth_udp_send(dest, &msg, sizeof(msg));
+	return transport()->send(dest, &msg, sizeof(msg));
 }
 
 int send_msg (
@@ -1087,18 +1871,15 @@ int send_msg (
 	struct ticket_config *tk = current_tk;
 	struct boothc_ticket_msg msg;
 
+	if (in_msg)
+		req = ntohl(in_msg->header.cmd);
+
 	if (cmd == OP_MY_INDEX) {
-		if (current_tk->state == ST_CANDIDATE &&
-				current_tk->last_valid_tk->current_term) {
-			tk = current_tk->last_valid_tk;
-		}
 		tk_log_info("sending status to %s",
 				site_string(dest));
+		init_status_msg(&msg, cmd, req, tk);
+	} else {
+		init_ticket_msg(&msg, cmd, req, RLT_SUCCESS, 0, tk);
 	}
-
-	if (in_msg)
-		req = ntohl(in_msg->header.cmd);
-
-	init_ticket_msg(&msg, cmd, req, RLT_SUCCESS, 0, tk);
-	return booth_udp_send(dest, &msg, sizeof(msg));
+	return transport()->send(dest, &msg, sizeof(msg));
 }
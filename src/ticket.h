@@ -47,17 +47,19 @@ int message_recv(struct boothc_ticket_msg *msg, int msglen);
 void reset_ticket(struct ticket_config *tk);
 void update_ticket_state(struct ticket_config *tk, struct booth_site *sender);
 int setup_ticket(void);
+int apply_config(struct booth_config *conf);
 int check_max_len_valid(const char *s, int max);
 
 int do_grant_ticket(struct ticket_config *ticket, int options);
 int do_revoke_ticket(struct ticket_config *tk);
+int do_move_ticket(struct ticket_config *tk, struct booth_site *target);
 
 int find_ticket_by_name(const char *ticket, struct ticket_config **found);
 
 void set_ticket_wakeup(struct ticket_config *tk);
 int postpone_ticket_processing(struct ticket_config *tk);
 
-int test_external_prog(struct ticket_config *tk, int start_election);
+int acquire_verdict(struct ticket_config *tk);
 int acquire_ticket(struct ticket_config *tk, cmd_reason_t reason);
 
 int ticket_answer_list(int fd, struct boothc_ticket_msg *msg);
@@ -65,6 +67,8 @@ int process_client_request(struct client *req_client,
 	struct boothc_ticket_msg *msg);
 
 int ticket_write(struct ticket_config *tk);
+void ticket_write_done(struct ticket_config *tk, uint32_t term,
+		int grant, int rv);
 
 void process_tickets(void);
 void tickets_log_info(void);
@@ -73,6 +77,8 @@ int send_reject(struct booth_site *dest, struct ticket_config *tk,
 	cmd_result_t code, struct boothc_ticket_msg *in_msg);
 int send_msg (int cmd, struct ticket_config *tk,
 	struct booth_site *dest, struct boothc_ticket_msg *in_msg);
+int send_compact_status(struct booth_site *dest, cmd_request_t request,
+	struct ticket_config **tks, int cnt, cmd_result_t res);
 void notify_client(struct ticket_config *tk, int rv);
 int ticket_broadcast(struct ticket_config *tk, cmd_request_t cmd, cmd_request_t expected_reply, cmd_result_t res, cmd_reason_t reason);
 
@@ -80,15 +86,22 @@ int leader_update_ticket(struct ticket_config *tk);
 void add_random_delay(struct ticket_config *tk);
 void schedule_election(struct ticket_config *tk, cmd_reason_t reason);
 
+static inline timetype *tk_next_cron(struct ticket_config *tk)
+{
+	return booth_conf->next_cron + (tk - booth_conf->ticket);
+}
+
 static inline void ticket_next_cron_at(struct ticket_config *tk, timetype when)
 {
-	tk->next_cron = when;
+	*tk_next_cron(tk) = when;
 }
 
 static inline void ticket_next_cron_at_coarse(struct ticket_config *tk, time_t when)
 {
-	memset(&tk->next_cron, 0, sizeof(tk->next_cron));
-	tk->next_cron.tv_sec  = when;
+	timetype *next = tk_next_cron(tk);
+
+	memset(next, 0, sizeof(*next));
+	next->tv_sec  = when;
 }
 
 static inline void ticket_next_cron_in(struct ticket_config *tk, time_t seconds)
@@ -48,6 +48,12 @@ time_t unwall_ts(time_t t);
 
 #define msecs(tv) ((tv).tv_nsec/1000000)
 
+/* set tv to t milliseconds */
+#define set_time_ms(tv, t) do { \
+	tv.tv_sec = (t) / 1000; \
+	tv.tv_nsec = ((t) % 1000) * 1000000; \
+	} while(0)
+
 /* random time from 0 to t milliseconds */
 #define rand_time_ms(tv, t) do { \
 	tv.tv_sec = 0; \
@@ -65,6 +71,12 @@ typedef struct timeval timetype;
 
 #define msecs(tv) ((tv).tv_usec/1000)
 
+/* set tv to t milliseconds */
+#define set_time_ms(tv, t) do { \
+	tv.tv_sec = (t) / 1000; \
+	tv.tv_usec = ((t) % 1000) * 1000; \
+	} while(0)
+
 /* random time from 0 to t milliseconds */
 #define rand_time_ms(tv, t) do { \
 	tv.tv_sec = 0; \
@@ -76,4 +88,6 @@ typedef struct timeval timetype;
 
 #endif
 
+#define time_to_ms(tv) ((tv).tv_sec * 1000 + msecs(tv))
+
 #endif
@@ -17,9 +17,12 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <net/if.h>
+#include <ifaddrs.h>
 #include <asm/types.h>
 #include <linux/rtnetlink.h>
 #include <arpa/inet.h>
@@ -30,18 +33,26 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <poll.h>
+#include <zlib.h>
+#include "b_config.h"
+#ifdef HAVE_LINUX_SCTP_H
+#include <linux/sctp.h>
+#endif
 #include "booth.h"
 #include "inline-fn.h"
 #include "log.h"
 #include "config.h"
 #include "ticket.h"
 #include "transport.h"
+#include "journal.h"
+#include "auth.h"
+#include "uring.h"
 
 #define BOOTH_IPADDR_LEN	(sizeof(struct in6_addr))
 
 #define NETLINK_BUFSIZE		16384
 #define SOCKET_BUFFER_SIZE	160000
-#define FRAME_SIZE_MAX		10000
+#define UDP_DRAIN_MAX		64
 
 
 
@@ -148,6 +159,7 @@ int _find_myself(int family, struct booth_site **mep, int fuzzy_allowed)
 		struct rtgenmsg g;
 	} req;
 	int address_bits_matched;
+	enum match_type did_match;
 
 
 	if (local)
@@ -156,6 +168,7 @@ int _find_myself(int family, struct booth_site **mep, int fuzzy_allowed)
 
 	me = NULL;
 	address_bits_matched = 0;
+	did_match = NO_MATCH;
 	if (mep)
 		*mep = NULL;
 	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
@@ -232,9 +245,12 @@ int _find_myself(int family, struct booth_site **mep, int fuzzy_allowed)
 							BOOTH_IPADDR_LEN);
 				}
 
-				/* First try with exact addresses, then optionally with subnet matching. */
-				if (ifa->ifa_prefixlen > address_bits_matched)
-					find_address(ipaddr,
+				/* First try with exact addresses, then optionally with subnet matching.
+				 * Prefix lengths of IPv4 and IPv6 can't be compared, so
+				 * an exact match ends it. */
+				if (did_match != EXACT_MATCH &&
+						ifa->ifa_prefixlen > address_bits_matched)
+					did_match = find_address(ipaddr,
 							ifa->ifa_family, ifa->ifa_prefixlen,
 							fuzzy_allowed, &me, &address_bits_matched);
 			}
@@ -255,10 +271,131 @@ found:
 	return 1;
 }
 
+/* One dump for both families; an exact match wins over prefix
+ * matches in either. */
 int find_myself(struct booth_site **mep, int fuzzy_allowed)
 {
-	return _find_myself(AF_INET6, mep, fuzzy_allowed) ||
-		_find_myself(AF_INET, mep, fuzzy_allowed);
+	return _find_myself(AF_UNSPEC, mep, fuzzy_allowed);
+}
+
+
+static const char *path_string(struct sockaddr *addr);
+static int site_paths(struct booth_site *site);
+static struct sockaddr *site_path_addr(struct booth_site *site, int path);
+
+/* Which of our addresses are up; a bit per path. Only known
+ * with addr_watch_init(), until then they count as up. */
+static int addr_watch_fd = -1;
+static uint32_t local_addrs_up;
+
+/* So that we can bind to an address which isn't up yet. */
+static void set_freebind(int fd)
+{
+	int one = 1;
+
+	if (setsockopt(fd, IPPROTO_IP, IP_FREEBIND, &one, sizeof(one)) == -1)
+		log_warn("failed to set the IP_FREEBIND option: %s",
+				strerror(errno));
+}
+
+/* With the address gone, it may be up on another node of the
+ * cluster, with the site's boothd there; so we stay quiet. */
+int local_addr_up(void)
+{
+	return addr_watch_fd < 0 || local_addrs_up;
+}
+
+/* Whether an address is ours is up to the routing (think of
+ * 127.0.0.2), so binding to it is the test. */
+static int addr_is_local(struct sockaddr *addr)
+{
+	struct sockaddr_in6 sa;
+	int fd, rv;
+
+	fd = socket(local->family, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return 1;
+
+	memcpy(&sa, addr, local->saddrlen);
+	sa.sin6_port = 0;	/* same place in sockaddr_in */
+	rv = bind(fd, (struct sockaddr *)&sa, local->saddrlen) == 0 ||
+		errno != EADDRNOTAVAIL;
+	close(fd);
+	return rv;
+}
+
+static void addr_check(void)
+{
+	struct sockaddr *addr;
+	uint32_t was;
+	int i;
+
+	was = local_addrs_up;
+	for (i = 0; i < site_paths(local); i++) {
+		addr = site_path_addr(local, i);
+		if (addr_is_local(addr)) {
+			local_addrs_up |= 1 << i;
+			if (!(was & (1 << i)))
+				log_info("address %s is up", path_string(addr));
+		} else {
+			local_addrs_up &= ~(1 << i);
+			if (was & (1 << i))
+				log_warn("address %s is gone", path_string(addr));
+		}
+	}
+
+	if (was && !local_addrs_up)
+		log_warn("none of our addresses is up, not sending");
+}
+
+static void process_addr_watch(int ci)
+{
+	static char buf[NETLINK_BUFSIZE];
+	struct nlmsghdr *h;
+	int rv, changed;
+
+	changed = 0;
+	while ((rv = recv(clients[ci].fd, buf, sizeof(buf),
+					MSG_DONTWAIT)) > 0) {
+		for (h = (void *)buf; NLMSG_OK(h, rv); h = NLMSG_NEXT(h, rv))
+			if (h->nlmsg_type == RTM_NEWADDR ||
+					h->nlmsg_type == RTM_DELADDR)
+				changed = 1;
+	}
+
+	/* ENOBUFS: events were lost */
+	if (changed || (rv < 0 && errno == ENOBUFS))
+		addr_check();
+}
+
+/* Replaces looking the addresses up only once, at startup: the
+ * service IP may come up after boothd, or move to another node. */
+int addr_watch_init(void)
+{
+	struct sockaddr_nl nladdr;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+	if (fd < 0) {
+		log_error("failed to create netlink socket");
+		return -1;
+	}
+
+	memset(&nladdr, 0, sizeof(nladdr));
+	nladdr.nl_family = AF_NETLINK;
+	nladdr.nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+	if (bind(fd, (struct sockaddr *)&nladdr, sizeof(nladdr)) < 0) {
+		log_error("failed to bind netlink socket: %s", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	addr_watch_fd = fd;
+	addr_check();
+	if (!local_addrs_up)
+		log_warn("none of our addresses is up yet, not sending");
+	client_add(fd, transport(), process_addr_watch, NULL);
+	return 0;
 }
 
 
@@ -274,7 +411,7 @@ int check_boothc_header(struct boothc_header *h, int len_incl_data)
 		log_error("magic error %x", ntohl(h->magic));
 		return -EINVAL;
 	}
-	if (h->version != htonl(BOOTHC_VERSION)) {
+	if (BOOTHC_MAJOR(ntohl(h->version)) != BOOTHC_MAJOR(BOOTHC_VERSION)) {
 		log_error("version error %x", ntohl(h->version));
 		return -EINVAL;
 	}
@@ -312,6 +449,10 @@ static void process_tcp_listener(int ci)
 			  fd, errno);
 		return;
 	}
+	if (!client_admit(fd)) {
+		close(fd);
+		return;
+	}
 	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *)&one, sizeof(one));
 
 
@@ -338,6 +479,9 @@ int setup_tcp_listener(int test_only)
 		return rv;
 	}
 
+	if (!test_only)
+		set_freebind(s);
+
 	rv = bind(s, &local->sa6, local->saddrlen);
 	if (test_only) {
 		rv = (rv == -1) ? errno : 0;
@@ -499,11 +643,231 @@ static int booth_tcp_exit(void)
 	return 0;
 }
 
-static int setup_udp_server(void)
+/* The sites' addresses, in the order of the configuration;
+ * path 0 is the first one. */
+static int site_paths(struct booth_site *site)
+{
+	return 1 + site->alt_count;
+}
+
+/* struct booth_site is packed; no pointers to its members. */
+static struct sockaddr *site_path_addr(struct booth_site *site, int path)
+{
+	return (void *)((char *)site + (path ?
+				offsetof(struct booth_site, alt) +
+				(path - 1) * sizeof(struct sockaddr_in6) :
+				offsetof(struct booth_site, sa6)));
+}
+
+static const char *path_string(struct sockaddr *addr)
+{
+	static char buf[INET6_ADDRSTRLEN];
+	void *a;
+
+	a = local->family == AF_INET ?
+		(void *)&((struct sockaddr_in *)addr)->sin_addr :
+		(void *)&((struct sockaddr_in6 *)addr)->sin6_addr;
+	return inet_ntop(local->family, a, buf, sizeof(buf)) ?: "?";
+}
+
+static int site_path_of(struct booth_site *site,
+		struct sockaddr_storage *sa)
+{
+	int i;
+
+	for (i = 0; i < site_paths(site); i++) {
+		if (site->family == AF_INET ?
+				((struct sockaddr_in *)sa)->sin_addr.s_addr ==
+				((struct sockaddr_in *)site_path_addr(site, i))->sin_addr.s_addr :
+				!memcmp(&((struct sockaddr_in6 *)sa)->sin6_addr,
+					&((struct sockaddr_in6 *)site_path_addr(site, i))->sin6_addr,
+					sizeof(struct in6_addr)))
+			return i;
+	}
+	return -1;
+}
+
+/* With several addresses for a site, the one answering path
+ * probes fastest is used; see udp_path_cron(). */
+#define PATH_PROBE_INTERVAL	1
+#define PATH_DEAD		(3 * PATH_PROBE_INTERVAL)
+#define PATH_RTT_MARGIN		10
+#define MCAST_PROBE_INTERVAL	5
+
+struct udp_path {
+	time_t last_recv;
+	int rtt_ms;
+	uint32_t probe;
+	timetype probe_sent;
+};
+
+static struct udp_path udp_paths[MAX_NODES][MAX_SITE_ADDRS];
+static int udp_path_cur[MAX_NODES];
+
+/* One UDP socket for each of our addresses. */
+static int udp_fds[MAX_SITE_ADDRS];
+static int udp_fd_count;
+
+/* Our address paired with a path of another site: the second
+ * address for the second, and so on. */
+static int udp_path_fd(int path)
+{
+	return udp_fds[min(path, udp_fd_count - 1)];
+}
+
+/* A burst of renewals brings in an ack per ticket and site at
+ * once; about what the kernel accounts for a small datagram. */
+#define UDP_TRUESIZE		1024
+#define UDP_RCVBUF_MAX		(32 * 1024 * 1024)
+
+/* The receiving side of a UDP socket. The kernel counts what it
+ * had to drop for lack of buffer space (SO_RXQ_OVFL); when that
+ * goes up, the buffer gets bigger. */
+struct udp_rx {
+	int fd;
+	int rcvbuf;
+	uint32_t drops;
+	time_t logged;
+	char name[INET6_ADDRSTRLEN];
+};
+
+static struct udp_rx udp_rx[MAX_SITE_ADDRS + 1];
+static int udp_rx_count;
+
+static int udp_rcvbuf_want(void)
+{
+	int64_t want;
+
+	want = (int64_t)booth_conf->ticket_count *
+		booth_conf->site_count * UDP_TRUESIZE;
+	if (want < SOCKET_BUFFER_SIZE)
+		want = SOCKET_BUFFER_SIZE;
+	if (want > UDP_RCVBUF_MAX)
+		want = UDP_RCVBUF_MAX;
+	return want;
+}
+
+/* Beyond net.core.rmem_max only with CAP_NET_ADMIN. Returns the
+ * size the kernel took (it reports twice that, for overhead). */
+static int set_rcvbuf(int fd, int size)
+{
+	socklen_t len;
+	int got;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE,
+				&size, sizeof(size)) < 0 &&
+			setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
+				&size, sizeof(size)) < 0)
+		return -1;
+
+	len = sizeof(got);
+	if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &got, &len) < 0)
+		return size;
+	return got / 2;
+}
+
+static int udp_rx_add(int fd, const char *name)
+{
+	struct udp_rx *rx;
+	int one = 1, want;
+
+	rx = udp_rx + udp_rx_count;
+	memset(rx, 0, sizeof(*rx));
+	rx->fd = fd;
+	strncpy(rx->name, name, sizeof(rx->name) - 1);
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) < 0)
+		log_warn("cannot count dropped datagrams on %s: %s",
+				name, strerror(errno));
+
+	want = udp_rcvbuf_want();
+	rx->rcvbuf = set_rcvbuf(fd, want);
+	if (rx->rcvbuf < 0) {
+		log_error("failed to set recvbuf size");
+		return -1;
+	}
+	if (rx->rcvbuf < want)
+		log_warn("receive buffer on %s is %d bytes instead of %d, "
+				"see net.core.rmem_max",
+				name, rx->rcvbuf, want);
+
+	udp_rx_count++;
+	return 0;
+}
+
+/* Called with the kernel's counter; logs at most once a second. */
+static void udp_rx_drops(int fd, uint32_t drops)
+{
+	struct udp_rx *rx;
+	uint32_t lost;
+	time_t now;
+	int i, size;
+
+	for (i = 0; i < udp_rx_count && udp_rx[i].fd != fd; i++)
+		;
+	if (i == udp_rx_count)
+		return;
+
+	rx = udp_rx + i;
+	now = get_secs(NULL);
+	if (drops == rx->drops || now == rx->logged)
+		return;
+
+	lost = drops - rx->drops;
+	rx->drops = drops;
+	rx->logged = now;
+
+	size = -1;
+	if (rx->rcvbuf < UDP_RCVBUF_MAX)
+		size = set_rcvbuf(fd, min(2 * rx->rcvbuf, UDP_RCVBUF_MAX));
+	if (size > rx->rcvbuf) {
+		log_warn("%u datagrams dropped on %s, receive buffer full; "
+				"grown from %d to %d bytes",
+				lost, rx->name, rx->rcvbuf, size);
+		rx->rcvbuf = size;
+	} else
+		log_warn("%u datagrams dropped on %s, receive buffer full "
+				"(%d bytes, see net.core.rmem_max)",
+				lost, rx->name, rx->rcvbuf);
+}
+
+/* For "booth stats"; one line per UDP socket. */
+static int tcp_peer_stats(char *buf, int size, const char *shard);
+
+int transport_answer_stats(int fd)
+{
+	struct boothc_header hdr;
+	char data[(MAX_SITE_ADDRS + MAX_NODES + 1) * 128];
+	char shard[32];
+	struct udp_rx *rx;
+	int i, len;
+
+	shard[0] = 0;
+	if (booth_conf->shards > 1)
+		snprintf(shard, sizeof(shard), "shard: %d, ", booth_shard);
+
+	len = 0;
+	for (i = 0; i < udp_rx_count; i++) {
+		rx = udp_rx + i;
+		len += snprintf(data + len, sizeof(data) - len,
+				"%sudp: %s, rcvbuf: %d, dropped: %u\n",
+				shard, rx->name, rx->rcvbuf, rx->drops);
+	}
+	if (!udp_rx_count)
+		len = snprintf(data, sizeof(data), "%stransport: %s\n",
+				shard, transport()->name);
+	if (booth_conf->proto == TCP_PEER)
+		len += tcp_peer_stats(data + len, sizeof(data) - len, shard);
+
+	init_header(&hdr, CL_STATS, 0, 0, RLT_SUCCESS, 0, sizeof(hdr) + len);
+	return send_header_plus(fd, &hdr, data, len);
+}
+
+
+static int setup_udp_server(struct sockaddr *addr)
 {
 	int rv, fd;
 	int one = 1;
-	unsigned int recvbuf_size;
 
 	fd = socket(local->family, SOCK_DGRAM, 0);
 	if (fd == -1) {
@@ -524,24 +888,20 @@ static int setup_udp_server(void)
 		goto ex;
 	}
 
-	rv = bind(fd, (struct sockaddr *)&local->sa6, local->saddrlen);
+	set_freebind(fd);
+	rv = bind(fd, addr, local->saddrlen);
 
 	if (rv == -1) {
 		log_error("failed to bind UDP socket to [%s]:%d: %s",
-				site_string(local), booth_conf->port,
+				path_string(addr), booth_conf->port,
 				strerror(errno));
 		goto ex;
 	}
 
-	recvbuf_size = SOCKET_BUFFER_SIZE;
-	rv = setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
-			&recvbuf_size, sizeof(recvbuf_size));
-	if (rv == -1) {
-		log_error("failed to set recvbuf size");
+	if (udp_rx_add(fd, path_string(addr)) < 0)
 		goto ex;
-	}
 
-	local->udp_fd = fd;
+	udp_fds[udp_fd_count++] = fd;
 	return 0;
 
 ex:
@@ -551,148 +911,1472 @@ ex:
 }
 
 
+static void finish_msg(void *buf, int len);
+
+/* Notes which path a message came in on; path probes are
+ * answered here, and not passed on. */
+static int udp_path_recv(int fd, struct sockaddr_storage *sa,
+		struct boothc_header *h, int len)
+{
+	struct booth_site *from;
+	struct boothc_header echo;
+	struct udp_path *p;
+	timetype now, res;
+	int path, sample;
+
+	if (len < sizeof(*h) ||
+			!find_site_by_id(ntohl(h->from), &from) || !from)
+		return 0;
+
+	path = site_path_of(from, sa);
+	if (path < 0)
+		return 0;
+	p = udp_paths[from->index] + path;
+	p->last_recv = get_secs(NULL);
+
+	switch (ntohl(h->cmd)) {
+	case OP_PATH_PROBE:
+		/* back the same way */
+		init_header(&echo, OP_PATH_ECHO, ntohl(h->request), 0,
+				RLT_SUCCESS, 0, sizeof(echo));
+		finish_msg(&echo, sizeof(echo));
+		(void)sendto(fd, &echo, sizeof(echo), MSG_NOSIGNAL,
+				(struct sockaddr *)sa, from->saddrlen);
+		return 1;
+
+	case OP_PATH_ECHO:
+		if (ntohl(h->request) != p->probe)
+			return 1;
+		get_time(&now);
+		time_sub(&now, &p->probe_sent, &res);
+		sample = time_to_ms(res);
+		/* 0 is for unknown */
+		if (sample >= 0)
+			p->rtt_ms = max(p->rtt_ms ?
+					(7 * p->rtt_ms + sample) / 8 :
+					sample, 1);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Broadcasts go out once, to the group, for the sites which
+ * joined it; see peer_broadcast(). */
+static int mcast_fd = -1;
+/* Whether a datagram of another site came in over the group; only
+ * then it's said to work, see finish_msg(). */
+static int mcast_heard;
+
+static void mcast_recv(struct boothc_header *h, int len)
+{
+	struct booth_site *from;
+
+	if (mcast_heard || len < sizeof(*h) ||
+			!find_site_by_id(ntohl(h->from), &from) || !from)
+		return;
+
+	log_info("multicast group %s works, heard %s",
+			path_string((void *)&booth_conf->mcast6),
+			site_string(from));
+	mcast_heard = 1;
+}
+
 /* Receive/process callback for UDP */
+/* Takes what is there, up to UDP_DRAIN_MAX datagrams; the loop
+ * handles the other sites before the clients, see loop(). */
 static void process_recv(int ci)
 {
 	struct sockaddr_storage sa;
-	int rv;
-	socklen_t sa_len;
-	char buffer[256];
+	struct msghdr mh;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char cbuf[CMSG_SPACE(sizeof(uint32_t))];
+	uint32_t drops;
+	int rv, n, fd;
+	char buffer[BOOTH_MAX_DGRAM];
 	/* Used for unit tests */
 	struct boothc_ticket_msg *msg;
 
 
-	sa_len = sizeof(sa);
+	fd = clients[ci].fd;
 	msg = (void*)buffer;
-	rv = recvfrom(clients[ci].fd,
-			buffer, sizeof(buffer),
-			MSG_NOSIGNAL | MSG_DONTWAIT,
-			(struct sockaddr *)&sa, &sa_len);
-	if (rv == -1)
-		return;
+	for (n = 0; n < UDP_DRAIN_MAX; n++) {
+		memset(&mh, 0, sizeof(mh));
+		iov.iov_base = buffer;
+		iov.iov_len = sizeof(buffer);
+		mh.msg_name = &sa;
+		mh.msg_namelen = sizeof(sa);
+		mh.msg_iov = &iov;
+		mh.msg_iovlen = 1;
+		mh.msg_control = cbuf;
+		mh.msg_controllen = sizeof(cbuf);
+		rv = uring_recvmsg(ci, fd, &mh, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (rv == -1)
+			return;
+
+		for (cmsg = CMSG_FIRSTHDR(&mh); cmsg;
+				cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET &&
+					cmsg->cmsg_type == SO_RXQ_OVFL) {
+				memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+				udp_rx_drops(fd, drops);
+			}
+		}
+
+		/* our own, from the multicast group */
+		if (rv >= sizeof(msg->header) &&
+				msg->header.from == htonl(local->site_id))
+			continue;
+
+		if (auth_verify((void *)buffer, rv) < 0)
+			continue;
+
+		if (fd == mcast_fd)
+			mcast_recv((void *)buffer, rv);
+		if (rv >= sizeof(msg->header) &&
+				ntohl(msg->header.cmd) == OP_MCAST_PROBE)
+			continue;
+
+		if (udp_path_recv(fd, &sa, (void *)buffer, rv))
+			continue;
 
-	deliver_fn(msg, rv);
+		deliver_fn(msg, rv);
+	}
 }
 
-static int booth_udp_init(void *f)
+/* The interface the group is joined on, from the site address;
+ * 0 (the routing table decides) if it isn't found. */
+static unsigned int local_ifindex(void)
 {
-	int rv;
+	struct ifaddrs *ifa_list, *ifa;
+	struct sockaddr_in6 *sa6;
+	unsigned int idx;
 
-	rv = setup_udp_server();
-	if (rv < 0)
-		return rv;
+	if (getifaddrs(&ifa_list) < 0) {
+		log_warn("cannot get the interfaces: %s", strerror(errno));
+		return 0;
+	}
 
-	deliver_fn = f;
-	client_add(local->udp_fd,
-			booth_transport + UDP,
-			process_recv, NULL);
+	idx = 0;
+	for (ifa = ifa_list; ifa && !idx; ifa = ifa->ifa_next) {
+		sa6 = (void *)ifa->ifa_addr;
+		if (sa6 && sa6->sin6_family == AF_INET6 &&
+				!memcmp(&sa6->sin6_addr, &local->sa6.sin6_addr,
+					sizeof(sa6->sin6_addr)))
+			idx = if_nametoindex(ifa->ifa_name);
+	}
+	freeifaddrs(ifa_list);
 
-	return 0;
+	if (!idx)
+		log_warn("no interface has %s, joining the group on the default one",
+				site_string(local));
+	return idx;
 }
 
-int booth_udp_send(struct booth_site *to, void *buf, int len)
+static int setup_mcast(void)
 {
-	int rv;
+	struct ip_mreq mreq;
+	struct ipv6_mreq mreq6;
+	unsigned int idx;
+	int fd, rv, one = 1;
+	int ttl = booth_conf->mcast_ttl;
 
-	rv = sendto(local->udp_fd, buf, len, MSG_NOSIGNAL,
-			(struct sockaddr *)&to->sa6, to->saddrlen);
-	if (rv == len) {
-		rv = 0;
-	} else if (rv < 0) {
-		log_error("Cannot send to %s: %d %s",
-				site_string(to),
-				errno,
+	fd = socket(local->family, SOCK_DGRAM, 0);
+	if (fd == -1) {
+		log_error("failed to create multicast socket %s",
 				strerror(errno));
+		return -1;
+	}
+
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1 ||
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR,
+				&one, sizeof(one)) == -1 ||
+			bind(fd, (struct sockaddr *)&booth_conf->mcast6,
+				local->saddrlen) == -1) {
+		log_error("failed to bind multicast socket to [%s]:%d: %s",
+				path_string((void *)&booth_conf->mcast6),
+				booth_conf->port, strerror(errno));
+		goto ex;
+	}
+
+	/* on the interface of the site address, also for sending */
+	if (local->family == AF_INET) {
+		mreq.imr_multiaddr = booth_conf->mcast4.sin_addr;
+		mreq.imr_interface = local->sa4.sin_addr;
+		rv = setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+				&mreq, sizeof(mreq));
+		if (rv == 0)
+			rv = setsockopt(udp_fds[0], IPPROTO_IP, IP_MULTICAST_IF,
+					&local->sa4.sin_addr,
+					sizeof(local->sa4.sin_addr));
+		if (rv == 0)
+			rv = setsockopt(udp_fds[0], IPPROTO_IP, IP_MULTICAST_TTL,
+					&ttl, sizeof(ttl));
 	} else {
-		rv = -1;
-		log_error("Packet sent to %s got truncated",
-				site_string(to));
+		idx = local_ifindex();
+		mreq6.ipv6mr_multiaddr = booth_conf->mcast6.sin6_addr;
+		mreq6.ipv6mr_interface = idx;
+		rv = setsockopt(fd, IPPROTO_IPV6, IPV6_JOIN_GROUP,
+				&mreq6, sizeof(mreq6));
+		if (rv == 0)
+			rv = setsockopt(udp_fds[0], IPPROTO_IPV6,
+					IPV6_MULTICAST_IF, &idx, sizeof(idx));
+		if (rv == 0)
+			rv = setsockopt(udp_fds[0], IPPROTO_IPV6,
+					IPV6_MULTICAST_HOPS, &ttl, sizeof(ttl));
+	}
+	if (rv == -1) {
+		log_error("failed to join multicast group %s: %s",
+				path_string((void *)&booth_conf->mcast6),
+				strerror(errno));
+		goto ex;
 	}
 
-	return rv;
+	/* not fatal, like the socket options above */
+	if (udp_rx_add(fd, path_string((void *)&booth_conf->mcast6)) < 0)
+		log_warn("multicast socket keeps the default receive buffer");
+
+	mcast_fd = fd;
+	/* else polled */
+	(void)uring_recv_multi(client_add(fd, booth_transport + UDP,
+				process_recv, NULL));
+	return 0;
+
+ex:
+	close(fd);
+	return -1;
 }
 
-static int booth_udp_broadcast(void *buf, int len)
+static int booth_udp_init(void *f)
 {
-	int i, rv, rvs;
-	struct booth_site *site;
+	int i, rv;
+
+	for (i = 0; i < site_paths(local); i++) {
+		rv = setup_udp_server(site_path_addr(local, i));
+		if (rv < 0)
+			return rv;
+		(void)uring_recv_multi(client_add(udp_fds[i],
+					booth_transport + UDP,
+					process_recv, NULL));
+	}
+	local->udp_fd = udp_fds[0];
 
+	/* unicast does it, too */
+	if (booth_conf->mcast6.sin6_family && setup_mcast() < 0)
+		log_warn("sending broadcasts to each site instead");
 
-	if (!booth_conf || !booth_conf->site_count)
-		return -1;
+	deliver_fn = f;
+	return 0;
+}
 
-	rvs = 0;
-	foreach_node(i, site) {
-		if (site != local) {
-			rv = booth_udp_send(site, buf, len);
-			if (!rvs)
-				rvs = rv;
-		}
-	}
+/* During a broadcast the message is finished only once per
+ * length, not for every site; the
+ * sends may be queued, see uring_sendto(). */
+static int in_batch;
+static int batch_len = -1;
+
+/* Messages held back until the journal is on disk; their data
+ * is in held_data, as TCP frames may be larger than a datagram. */
+struct held_dgram {
+	struct booth_site *to;
+	int len;
+	int offset;
+};
 
-	return rvs;
+static struct held_dgram *held;
+static int held_cnt, held_alloc;
+static char *held_data;
+static int held_used, held_size;
+
+static int peer_sendto(struct booth_site *to, void *buf, int len);
+
+static int mcast_sendto(void *buf, int len)
+{
+	int rv;
+
+	if (!local_addr_up())
+		return 0;
+
+	rv = sendto(udp_fds[0], buf, len, MSG_NOSIGNAL,
+			(struct sockaddr *)&booth_conf->mcast6, local->saddrlen);
+	if (rv == len)
+		return 0;
+
+	log_error("Cannot send to multicast group %s: %s",
+			path_string((void *)&booth_conf->mcast6),
+			rv < 0 ? strerror(errno) : "truncated");
+	return -1;
 }
 
-static int booth_udp_exit(void)
+/* A held datagram without a site is for the multicast group. */
+static int dgram_sendto(struct booth_site *to, void *buf, int len)
 {
-	return 0;
+	return to ? peer_sendto(to, buf, len) : mcast_sendto(buf, len);
 }
 
-/* SCTP transport layer has not been developed yet */
-static int booth_sctp_init(void *f __attribute__((unused)))
+/* Nothing may go out before what is held, so without memory the
+ * message is lost; the peers resend, or we do. */
+static int hold_dgram(struct booth_site *to, void *buf, int len)
 {
+	struct held_dgram *p;
+	char *d;
+	int n;
+
+	if (held_cnt == held_alloc) {
+		n = held_alloc ? held_alloc * 2 : 16;
+		p = realloc(held, n * sizeof(*held));
+		if (!p)
+			goto oom;
+		held = p;
+		held_alloc = n;
+	}
+
+	if (held_used + len > held_size) {
+		n = held_size ? held_size : 16 * BOOTH_MAX_DGRAM;
+		while (n < held_used + len)
+			n *= 2;
+		d = realloc(held_data, n);
+		if (!d)
+			goto oom;
+		held_data = d;
+		held_size = n;
+	}
+
+	p = held + held_cnt++;
+	p->to = to;
+	p->len = len;
+	p->offset = held_used;
+	memcpy(held_data + held_used, buf, len);
+	held_used += len;
 	return 0;
+
+oom:
+	log_error("out of memory, dropping a message held for the journal");
+	return -ENOMEM;
 }
 
-static int booth_sctp_send(struct booth_site * to __attribute__((unused)),
-			   void *buf __attribute__((unused)),
-			   int len __attribute__((unused)))
+int booth_udp_held(void)
 {
-	return 0;
+	return held_cnt;
 }
 
-static int booth_sctp_broadcast(void *buf __attribute__((unused)),
-				int len __attribute__((unused)))
+/* Send the first 'cnt' held messages; those held later may wait
+ * for a journal sync still running. */
+void booth_udp_release_held(int cnt)
 {
-	return 0;
+	int i, used;
+
+	if (cnt > held_cnt)
+		cnt = held_cnt;
+	if (!cnt)
+		return;
+
+	in_batch = 1;
+	for (i = 0; i < cnt; i++)
+		(void)dgram_sendto(held[i].to, held_data + held[i].offset,
+				held[i].len);
+	in_batch = 0;
+	uring_submit();
+
+	used = cnt < held_cnt ? held[cnt].offset : held_used;
+	held_cnt -= cnt;
+	held_used -= used;
+	memmove(held, held + cnt, held_cnt * sizeof(*held));
+	memmove(held_data, held_data + used, held_used);
+	for (i = 0; i < held_cnt; i++)
+		held[i].offset -= used;
 }
 
-static int return_0_booth_site(struct booth_site *v __attribute((unused)))
+/* The journal couldn't be written; see journal_flush(). */
+void booth_udp_drop_held(void)
 {
-	return 0;
+	if (held_cnt)
+		log_warn("dropped %d datagrams, journal not on disk",
+				held_cnt);
+	held_cnt = 0;
+	held_used = 0;
 }
 
-static int return_0(void)
+/* Ticket messages that an older site could understand. */
+static int is_ticket_msg(struct boothc_header *h, int len)
 {
-	return 0;
+	if (len != sizeof(struct boothc_ticket_msg))
+		return 0;
+
+	switch (ntohl(h->cmd)) {
+	case OP_BULK_STATUS:
+	case OP_BULK_INDEX:
+	case OP_BULK_COMPACT:
+	case OP_DIGEST:
+	case OP_ADD_TICKET:
+	case OP_DEL_TICKET:
+		return 0;
+	}
+	return 1;
 }
-const struct booth_transport booth_transport[TRANSPORT_ENTRIES] = {
-	[TCP] = {
-		.name = "TCP",
-		.init = booth_tcp_init,
-		.open = booth_tcp_open,
-		.send = booth_tcp_send,
-		.recv = booth_tcp_recv,
-		.close = booth_tcp_close,
-		.exit = booth_tcp_exit
-	},
-	[UDP] = {
-		.name = "UDP",
-		.init = booth_udp_init,
-		.open = return_0_booth_site,
-		.send = booth_udp_send,
-		.close = return_0_booth_site,
-		.broadcast = booth_udp_broadcast,
-		.exit = booth_udp_exit
+
+/* Sites without CAP_SUCCESSOR get the shorter ticket messages. */
+static int classic_len(struct booth_site *to, void *buf, int len)
+{
+	if (!(to->caps & CAP_SUCCESSOR) && is_ticket_msg(buf, len))
+		return BOOTHC_CLASSIC_LEN;
+	return len;
+}
+
+/* Fills in what depends on the message length, see auth_sign(). */
+static void finish_msg(void *buf, int len)
+{
+	struct boothc_header *h = buf;
+
+	h->options = htonl(CAP_VALID | BOOTH_CAPS |
+			(mcast_heard ? CAP_MCAST : 0));
+	h->length = htonl(len);
+	auth_sign(h, len);
+}
+
+/* Common to UDP and SCTP. */
+static int peer_send(struct booth_site *to, void *buf, int len)
+{
+	len = classic_len(to, buf, len);
+	if (len != batch_len) {
+		finish_msg(buf, len);
+		if (in_batch)
+			batch_len = len;
+	}
+
+	/* see journal_flush() */
+	if (journal_pending())
+		return hold_dgram(to, buf, len);
+
+	return peer_sendto(to, buf, len);
+}
+
+static int is_vote_msg(struct boothc_header *h);
+
+/* Votes take all paths to multi-homed sites, not just the one
+ * the group is on. */
+static int via_mcast(struct booth_site *site, void *buf)
+{
+	return mcast_fd >= 0 && (site->caps & CAP_MCAST) &&
+		!(site->alt_count && is_vote_msg(buf));
+}
+
+static int peer_broadcast(void *buf, int len)
+{
+	int i, rv, rvs, mcast;
+	struct booth_site *site;
+
+
+	if (!booth_conf || !booth_conf->site_count)
+		return -1;
+
+	in_batch = 1;
+	rvs = 0;
+
+	mcast = 0;
+	foreach_node(i, site) {
+		if (site != local && via_mcast(site, buf))
+			mcast = 1;
+	}
+	if (mcast) {
+		finish_msg(buf, len);
+		batch_len = len;
+		rvs = journal_pending() ?
+			hold_dgram(NULL, buf, len) :
+			mcast_sendto(buf, len);
+	}
+
+	foreach_node(i, site) {
+		if (site != local && !(mcast && via_mcast(site, buf))) {
+			rv = transport()->send(site, buf, len);
+			if (!rvs)
+				rvs = rv;
+		}
+	}
+	in_batch = 0;
+	batch_len = -1;
+	uring_submit();
+
+	return rvs;
+}
+
+int booth_udp_send(struct booth_site *to, void *buf, int len)
+{
+	return peer_send(to, buf, len);
+}
+
+static int udp_sendto_path(struct booth_site *to, int path,
+		void *buf, int len)
+{
+	int rv;
+
+	/* see uring_submit() in peer_broadcast() */
+	if (in_batch && !uring_sendto(udp_path_fd(path), buf, len,
+				site_path_addr(to, path), to->saddrlen))
+		return 0;
+
+	rv = sendto(udp_path_fd(path), buf, len, MSG_NOSIGNAL,
+			site_path_addr(to, path), to->saddrlen);
+	if (rv == len) {
+		rv = 0;
+	} else if (rv < 0) {
+		log_error("Cannot send to %s: %d %s",
+				path_string(site_path_addr(to, path)),
+				errno,
+				strerror(errno));
+	} else {
+		rv = -1;
+		log_error("Packet sent to %s got truncated",
+				path_string(site_path_addr(to, path)));
+	}
+
+	return rv;
+}
+
+/* An election shouldn't wait for a path to be found dead. */
+static int is_vote_msg(struct boothc_header *h)
+{
+	switch (ntohl(h->cmd)) {
+	case OP_PREVOTE:
+	case OP_REQ_VOTE:
+	case OP_VOTE_FOR:
+		return 1;
+	}
+	return 0;
+}
+
+static int udp_sendto(struct booth_site *to, void *buf, int len)
+{
+	int i, rv, rvs;
+
+	if (!to->alt_count || !is_vote_msg(buf))
+		return udp_sendto_path(to, udp_path_cur[to->index], buf, len);
+
+	rvs = -1;
+	for (i = 0; i < site_paths(to); i++) {
+		rv = udp_sendto_path(to, i, buf, len);
+		if (!rv)
+			rvs = 0;
+	}
+	return rvs;
+}
+
+static void udp_path_probe(struct booth_site *site, int path)
+{
+	struct udp_path *p = udp_paths[site->index] + path;
+	struct boothc_header probe;
+
+	init_header(&probe, OP_PATH_PROBE, ++p->probe, 0,
+			RLT_SUCCESS, 0, sizeof(probe));
+	finish_msg(&probe, sizeof(probe));
+	get_time(&p->probe_sent);
+	(void)sendto(udp_path_fd(path), &probe, sizeof(probe), MSG_NOSIGNAL,
+			site_path_addr(site, path), site->saddrlen);
+}
+
+/* Switching needs a path to be clearly better, so that two
+ * similar ones don't take turns; on a LAN, a few milliseconds
+ * are just noise. */
+static int udp_path_better(struct udp_path *p, struct udp_path *cur,
+		time_t now)
+{
+	if (now - p->last_recv > PATH_DEAD || !p->rtt_ms)
+		return 0;
+	if (now - cur->last_recv > PATH_DEAD || !cur->rtt_ms)
+		return 1;
+	return 4 * p->rtt_ms < 3 * cur->rtt_ms &&
+		p->rtt_ms + PATH_RTT_MARGIN < cur->rtt_ms;
+}
+
+static void udp_path_cron(void)
+{
+	static time_t next_probe;
+	struct booth_site *site;
+	struct udp_path *paths;
+	time_t now;
+	int i, j, best;
+
+	now = get_secs(NULL);
+	if (now < next_probe)
+		return;
+	next_probe = now + PATH_PROBE_INTERVAL;
+
+	foreach_node(i, site) {
+		if (site == local || !site->alt_count ||
+				!(site->caps & CAP_PATHS))
+			continue;
+
+		paths = udp_paths[site->index];
+		best = udp_path_cur[site->index];
+		for (j = 0; j < site_paths(site); j++) {
+			if (udp_path_better(paths + j, paths + best, now))
+				best = j;
+			udp_path_probe(site, j);
+		}
+
+		if (best != udp_path_cur[site->index]) {
+			log_info("%s: sending to %s now (%d ms)",
+					site_string(site),
+					path_string(site_path_addr(site, best)),
+					paths[best].rtt_ms);
+			udp_path_cur[site->index] = best;
+		}
+	}
+}
+
+static int booth_udp_exit(void)
+{
+	return 0;
+}
+
+
+#ifdef HAVE_LINUX_SCTP_H
+
+/* The tickets are spread over the streams of an association, so
+ * that a lost message holds up only the tickets in its stream;
+ * stream 0 is for everything else. */
+#define SCTP_STREAMS		16
+
+/* A dead path is noticed, and the next one used, after a few
+ * seconds; the tickets don't need to expire for that. */
+#define SCTP_RTO_MIN		200
+#define SCTP_RTO_MAX		1000
+#define SCTP_HB_INTERVAL	1000
+#define SCTP_PATH_MAX_RETRANS	2
+
+static int sctp_fd = -1;
+
+/* All addresses of a site, packed as for sctp_bindx(). */
+static int pack_site_addrs(struct booth_site *site, char *buf)
+{
+	int i, len;
+
+	memcpy(buf, &site->sa6, site->saddrlen);
+	len = site->saddrlen;
+	for (i = 0; i < site->alt_count; i++) {
+		memcpy(buf + len, site->alt + i, site->saddrlen);
+		len += site->saddrlen;
+	}
+	return len;
+}
+
+/* Like sctp_connectx(); all addresses of the site are given, so
+ * that the setup works even if the first path is down. */
+static void sctp_associate(struct booth_site *site)
+{
+	char addrs[MAX_SITE_ADDRS * sizeof(struct sockaddr_in6)];
+	struct sctp_getaddrs_old param;
+	socklen_t len;
+
+	param.assoc_id = 0;
+	param.addr_num = pack_site_addrs(site, addrs);
+	param.addrs = (void *)addrs;
+	len = sizeof(param);
+	if (getsockopt(sctp_fd, IPPROTO_SCTP, SCTP_SOCKOPT_CONNECTX3,
+				&param, &len) < 0 && errno != EINPROGRESS) {
+		log_error("cannot associate with %s: %s",
+				site_string(site), strerror(errno));
+		site->sctp_assoc = 0;
+		return;
+	}
+	site->sctp_assoc = param.assoc_id;
+}
+
+static int sctp_stream(void *buf, int len)
+{
+	struct boothc_ticket_msg *msg = buf;
+
+	if ((len != sizeof(*msg) && len != BOOTHC_CLASSIC_LEN) ||
+			!is_ticket_msg(buf, sizeof(*msg)))
+		return 0;
+
+	return 1 + crc32(0L, msg->ticket.id,
+			strnlen((char *)msg->ticket.id, sizeof(msg->ticket.id)))
+		% (SCTP_STREAMS - 1);
+}
+
+static int sctp_sendto(struct booth_site *to, void *buf, int len)
+{
+	char cbuf[CMSG_SPACE(sizeof(struct sctp_sndrcvinfo))];
+	struct iovec iov = { buf, len };
+	struct sctp_sndrcvinfo *si;
+	struct cmsghdr *c;
+	struct msghdr mh;
+	int rv;
+
+	memset(&mh, 0, sizeof(mh));
+	memset(cbuf, 0, sizeof(cbuf));
+	mh.msg_name = &to->sa6;
+	mh.msg_namelen = to->saddrlen;
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = cbuf;
+	mh.msg_controllen = sizeof(cbuf);
+
+	c = CMSG_FIRSTHDR(&mh);
+	c->cmsg_level = IPPROTO_SCTP;
+	c->cmsg_type = SCTP_SNDRCV;
+	c->cmsg_len = CMSG_LEN(sizeof(*si));
+	si = (void *)CMSG_DATA(c);
+	si->sinfo_stream = sctp_stream(buf, len);
+
+	rv = sendmsg(sctp_fd, &mh, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (rv == len)
+		return 0;
+
+	if (rv < 0) {
+		log_error("Cannot send to %s: %d %s",
+				site_string(to), errno, strerror(errno));
+		/* perhaps the association is gone */
+		if (errno != EAGAIN)
+			sctp_associate(to);
+		return rv;
+	}
+
+	log_error("Packet sent to %s got truncated", site_string(to));
+	return -1;
+}
+
+static struct booth_site *site_by_assoc(sctp_assoc_t id)
+{
+	struct booth_site *site;
+	int i;
+
+	foreach_node(i, site) {
+		if (site->sctp_assoc && site->sctp_assoc == id)
+			return site;
+	}
+	return NULL;
+}
+
+static void sctp_notification(union sctp_notification *sn)
+{
+	struct sctp_assoc_change *sac;
+	struct sctp_paddr_change *spc;
+	struct booth_site *site;
+
+	switch (sn->sn_header.sn_type) {
+	case SCTP_ASSOC_CHANGE:
+		sac = &sn->sn_assoc_change;
+		site = site_by_assoc(sac->sac_assoc_id);
+		if (!site)
+			return;
+
+		switch (sac->sac_state) {
+		case SCTP_COMM_UP:
+		case SCTP_RESTART:
+			log_info("SCTP association with %s up",
+					site_string(site));
+			break;
+		case SCTP_COMM_LOST:
+		case SCTP_SHUTDOWN_COMP:
+			log_warn("SCTP association with %s lost",
+					site_string(site));
+			/* fall through */
+		case SCTP_CANT_STR_ASSOC:
+			sctp_associate(site);
+			break;
+		}
+		break;
+
+	case SCTP_PEER_ADDR_CHANGE:
+		spc = &sn->sn_paddr_change;
+		site = site_by_assoc(spc->spc_assoc_id);
+		if (!site)
+			return;
+
+		if (spc->spc_state == SCTP_ADDR_UNREACHABLE)
+			log_warn("a path to %s failed", site_string(site));
+		else if (spc->spc_state == SCTP_ADDR_AVAILABLE)
+			log_info("a path to %s is back", site_string(site));
+		break;
+	}
+}
+
+static void process_sctp_recv(int ci)
+{
+	char buffer[BOOTH_MAX_DGRAM];
+	char cbuf[CMSG_SPACE(sizeof(struct sctp_sndrcvinfo))];
+	struct iovec iov = { buffer, sizeof(buffer) };
+	struct sctp_sndrcvinfo *si;
+	struct sockaddr_storage sa;
+	struct boothc_header *h;
+	struct booth_site *from;
+	struct cmsghdr *c;
+	struct msghdr mh;
+	int rv;
+
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_name = &sa;
+	mh.msg_namelen = sizeof(sa);
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = cbuf;
+	mh.msg_controllen = sizeof(cbuf);
+
+	rv = recvmsg(clients[ci].fd, &mh, MSG_DONTWAIT);
+	if (rv <= 0)
+		return;
+
+	if (mh.msg_flags & MSG_NOTIFICATION) {
+		sctp_notification((void *)buffer);
+		return;
+	}
+
+	if (!(mh.msg_flags & MSG_EOR)) {
+		log_error("SCTP message too long, dropped");
+		return;
+	}
+
+	if (auth_verify((void *)buffer, rv) < 0)
+		return;
+
+	/* The other side may have set up the association. */
+	h = (void *)buffer;
+	si = NULL;
+	for (c = CMSG_FIRSTHDR(&mh); c; c = CMSG_NXTHDR(&mh, c)) {
+		if (c->cmsg_level == IPPROTO_SCTP &&
+				c->cmsg_type == SCTP_SNDRCV)
+			si = (void *)CMSG_DATA(c);
+	}
+	if (si && rv >= sizeof(*h) &&
+			find_site_by_id(ntohl(h->from), &from) && from)
+		from->sctp_assoc = si->sinfo_assoc_id;
+
+	deliver_fn(buffer, rv);
+}
+
+static int booth_sctp_init(void *f)
+{
+	char addrs[MAX_SITE_ADDRS * sizeof(struct sockaddr_in6)];
+	struct sctp_event_subscribe ev;
+	struct sctp_paddrparams pp;
+	struct sctp_initmsg init;
+	struct sctp_rtoinfo rto;
+	struct booth_site *site;
+	int fd, i, len, one = 1;
+
+	fd = socket(local->family, SOCK_SEQPACKET, IPPROTO_SCTP);
+	if (fd == -1) {
+		log_error("failed to create SCTP socket %s%s", strerror(errno),
+				errno == ESOCKTNOSUPPORT || errno == EPROTONOSUPPORT ?
+				" (is the sctp kernel module loaded?)" : "");
+		return -1;
+	}
+
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1 ||
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR,
+				&one, sizeof(one)) == -1) {
+		log_error("failed to set up SCTP socket: %s",
+				strerror(errno));
+		goto ex;
+	}
+
+	set_freebind(fd);
+
+	/* all our addresses, for multi-homing */
+	len = pack_site_addrs(local, addrs);
+	if (setsockopt(fd, IPPROTO_SCTP, SCTP_SOCKOPT_BINDX_ADD,
+				addrs, len) == -1) {
+		log_error("failed to bind SCTP socket to [%s]:%d: %s",
+				site_string(local), booth_conf->port,
+				strerror(errno));
+		goto ex;
+	}
+
+	memset(&init, 0, sizeof(init));
+	init.sinit_num_ostreams = SCTP_STREAMS;
+	init.sinit_max_instreams = SCTP_STREAMS;
+
+	memset(&rto, 0, sizeof(rto));
+	rto.srto_initial = SCTP_RTO_MAX;
+	rto.srto_min = SCTP_RTO_MIN;
+	rto.srto_max = SCTP_RTO_MAX;
+
+	memset(&pp, 0, sizeof(pp));
+	pp.spp_hbinterval = SCTP_HB_INTERVAL;
+	pp.spp_pathmaxrxt = SCTP_PATH_MAX_RETRANS;
+	pp.spp_flags = SPP_HB_ENABLE;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.sctp_data_io_event = 1;
+	ev.sctp_association_event = 1;
+	ev.sctp_address_event = 1;
+
+	if (setsockopt(fd, IPPROTO_SCTP, SCTP_INITMSG,
+				&init, sizeof(init)) == -1 ||
+			setsockopt(fd, IPPROTO_SCTP, SCTP_RTOINFO,
+				&rto, sizeof(rto)) == -1 ||
+			setsockopt(fd, IPPROTO_SCTP, SCTP_PEER_ADDR_PARAMS,
+				&pp, sizeof(pp)) == -1 ||
+			setsockopt(fd, IPPROTO_SCTP, SCTP_EVENTS,
+				&ev, sizeof(ev)) == -1 ||
+			setsockopt(fd, IPPROTO_SCTP, SCTP_NODELAY,
+				&one, sizeof(one)) == -1) {
+		log_error("failed to set SCTP socket options: %s",
+				strerror(errno));
+		goto ex;
+	}
+
+	if (listen(fd, MAX_NODES) == -1) {
+		log_error("failed to listen on SCTP socket: %s",
+				strerror(errno));
+		goto ex;
+	}
+
+	sctp_fd = fd;
+	deliver_fn = f;
+	client_add(fd, booth_transport + SCTP,
+			process_sctp_recv, NULL);
+
+	foreach_node(i, site) {
+		if (site != local)
+			sctp_associate(site);
+	}
+	return 0;
+
+ex:
+	close(fd);
+	return -1;
+}
+
+#else
+
+static int booth_sctp_init(void *f __attribute__((unused)))
+{
+	log_error("this boothd was built without SCTP support");
+	return -EPROTONOSUPPORT;
+}
+
+#endif /* HAVE_LINUX_SCTP_H */
+
+/* With "transport = TCP" the sites talk over long-lived TCP
+ * connections, so that bulk updates and batches aren't limited to
+ * a datagram. Messages are framed by the length in their header.
+ * The site with the lower ID connects; the other one takes the
+ * connection over from the client listener, see tcp_peer_adopt().
+ * Everything is non-blocking and driven by the main loop. */
+
+/* Queued per site while the connection is (re)established. */
+#define PEER_OUT_MAX		(4 * FRAME_SIZE_MAX)
+/* Connections from sites not yet identified count, too. */
+#define PEER_CONNS		(2 * MAX_NODES)
+/* Seconds between connection attempts, at most. */
+#define PEER_RETRY_MAX		8
+
+struct peer_conn {
+	int ci;
+	/* NULL until the first message came in */
+	struct booth_site *site;
+	int connecting;
+	int in_len;
+	char in[FRAME_SIZE_MAX];
+};
+
+struct peer_out {
+	struct peer_conn *conn;
+	char *buf;
+	int len;
+	time_t next_try;
+	int retry;
+	/* the queue ran full, and what got dropped since; see
+	 * tcp_peer_sendto() */
+	int full;
+	unsigned int dropped;
+	unsigned int dropped_total;
+};
+
+static struct peer_conn *peer_conns[PEER_CONNS];
+static struct peer_out peer_out[MAX_NODES];
+
+
+static struct peer_conn *conn_by_ci(int ci)
+{
+	int i;
+
+	for (i = 0; i < PEER_CONNS; i++) {
+		if (peer_conns[i] && peer_conns[i]->ci == ci)
+			return peer_conns[i];
+	}
+	return NULL;
+}
+
+static void peer_drop(struct peer_conn *c)
+{
+	struct peer_out *po;
+	int i;
+
+	if (c->site) {
+		po = peer_out + c->site->index;
+		if (po->conn == c) {
+			if (!c->connecting)
+				log_info("connection to %s closed",
+						site_string(c->site));
+			po->conn = NULL;
+			/* might end within a message */
+			po->len = 0;
+		}
+	}
+
+	for (i = 0; i < PEER_CONNS; i++) {
+		if (peer_conns[i] == c)
+			peer_conns[i] = NULL;
+	}
+	client_dead(c->ci);
+	free(c);
+}
+
+static void peer_dead(int ci)
+{
+	struct peer_conn *c;
+
+	c = conn_by_ci(ci);
+	if (c)
+		peer_drop(c);
+	else
+		client_dead(ci);
+}
+
+/* Errors show up as POLLHUP in the main loop; so nothing is freed
+ * while a message is being processed. */
+static void peer_fail(struct peer_conn *c)
+{
+	shutdown(clients[c->ci].fd, SHUT_RDWR);
+}
+
+static void peer_flush(struct peer_out *po)
+{
+	struct peer_conn *c = po->conn;
+	int rv;
+
+	if (!c || c->connecting)
+		return;
+
+	rv = po->len ? send(clients[c->ci].fd, po->buf, po->len,
+			MSG_NOSIGNAL | MSG_DONTWAIT) : 0;
+	if (rv < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			log_warn("cannot send to %s: %s",
+					site_string(c->site), strerror(errno));
+			peer_fail(c);
+			return;
+		}
+		rv = 0;
+	}
+
+	po->len -= rv;
+	memmove(po->buf, po->buf + rv, po->len);
+	pollfds[c->ci].events = POLLIN | (po->len ? POLLOUT : 0);
+
+	if (po->full && !po->len) {
+		log_info("queue for %s drained, %u message(s) were dropped",
+				site_string(c->site), po->dropped);
+		po->full = 0;
+		po->dropped = 0;
+	}
+}
+
+static struct peer_conn *peer_new(int ci, struct booth_site *site)
+{
+	struct peer_conn *c;
+	int i;
+
+	for (i = 0; i < PEER_CONNS && peer_conns[i]; i++)
+		;
+	if (i == PEER_CONNS) {
+		log_error("too many connections from other sites");
+		return NULL;
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		log_error("out of memory");
+		return NULL;
+	}
+
+	c->ci = ci;
+	c->site = site;
+	peer_conns[i] = c;
+	return c;
+}
+
+/* The first message tells who is on the other side. */
+static void peer_deliver(struct peer_conn *c, void *buf, int len)
+{
+	struct boothc_header *h = buf;
+	struct booth_site *site;
+	struct peer_out *po;
+	struct sockaddr_storage sa;
+	socklen_t sa_len;
+
+	if (auth_verify(h, len) < 0)
+		return;
+
+	if (!c->site) {
+		if (!find_site_by_id(ntohl(h->from), &site) ||
+				!site || site == local) {
+			log_error("connection from unknown site %08x",
+					ntohl(h->from));
+			peer_fail(c);
+			return;
+		}
+
+		/* else anybody could take over the connection of a
+		 * site, at least without an authfile */
+		sa_len = sizeof(sa);
+		if (getpeername(clients[c->ci].fd,
+					(struct sockaddr *)&sa, &sa_len) < 0 ||
+				site_path_of(site, &sa) < 0) {
+			log_error("connection claims to be from %s, "
+					"but comes from another address",
+					site_string(site));
+			peer_fail(c);
+			return;
+		}
+
+		po = peer_out + site->index;
+		if (po->conn)
+			peer_fail(po->conn);
+		c->site = site;
+		po->conn = c;
+		po->retry = 0;
+		log_info("connection from %s", site_string(site));
+		peer_flush(po);
+	} else if (ntohl(h->from) != c->site->site_id) {
+		log_error("message from %08x over the connection of %s",
+				ntohl(h->from), site_string(c->site));
+		peer_fail(c);
+		return;
+	}
+
+	if (ntohl(h->cmd) != OP_HELLO)
+		deliver_fn(buf, len);
+}
+
+static void peer_read(struct peer_conn *c)
+{
+	struct boothc_header *h;
+	int rv, len;
+
+	rv = recv(clients[c->ci].fd, c->in + c->in_len,
+			sizeof(c->in) - c->in_len, MSG_DONTWAIT);
+	if (rv == 0 || (rv < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+		peer_fail(c);
+		return;
+	}
+	/* see tcp_peer_adopt() for data already there */
+	if (rv > 0)
+		c->in_len += rv;
+
+	while (c->in_len >= sizeof(*h)) {
+		h = (void *)c->in;
+		if (check_boothc_header(h, -1) < 0 ||
+				ntohl(h->length) > FRAME_SIZE_MAX) {
+			log_error("bad message over TCP, closing");
+			peer_fail(c);
+			return;
+		}
+
+		len = ntohl(h->length);
+		if (c->in_len < len)
+			break;
+
+		peer_deliver(c, c->in, len);
+		c->in_len -= len;
+		memmove(c->in, c->in + len, c->in_len);
+	}
+}
+
+static void peer_work(int ci)
+{
+	struct boothc_header hello;
+	struct peer_conn *c;
+	socklen_t len;
+	int err;
+
+	c = conn_by_ci(ci);
+	if (!c)
+		return;
+
+	if (c->connecting) {
+		len = sizeof(err);
+		if (getsockopt(clients[ci].fd, SOL_SOCKET, SO_ERROR,
+					&err, &len) < 0)
+			err = errno;
+		if (err) {
+			log_debug("connect to %s failed: %s",
+					site_string(c->site), strerror(err));
+			peer_fail(c);
+			return;
+		}
+
+		c->connecting = 0;
+		peer_out[c->site->index].retry = 0;
+		log_info("connected to %s", site_string(c->site));
+
+		/* so that the other side knows who we are */
+		init_header(&hello, OP_HELLO, 0, 0, RLT_SUCCESS, 0,
+				sizeof(hello));
+		peer_send(c->site, &hello, sizeof(hello));
+	}
+
+	if (c->site)
+		peer_flush(peer_out + c->site->index);
+	peer_read(c);
+}
+
+static void peer_connect(struct booth_site *site)
+{
+	struct sockaddr_in6 sa;
+	struct peer_conn *c;
+	int fd, ci, one = 1;
+
+	fd = socket(site->family, SOCK_STREAM, 0);
+	if (fd == -1) {
+		log_error("cannot create socket of family %d", site->family);
+		return;
+	}
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	/* from our address, see peer_deliver() */
+	memcpy(&sa, &local->sa6, local->saddrlen);
+	sa.sin6_port = 0;	/* same place in sockaddr_in */
+	if (bind(fd, (struct sockaddr *)&sa, local->saddrlen) < 0)
+		log_warn("cannot bind to %s: %s",
+				site_string(local), strerror(errno));
+	if (connect(fd, (struct sockaddr *)&site->sa6, site->saddrlen) < 0 &&
+			errno != EINPROGRESS) {
+		log_debug("connect to %s failed: %s",
+				site_string(site), strerror(errno));
+		close(fd);
+		return;
+	}
+
+	ci = client_add(fd, booth_transport + TCP_PEER, peer_work, peer_dead);
+	c = peer_new(ci, site);
+	if (!c) {
+		client_dead(ci);
+		return;
+	}
+
+	c->connecting = 1;
+	pollfds[ci].events = POLLIN | POLLOUT;
+	peer_out[site->index].conn = c;
+}
+
+/* Called from process_connection() with the first header read;
+ * returns 1 if the connection is from another site. */
+int tcp_peer_adopt(int ci, struct boothc_header *h)
+{
+	struct peer_conn *c;
+
+	/* client commands are 'C'... */
+	if (booth_conf->proto != TCP_PEER || (ntohl(h->cmd) >> 24) == 'C')
+		return 0;
+
+	c = peer_new(ci, NULL);
+	if (!c) {
+		client_dead(ci);
+		return 1;
+	}
+
+	fcntl(clients[ci].fd, F_SETFL, O_NONBLOCK);
+	clients[ci].transport = booth_transport + TCP_PEER;
+	clients[ci].workfn = peer_work;
+	clients[ci].deadfn = peer_dead;
+	memcpy(c->in, h, sizeof(*h));
+	c->in_len = sizeof(*h);
+	peer_read(c);
+	return 1;
+}
+
+static int tcp_peer_sendto(struct booth_site *to, void *buf, int len)
+{
+	struct peer_out *po = peer_out + to->index;
+
+	if (!po->buf) {
+		po->buf = malloc(PEER_OUT_MAX);
+		if (!po->buf) {
+			log_error("out of memory");
+			return -ENOMEM;
+		}
+	}
+
+	/* logged once, and once again when it drained */
+	if (po->len + len > PEER_OUT_MAX) {
+		if (!po->full)
+			log_warn("queue for %s full, dropping messages",
+					site_string(to));
+		po->full = 1;
+		po->dropped++;
+		po->dropped_total++;
+		return -ENOBUFS;
+	}
+
+	memcpy(po->buf + po->len, buf, len);
+	po->len += len;
+	peer_flush(po);
+	return 0;
+}
+
+/* For "booth stats". */
+static int tcp_peer_stats(char *buf, int size, const char *shard)
+{
+	struct booth_site *site;
+	struct peer_out *po;
+	int i, len;
+
+	len = 0;
+	foreach_node(i, site) {
+		if (site == local)
+			continue;
+		po = peer_out + site->index;
+		len += snprintf(buf + len, size - len,
+				"%stcp: %s, %s, queued: %d, dropped: %u\n",
+				shard, site_string(site),
+				po->conn && !po->conn->connecting ?
+				"connected" : "not connected",
+				po->len, po->dropped_total);
+	}
+	return len;
+}
+
+/* (Re)connect to the sites with higher IDs. */
+static void tcp_peer_cron(void)
+{
+	struct booth_site *site;
+	struct peer_out *po;
+	time_t now;
+	int i;
+
+	now = get_secs(NULL);
+	foreach_node(i, site) {
+		po = peer_out + site->index;
+		if (site == local || site->site_id < local->site_id ||
+				po->conn || now < po->next_try)
+			continue;
+
+		po->retry = po->retry ? min(2 * po->retry, PEER_RETRY_MAX) : 1;
+		po->next_try = now + po->retry;
+		peer_connect(site);
+	}
+}
+
+/* Until a site heard another over the group, nobody sends to it;
+ * so the group gets a probe now and then. */
+static void mcast_cron(void)
+{
+	static time_t next_probe;
+	struct boothc_header probe;
+	time_t now;
+
+	now = get_secs(NULL);
+	if (mcast_fd < 0 || mcast_heard || now < next_probe)
+		return;
+	next_probe = now + MCAST_PROBE_INTERVAL;
+
+	init_header(&probe, OP_MCAST_PROBE, 0, 0,
+			RLT_SUCCESS, 0, sizeof(probe));
+	finish_msg(&probe, sizeof(probe));
+	(void)mcast_sendto(&probe, sizeof(probe));
+}
+
+void transport_cron(void)
+{
+	if (!booth_conf || !local_addr_up())
+		return;
+
+	if (booth_conf->proto == TCP_PEER) {
+		tcp_peer_cron();
+	} else if (booth_conf->proto == UDP) {
+		udp_path_cron();
+		mcast_cron();
+	}
+}
+
+static int booth_tcp_peer_init(void *f)
+{
+	deliver_fn = f;
+	tcp_peer_cron();
+	return 0;
+}
+
+static int booth_tcp_peer_send(struct booth_site *to, void *buf, int len)
+{
+	return peer_send(to, buf, len);
+}
+
+static int peer_sendto(struct booth_site *to, void *buf, int len)
+{
+	/* as if lost on the way */
+	if (!local_addr_up())
+		return 0;
+
+	if (booth_conf->proto == TCP_PEER)
+		return tcp_peer_sendto(to, buf, len);
+#ifdef HAVE_LINUX_SCTP_H
+	if (booth_conf->proto == SCTP)
+		return sctp_sendto(to, buf, len);
+#endif
+	return udp_sendto(to, buf, len);
+}
+
+static int booth_sctp_send(struct booth_site *to, void *buf, int len)
+{
+	return peer_send(to, buf, len);
+}
+
+static int return_0_booth_site(struct booth_site *v __attribute((unused)))
+{
+	return 0;
+}
+
+static int return_0(void)
+{
+	return 0;
+}
+const struct booth_transport booth_transport[TRANSPORT_ENTRIES] = {
+	[TCP] = {
+		.name = "TCP",
+		.init = booth_tcp_init,
+		.open = booth_tcp_open,
+		.send = booth_tcp_send,
+		.recv = booth_tcp_recv,
+		.close = booth_tcp_close,
+		.exit = booth_tcp_exit
+	},
+	[UDP] = {
+		.name = "UDP",
+		.init = booth_udp_init,
+		.open = return_0_booth_site,
+		.send = booth_udp_send,
+		.close = return_0_booth_site,
+		.broadcast = peer_broadcast,
+		.exit = booth_udp_exit,
+		.max_msg = BOOTH_MAX_DGRAM,
 	},
 	[SCTP] = {
 		.name = "SCTP",
 		.init = booth_sctp_init,
 		.open = return_0_booth_site,
 		.send = booth_sctp_send,
-		.broadcast = booth_sctp_broadcast,
+		.close = return_0_booth_site,
+		.broadcast = peer_broadcast,
 		.exit = return_0,
-	}
+		.max_msg = BOOTH_MAX_DGRAM,
+	},
+	[TCP_PEER] = {
+		.name = "TCP (sites)",
+		.init = booth_tcp_peer_init,
+		.open = return_0_booth_site,
+		.send = booth_tcp_peer_send,
+		.close = return_0_booth_site,
+		.broadcast = peer_broadcast,
+		.exit = return_0,
+		.max_msg = FRAME_SIZE_MAX,
+	},
 };
 
 const struct booth_transport *local_transport = booth_transport+TCP;
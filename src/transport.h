@@ -26,6 +26,7 @@ typedef enum {
 	TCP = 1,
 	UDP,
 	SCTP,
+	TCP_PEER,	/* "transport = TCP", between sites */
 	TRANSPORT_ENTRIES,
 } transport_layer_t;
 
@@ -46,15 +47,25 @@ struct booth_transport {
 	int (*broadcast) (void *, int);
 	int (*close) (struct booth_site *);
 	int (*exit) (void);
+	/** Longest message to send between sites. */
+	int max_msg;
 };
 
 extern const struct booth_transport booth_transport[TRANSPORT_ENTRIES];
 int find_myself(struct booth_site **me, int fuzzy_allowed);
+int addr_watch_init(void);
+int local_addr_up(void);
 
 int check_boothc_header(struct boothc_header *data, int len_incl_data);
 
 int setup_tcp_listener(int test_only);
 int booth_udp_send(struct booth_site *to, void *buf, int len);
+int booth_udp_held(void);
+void booth_udp_release_held(int cnt);
+void booth_udp_drop_held(void);
+int tcp_peer_adopt(int ci, struct boothc_header *h);
+void transport_cron(void);
+int transport_answer_stats(int fd);
 
 int booth_tcp_open(struct booth_site *to);
 int booth_tcp_send(struct booth_site *to, void *buf, int len);
@@ -0,0 +1,645 @@
+/* 
+ * Copyright (C) 2026 agent <agent@local>
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "b_config.h"
+
+#ifdef HAVE_IO_URING
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "booth.h"
+#include "log.h"
+#include "uring.h"
+
+/* The event loop with io_uring: instead of poll() going over
+ * all sockets each time, the sockets are armed once and stay so
+ * until they are ready; re-arming and the wait take a single
+ * system call. Broadcasts are queued and submitted at once.
+ *
+ * Where the kernel has it (5.13), the polls are multishot, and
+ * stay armed after they fired. As the handlers take only part
+ * of what is there, a socket that was reported gets a one-shot
+ * poll, too, until it's quiet again; it stays level-triggered.
+ *
+ * The UDP sockets (6.0) don't need a poll at all: a multishot
+ * recvmsg puts the datagrams into a ring of buffers, and
+ * uring_recvmsg() takes them from there; that is one system
+ * call less for each. */
+
+#define URING_ENTRIES		256
+#define URING_SEND_SLOTS	64
+
+/* Each holds the struct io_uring_recvmsg_out, the address, the
+ * control data and the datagram. */
+#define URING_RX_BUFS		64
+#define URING_RX_BUF_SIZE	2048
+#define URING_RX_NAME		sizeof(struct sockaddr_storage)
+#define URING_RX_CONTROL	64
+#define URING_RX_GROUP		1
+
+/* What a completion is for, in the top bits of user_data; then
+ * the generation of the slot, and the slot itself. */
+#define TAG_POLL		(1ULL << 61)
+#define TAG_SEND		(2ULL << 61)
+#define TAG_CHECK		(3ULL << 61)
+#define TAG_RECV		(4ULL << 61)
+#define TAG_MASK		(7ULL << 61)
+#define GEN_MASK		0x1fffffff
+
+struct uring_poll_state {
+	int fd;
+	short events;
+	int armed;
+	int check;
+	int recv;
+	uint32_t gen;
+};
+
+/* A datagram waiting in one of the buffers. */
+struct uring_rx {
+	int ci;
+	int len;
+	unsigned bid;
+};
+
+struct uring_send {
+	int used;
+	struct msghdr mh;
+	struct iovec iov;
+	struct sockaddr_in6 addr;
+	char data[BOOTH_MAX_DGRAM];
+};
+
+static int ring_fd = -1;
+static unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+static unsigned *cq_head, *cq_tail, *cq_mask;
+static unsigned sq_entries;
+static struct io_uring_sqe *sqes;
+static struct io_uring_cqe *cqes;
+
+static struct uring_poll_state *polls;
+static int polls_alloc;
+
+static struct uring_send *sends;
+
+static int poll_multi = 1;
+static int recv_multi;
+static struct io_uring_buf_ring *rx_ring;
+static unsigned short rx_tail;
+static char *rx_bufs;
+static struct uring_rx rxq[URING_RX_BUFS];
+static int rxq_len;
+static struct msghdr rx_msg = {
+	.msg_namelen = URING_RX_NAME,
+	.msg_controllen = URING_RX_CONTROL,
+};
+
+
+static int uring_enter(unsigned to_submit, unsigned min_complete,
+		unsigned flags, void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, ring_fd, to_submit,
+			min_complete, flags, arg, argsz);
+}
+
+/* Entries the kernel hasn't taken yet. */
+static unsigned sq_pending(void)
+{
+	return *sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+}
+
+void uring_submit(void)
+{
+	if (ring_fd >= 0 && sq_pending())
+		(void)uring_enter(sq_pending(), 0, 0, NULL, 0);
+}
+
+static struct io_uring_sqe *get_sqe(void)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail;
+
+	if (sq_pending() == sq_entries)
+		uring_submit();
+	if (sq_pending() == sq_entries)
+		return NULL;
+
+	tail = *sq_tail;
+	sqe = sqes + (tail & *sq_mask);
+	memset(sqe, 0, sizeof(*sqe));
+	sq_array[tail & *sq_mask] = tail & *sq_mask;
+	__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+
+static inline uint64_t slot_data(uint64_t tag, int ci)
+{
+	return tag | ((uint64_t)(polls[ci].gen & GEN_MASK) << 32) | ci;
+}
+
+/* Whether a completion is still for what's in the slot now. */
+static int slot_current(uint64_t data, int nfds)
+{
+	int ci = data & 0xffffffff;
+
+	return ci < nfds &&
+		((data >> 32) & GEN_MASK) == (polls[ci].gen & GEN_MASK);
+}
+
+static void rx_recycle(unsigned bid)
+{
+	struct io_uring_buf *b;
+
+	b = rx_ring->bufs + (rx_tail & (URING_RX_BUFS - 1));
+	b->addr = (uintptr_t)(rx_bufs + bid * URING_RX_BUF_SIZE);
+	b->len = URING_RX_BUF_SIZE;
+	b->bid = bid;
+	rx_tail++;
+	__atomic_store_n(&rx_ring->tail, rx_tail, __ATOMIC_RELEASE);
+}
+
+/* The ring of buffers for the multishot receive; needs 5.19, if
+ * it isn't there, the UDP sockets are polled. */
+static void rx_init(void)
+{
+	struct io_uring_buf_reg reg;
+	size_t len;
+	unsigned i;
+
+	len = URING_RX_BUFS * sizeof(struct io_uring_buf);
+	rx_ring = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (rx_ring == MAP_FAILED)
+		goto ex;
+	rx_bufs = malloc(URING_RX_BUFS * URING_RX_BUF_SIZE);
+	if (!rx_bufs)
+		goto ex_bufs;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uintptr_t)rx_ring;
+	reg.ring_entries = URING_RX_BUFS;
+	reg.bgid = URING_RX_GROUP;
+	if (syscall(__NR_io_uring_register, ring_fd,
+				IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		goto ex_reg;
+
+	for (i = 0; i < URING_RX_BUFS; i++)
+		rx_recycle(i);
+	recv_multi = 1;
+	return;
+
+ex_reg:
+	free(rx_bufs);
+	rx_bufs = NULL;
+ex_bufs:
+	munmap(rx_ring, len);
+ex:
+	rx_ring = NULL;
+}
+
+int uring_init(void)
+{
+	struct io_uring_params p;
+	size_t sq_len, cq_len;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (ring_fd < 0) {
+		log_info("io_uring not available (%s), using poll",
+				strerror(errno));
+		return -1;
+	}
+
+	/* the timeout of the wait needs 5.11 */
+	if (!(p.features & IORING_FEAT_EXT_ARG) ||
+			!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		log_info("io_uring too old, using poll");
+		goto ex;
+	}
+
+	sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (cq_len > sq_len)
+		sq_len = cq_len;
+	sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto ex_map;
+	cq = sq;
+
+	sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		goto ex_map;
+
+	sq_head  = (void *)(sq + p.sq_off.head);
+	sq_tail  = (void *)(sq + p.sq_off.tail);
+	sq_mask  = (void *)(sq + p.sq_off.ring_mask);
+	sq_array = (void *)(sq + p.sq_off.array);
+	sq_entries = p.sq_entries;
+	cq_head  = (void *)(cq + p.cq_off.head);
+	cq_tail  = (void *)(cq + p.cq_off.tail);
+	cq_mask  = (void *)(cq + p.cq_off.ring_mask);
+	cqes     = (void *)(cq + p.cq_off.cqes);
+
+	sends = calloc(URING_SEND_SLOTS, sizeof(*sends));
+	if (!sends) {
+		log_error("out of memory");
+		goto ex;
+	}
+
+	rx_init();
+
+	log_info("using io_uring%s",
+			recv_multi ? ", with multishot receive" : "");
+	return 0;
+
+ex_map:
+	log_error("cannot map io_uring: %s", strerror(errno));
+ex:
+	close(ring_fd);
+	ring_fd = -1;
+	return -1;
+}
+
+int uring_active(void)
+{
+	return ring_fd >= 0;
+}
+
+
+static void cancel(uint8_t opcode, uint64_t data)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = get_sqe();
+	if (sqe) {
+		sqe->opcode = opcode;
+		sqe->fd = -1;
+		sqe->addr = data;
+	}
+}
+
+/* Gives back the buffers of what wasn't taken. */
+static void rx_drop(int ci)
+{
+	int i, j;
+
+	for (i = j = 0; i < rxq_len; i++) {
+		if (rxq[i].ci == ci)
+			rx_recycle(rxq[i].bid);
+		else
+			rxq[j++] = rxq[i];
+	}
+	rxq_len = j;
+}
+
+/* The socket may be closed; the poll holds on to it until
+ * removed. */
+void uring_poll_del(int ci)
+{
+	struct uring_poll_state *st;
+
+	if (ring_fd < 0 || ci >= polls_alloc)
+		return;
+
+	st = polls + ci;
+	if (st->armed)
+		cancel(st->recv ? IORING_OP_ASYNC_CANCEL : IORING_OP_POLL_REMOVE,
+				slot_data(st->recv ? TAG_RECV : TAG_POLL, ci));
+	if (st->check)
+		cancel(IORING_OP_POLL_REMOVE, slot_data(TAG_CHECK, ci));
+	if (st->recv)
+		rx_drop(ci);
+	st->armed = 0;
+	st->check = 0;
+	st->recv = 0;
+	st->gen++;
+}
+
+static int polls_grow(int nfds)
+{
+	struct uring_poll_state *p;
+
+	if (nfds <= polls_alloc)
+		return 0;
+
+	p = realloc(polls, nfds * sizeof(*polls));
+	if (!p)
+		return -1;
+	memset(p + polls_alloc, 0, (nfds - polls_alloc) * sizeof(*p));
+	polls = p;
+	polls_alloc = nfds;
+	return 0;
+}
+
+int uring_recv_multi(int ci)
+{
+	if (ring_fd < 0 || !recv_multi || polls_grow(ci + 1) < 0)
+		return -1;
+	polls[ci].recv = 1;
+	return 0;
+}
+
+static void recv_done(struct io_uring_cqe *cqe, int ci)
+{
+	unsigned bid;
+
+	if (cqe->flags & IORING_CQE_F_BUFFER) {
+		bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		if (cqe->res < 0 || rxq_len == URING_RX_BUFS) {
+			rx_recycle(bid);
+		} else {
+			rxq[rxq_len].ci = ci;
+			rxq[rxq_len].len = cqe->res;
+			rxq[rxq_len].bid = bid;
+			rxq_len++;
+		}
+	}
+
+	if (cqe->flags & IORING_CQE_F_MORE)
+		return;
+
+	/* out of buffers, say; armed again in uring_poll() */
+	polls[ci].armed = 0;
+	if (cqe->res == -EINVAL) {
+		log_info("no multishot receive, polling the UDP sockets");
+		recv_multi = 0;
+	}
+	if (!recv_multi)
+		polls[ci].recv = 0;
+}
+
+static void reap(struct pollfd *fds, int nfds)
+{
+	struct io_uring_cqe *cqe;
+	struct uring_poll_state *st;
+	unsigned head;
+	uint64_t data;
+	int ci;
+
+	head = *cq_head;
+	while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = cqes + (head & *cq_mask);
+		data = cqe->user_data;
+		head++;
+
+		ci = data & 0xffffffff;
+		st = polls + ci;
+		switch (data & TAG_MASK) {
+		case TAG_POLL:
+		case TAG_CHECK:
+			if (!slot_current(data, nfds))
+				break;
+			if ((data & TAG_MASK) == TAG_CHECK)
+				st->check = 0;
+			else if (!(cqe->flags & IORING_CQE_F_MORE))
+				st->armed = 0;
+
+			if (cqe->res >= 0) {
+				fds[ci].revents |= cqe->res;
+			} else if (cqe->res == -EINVAL && poll_multi &&
+					(data & TAG_MASK) == TAG_POLL) {
+				/* before 5.13; armed again as one-shot */
+				poll_multi = 0;
+			} else if (cqe->res != -ECANCELED) {
+				fds[ci].revents |= POLLNVAL;
+			}
+			break;
+
+		case TAG_RECV:
+			if (slot_current(data, nfds) && st->recv)
+				recv_done(cqe, ci);
+			else if (cqe->flags & IORING_CQE_F_BUFFER)
+				rx_recycle(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+			break;
+
+		case TAG_SEND:
+			sends[data & ~TAG_MASK].used = 0;
+			if (cqe->res < 0)
+				log_error("Cannot send: %s", strerror(-cqe->res));
+			break;
+		}
+	}
+	__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+static int arm_poll(struct pollfd *fd, uint64_t tag, int ci, int multi)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = get_sqe();
+	if (!sqe)
+		return -1;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd->fd;
+	sqe->poll32_events = fd->events;
+	sqe->len = multi ? IORING_POLL_ADD_MULTI : 0;
+	sqe->user_data = slot_data(tag, ci);
+	return 0;
+}
+
+static int arm_recv(struct pollfd *fd, int ci)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = get_sqe();
+	if (!sqe)
+		return -1;
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = fd->fd;
+	sqe->addr = (uintptr_t)&rx_msg;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_RX_GROUP;
+	sqe->user_data = slot_data(TAG_RECV, ci);
+	return 0;
+}
+
+/* Like poll(); see at the top for how it stays level-triggered. */
+int uring_poll(struct pollfd *fds, int nfds, int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	struct uring_poll_state *st;
+	int i, rv, cnt, wait;
+
+	if (polls_grow(nfds) < 0)
+		return poll(fds, nfds, timeout);
+
+	for (i = 0; i < nfds; i++) {
+		st = polls + i;
+		/* reported the last time */
+		if (fds[i].revents && !st->recv && st->armed &&
+				!st->check && !arm_poll(fds + i, TAG_CHECK, i, 0))
+			st->check = 1;
+		fds[i].revents = 0;
+
+		if ((st->armed || st->check) &&
+				(st->fd != fds[i].fd || st->events != fds[i].events))
+			uring_poll_del(i);
+		if (st->armed || fds[i].fd < 0)
+			continue;
+
+		if (st->recv ? arm_recv(fds + i, i) :
+				arm_poll(fds + i, TAG_POLL, i, poll_multi))
+			break;
+		st->fd = fds[i].fd;
+		st->events = fds[i].events;
+		st->armed = 1;
+	}
+
+	/* no waiting while datagrams are there */
+	wait = !rxq_len;
+	memset(&arg, 0, sizeof(arg));
+	if (timeout >= 0 || !wait) {
+		ts.tv_sec = wait ? timeout / 1000 : 0;
+		ts.tv_nsec = wait ? (timeout % 1000) * 1000000 : 0;
+		arg.ts = (uintptr_t)&ts;
+	}
+	rv = 0;
+	if (wait || sq_pending())
+		rv = uring_enter(sq_pending(), wait,
+				IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+				&arg, sizeof(arg));
+	if (rv < 0 && errno != ETIME && errno != EINTR)
+		return rv;
+
+	reap(fds, nfds);
+	for (i = 0; i < rxq_len; i++)
+		if (rxq[i].ci < nfds)
+			fds[rxq[i].ci].revents |= POLLIN;
+	cnt = 0;
+	for (i = 0; i < nfds; i++)
+		if (fds[i].revents)
+			cnt++;
+
+	if (!cnt && rv < 0 && errno == EINTR)
+		return rv;
+	return cnt;
+}
+
+
+/* Like recvmsg(); from the buffers if the socket has a multishot
+ * receive, else directly. */
+int uring_recvmsg(int ci, int fd, struct msghdr *mh, int flags)
+{
+	struct io_uring_recvmsg_out *out;
+	struct iovec *iov = mh->msg_iov;
+	char *buf, *name, *control, *payload;
+	int i, len, need;
+
+	if (ring_fd < 0 || ci >= polls_alloc || !polls[ci].recv)
+		return recvmsg(fd, mh, flags);
+
+	for (i = 0; i < rxq_len && rxq[i].ci != ci; i++)
+		;
+	if (i == rxq_len) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	buf = rx_bufs + rxq[i].bid * URING_RX_BUF_SIZE;
+	out = (void *)buf;
+	name = buf + sizeof(*out);
+	control = name + URING_RX_NAME;
+	payload = control + URING_RX_CONTROL;
+	need = sizeof(*out) + URING_RX_NAME + URING_RX_CONTROL;
+
+	len = -1;
+	if (rxq[i].len >= need &&
+			out->payloadlen <= rxq[i].len - need) {
+		len = out->payloadlen;
+		mh->msg_flags = out->flags;
+		if (mh->msg_name) {
+			mh->msg_namelen = min(mh->msg_namelen, out->namelen);
+			memcpy(mh->msg_name, name, mh->msg_namelen);
+		}
+		if (mh->msg_controllen < out->controllen)
+			mh->msg_flags |= MSG_CTRUNC;
+		mh->msg_controllen = min(mh->msg_controllen, out->controllen);
+		memcpy(mh->msg_control, control, mh->msg_controllen);
+		if (len > iov->iov_len) {
+			len = iov->iov_len;
+			mh->msg_flags |= MSG_TRUNC;
+		}
+		memcpy(iov->iov_base, payload, len);
+	}
+
+	rx_recycle(rxq[i].bid);
+	rxq_len--;
+	memmove(rxq + i, rxq + i + 1, (rxq_len - i) * sizeof(*rxq));
+
+	if (len < 0)
+		errno = EIO;
+	return len;
+}
+
+/* Queued until uring_submit(); returns -1 if it has to be sent
+ * directly. */
+int uring_sendto(int fd, const void *buf, int len,
+		const struct sockaddr *addr, socklen_t addrlen)
+{
+	struct io_uring_sqe *sqe;
+	struct uring_send *s;
+	int i;
+
+	if (ring_fd < 0 || len > sizeof(s->data) ||
+			addrlen > sizeof(s->addr))
+		return -1;
+
+	for (i = 0; i < URING_SEND_SLOTS && sends[i].used; i++)
+		;
+	if (i == URING_SEND_SLOTS)
+		return -1;
+
+	sqe = get_sqe();
+	if (!sqe)
+		return -1;
+
+	s = sends + i;
+	s->used = 1;
+	memcpy(s->data, buf, len);
+	memcpy(&s->addr, addr, addrlen);
+	s->iov.iov_base = s->data;
+	s->iov.iov_len = len;
+	memset(&s->mh, 0, sizeof(s->mh));
+	s->mh.msg_name = &s->addr;
+	s->mh.msg_namelen = addrlen;
+	s->mh.msg_iov = &s->iov;
+	s->mh.msg_iovlen = 1;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)&s->mh;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = TAG_SEND | i;
+	return 0;
+}
+
+#endif /* HAVE_IO_URING */
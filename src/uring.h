@@ -0,0 +1,64 @@
+/* 
+ * Copyright (C) 2026 agent <agent@local>
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _URING_H
+#define _URING_H
+
+#include <poll.h>
+#include <sys/socket.h>
+#include "b_config.h"
+
+#ifdef HAVE_IO_URING
+
+int uring_init(void);
+int uring_active(void);
+int uring_poll(struct pollfd *fds, int nfds, int timeout);
+void uring_poll_del(int ci);
+int uring_recv_multi(int ci);
+int uring_recvmsg(int ci, int fd, struct msghdr *mh, int flags);
+int uring_sendto(int fd, const void *buf, int len,
+		const struct sockaddr *addr, socklen_t addrlen);
+void uring_submit(void);
+
+#else
+
+/* Without io_uring, poll(), recvmsg() and sendto() are used
+ * directly. */
+static inline int uring_init(void) { return -1; }
+static inline int uring_active(void) { return 0; }
+static inline int uring_poll(struct pollfd *fds, int nfds, int timeout)
+{
+	return poll(fds, nfds, timeout);
+}
+static inline void uring_poll_del(int ci) { }
+static inline int uring_recv_multi(int ci) { return -1; }
+static inline int uring_recvmsg(int ci, int fd, struct msghdr *mh,
+		int flags)
+{
+	return recvmsg(fd, mh, flags);
+}
+static inline int uring_sendto(int fd, const void *buf, int len,
+		const struct sockaddr *addr, socklen_t addrlen)
+{
+	return -1;
+}
+static inline void uring_submit(void) { }
+
+#endif
+
+#endif /* _URING_H */
@@ -0,0 +1,257 @@
+/* 
+ * Copyright (C) 2026 agent <agent@local>
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include "booth.h"
+#include "log.h"
+#include "worker.h"
+
+/* The event loop runs with SCHED_RR (see set_scheduler()) and does
+ * the protocol: renewals, acks, expiry. Anything that may block
+ * for long is handed to a worker thread, through a queue without
+ * locks (one writer, one reader each way); the results come back
+ * via an eventfd in the loop. Each kind of job has a worker of its
+ * own, so a slow CIB can't hold back the handlers of a renewal or
+ * the journal; within one worker jobs run in order, so CIB
+ * updates can't overtake each other. */
+
+#define WORKER_QUEUE		256
+#define WORKER_STACK		(256 * 1024)
+
+struct worker_job {
+	worker_fn run;
+	worker_fn done;
+	void *arg;
+};
+
+struct job_ring {
+	struct worker_job *job;
+	/* each written by one side only */
+	unsigned head;
+	unsigned tail;
+};
+
+static struct worker {
+	const char *name;
+	/* a power of two */
+	unsigned size;
+	struct job_ring todo, finished;
+	/* queued and not yet done; bounds both rings */
+	unsigned pending;
+	int wake_fd;
+	int done_fd;
+	pthread_t thread;
+	int running;
+} workers[WORKER_COUNT] = {
+	[WORKER_CIB]		= { .name = "CIB" },
+	[WORKER_HANDLER]	= { .name = "handler" },
+	[WORKER_JOURNAL]	= { .name = "journal" },
+};
+
+
+static int ring_put(struct worker *w, struct job_ring *r,
+		const struct worker_job *job)
+{
+	unsigned tail = r->tail;
+
+	if (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == w->size)
+		return -EAGAIN;
+	r->job[tail & (w->size - 1)] = *job;
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static int ring_get(struct worker *w, struct job_ring *r,
+		struct worker_job *job)
+{
+	unsigned head = r->head;
+
+	if (head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))
+		return 0;
+	*job = r->job[head & (w->size - 1)];
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static int kick(int fd)
+{
+	uint64_t one = 1;
+
+	/* can only fail if the counter is about to overflow */
+	return write(fd, &one, sizeof(one)) == sizeof(one) ? 0 : -1;
+}
+
+
+/* Must not log or touch the configuration; the jobs get copies
+ * of what they need. */
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	struct worker_job job;
+	uint64_t cnt;
+
+	while (1) {
+		while (ring_get(w, &w->todo, &job)) {
+			job.run(job.arg);
+			/* there's room, see worker_queue() */
+			ring_put(w, &w->finished, &job);
+			kick(w->done_fd);
+		}
+		/* the counter keeps a wakeup that came in meanwhile */
+		if (read(w->wake_fd, &cnt, sizeof(cnt)) < 0 && errno != EINTR)
+			break;
+	}
+	return NULL;
+}
+
+
+static void process_worker_done(int ci)
+{
+	struct worker *w;
+	struct worker_job job;
+	uint64_t cnt;
+
+	for (w = workers; w < workers + WORKER_COUNT; w++)
+		if (w->running && w->done_fd == clients[ci].fd)
+			break;
+	if (w == workers + WORKER_COUNT)
+		return;
+
+	/* just resets the counter */
+	if (read(w->done_fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+		return;
+	while (ring_get(w, &w->finished, &job)) {
+		w->pending--;
+		if (job.done)
+			job.done(job.arg);
+	}
+}
+
+
+static int start_worker(struct worker *w, unsigned size, int inherit)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+	int rv;
+
+	w->size = size;
+	w->todo.job = calloc(size, sizeof(struct worker_job));
+	w->finished.job = calloc(size, sizeof(struct worker_job));
+	w->wake_fd = eventfd(0, EFD_CLOEXEC);
+	w->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (!w->todo.job || !w->finished.job) {
+		log_error("out of memory");
+		goto fail;
+	}
+	if (w->wake_fd < 0 || w->done_fd < 0) {
+		log_error("cannot create eventfd: %s", strerror(errno));
+		goto fail;
+	}
+
+	pthread_attr_init(&attr);
+	if (!inherit) {
+		/* Not SCHED_RR like the loop; the programs it starts
+		 * inherit that, too. */
+		memset(&param, 0, sizeof(param));
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+	/* all memory is locked, see set_scheduler() */
+	pthread_attr_setstacksize(&attr, WORKER_STACK);
+	rv = pthread_create(&w->thread, &attr, worker_main, w);
+	pthread_attr_destroy(&attr);
+	if (rv) {
+		log_error("cannot start %s worker: %s", w->name, strerror(rv));
+		goto fail;
+	}
+
+	client_add(w->done_fd, NULL, process_worker_done, NULL);
+	w->running = 1;
+	return 0;
+
+fail:
+	free(w->todo.job);
+	free(w->finished.job);
+	w->todo.job = w->finished.job = NULL;
+	if (w->wake_fd >= 0)
+		close(w->wake_fd);
+	if (w->done_fd >= 0)
+		close(w->done_fd);
+	w->wake_fd = w->done_fd = -1;
+	return -1;
+}
+
+
+int worker_init(void)
+{
+	unsigned size;
+	int rv = 0;
+
+	/* A renewal has at most a test and a verdict per ticket
+	 * running, see handler.c; room for twice that. */
+	size = WORKER_QUEUE;
+	while (size < 2 * booth_conf->ticket_count)
+		size *= 2;
+
+	if (start_worker(workers + WORKER_CIB, WORKER_QUEUE, 0) < 0)
+		rv = -1;
+	if (start_worker(workers + WORKER_HANDLER, size, 0) < 0)
+		rv = -1;
+	/* The journal holds back our messages until it's synced,
+	 * so it gets the priority of the loop. */
+	if (start_worker(workers + WORKER_JOURNAL, WORKER_QUEUE, 1) < 0)
+		rv = -1;
+	return rv;
+}
+
+
+/** Has 'run' called with 'arg' in the given worker thread, and
+ * then 'done' in the event loop. Without the thread (before the
+ * loop, in the client, or if it couldn't start) both run right
+ * away. Returns -EAGAIN if too much is queued already. */
+int worker_queue(int worker, worker_fn run, worker_fn done, void *arg)
+{
+	struct worker *w = workers + worker;
+	struct worker_job job;
+
+	if (!w->running) {
+		run(arg);
+		if (done)
+			done(arg);
+		return 0;
+	}
+
+	if (w->pending == w->size)
+		return -EAGAIN;
+
+	job.run = run;
+	job.done = done;
+	job.arg = arg;
+	ring_put(w, &w->todo, &job);
+	w->pending++;
+	kick(w->wake_fd);
+	return 0;
+}
@@ -0,0 +1,39 @@
+/* 
+ * Copyright (C) 2026 agent <agent@local>
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _WORKER_H
+#define _WORKER_H
+
+/* Slow work (eg. the CIB updates via crm_ticket) runs on threads
+ * of its own, so that the event loop keeps its timing; see
+ * worker.c. */
+
+enum {
+	WORKER_CIB,
+	WORKER_HANDLER,
+	WORKER_JOURNAL,
+	WORKER_COUNT
+};
+
+typedef void (*worker_fn)(void *arg);
+
+int worker_init(void);
+int worker_queue(int worker, worker_fn run, worker_fn done, void *arg);
+
+
+#endif /* _WORKER_H */
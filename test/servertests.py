@@ -3,6 +3,7 @@
 import copy
 from   pprint    import pprint, pformat
 import re
+import socket
 import string
 
 from   serverenv import ServerTestEnvironment
@@ -105,6 +106,16 @@ class ServerTests(ServerTestEnvironment):
             self.run_booth(config_text=config, expected_exitcode=1, expected_daemon=False)
         self.assertRegexpMatches(stderr, 'invalid transport protocol')
 
+    def test_sctp_transport(self):
+        # the kernel may come without SCTP
+        try:
+            socket.socket(socket.AF_INET, socket.SOCK_SEQPACKET, 132).close()
+        except socket.error:
+            return True
+        config = re.sub('transport=.+', 'transport="SCTP"', self.working_config)
+        (pid, ret, stdout, stderr, runner) = \
+            self.run_booth(config_text=config, expected_exitcode=0, expected_daemon=True)
+
     def test_missing_final_newline(self):
         config = re.sub('\n$', '', self.working_config)
         (pid, ret, stdout, stderr, runner) = \